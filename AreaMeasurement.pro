@@ -4,31 +4,12 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui svg
 
 TARGET = AreaMeasurement
 TEMPLATE = app
 
 
-SOURCES += main.cpp\
-        mainwindow.cpp \
-    canvaswidget.cpp \
-    defines.cpp \
-    figure.cpp \
-    paint_utils.cpp \
-    selection.cpp \
-    shape.cpp
+SOURCES += main.cpp
 
-HEADERS  += mainwindow.h \
-    canvaswidget.h \
-    defines.h \
-    figure.h \
-    paint_utils.h \
-    selection.h \
-    shape.h \
-    debug_utils.h
-
-FORMS    += mainwindow.ui
-
-RESOURCES += \
-    resources.qrc
+include(AreaMeasurementApp.pri)
@@ -0,0 +1,54 @@
+# Everything of the application except main.cpp, shared with the benchmark
+
+include(AreaMeasurementShapes.pri)
+
+SOURCES += \
+    mainwindow.cpp \
+    canvaswidget.cpp \
+    color_census.cpp \
+    edge_snapping.cpp \
+    figure.cpp \
+    figure_index.cpp \
+    flood_fill.cpp \
+    gradient_pyramid.cpp \
+    image_pyramid.cpp \
+    overlay_cache.cpp \
+    paint_utils.cpp \
+    perf_stats.cpp \
+    selection.cpp \
+    session.cpp \
+    simplification.cpp \
+    tiff_tile_source.cpp \
+    tiff_writer.cpp \
+    tile_loader.cpp \
+    tile_source.cpp \
+    zoom_renderer.cpp
+
+HEADERS += \
+    mainwindow.h \
+    canvaswidget.h \
+    color_census.h \
+    color_range.h \
+    edge_snapping.h \
+    figure.h \
+    figure_index.h \
+    flood_fill.h \
+    gradient_pyramid.h \
+    image_pyramid.h \
+    overlay_cache.h \
+    paint_utils.h \
+    perf_stats.h \
+    selection.h \
+    session.h \
+    simplification.h \
+    slot_map.h \
+    tiff_tile_source.h \
+    tiff_writer.h \
+    tile_loader.h \
+    tile_source.h \
+    zoom_renderer.h
+
+FORMS    += mainwindow.ui
+
+RESOURCES += \
+    resources.qrc
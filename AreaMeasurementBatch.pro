@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Headless batch measurement of shapes from a text file
+#
+#-------------------------------------------------
+
+# QPolygonF lives in QtGui, but no QApplication is created, so no display is needed
+QT       += core gui
+
+TARGET = AreaMeasurementBatch
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+
+SOURCES += batch.cpp
+
+include(AreaMeasurementShapes.pri)
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Performance benchmarks for geometry and interaction code
+#
+#-------------------------------------------------
+
+# Figure and canvas benchmarks need the whole application except main.cpp
+QT       += core gui svg
+
+TARGET = AreaMeasurementBenchmark
+TEMPLATE = app
+CONFIG   += console release
+CONFIG   -= app_bundle
+
+
+SOURCES += benchmark.cpp
+
+include(AreaMeasurementApp.pri)
@@ -0,0 +1,18 @@
+# Shape geometry and measurement, shared by the application, the batch tool and the benchmark
+
+SOURCES += \
+    defines.cpp \
+    edge_index.cpp \
+    geometry.cpp \
+    measure_kernels.cpp \
+    shape.cpp \
+    sweep_line.cpp
+
+HEADERS += \
+    defines.h \
+    edge_index.h \
+    geometry.h \
+    measure_kernels.h \
+    shape.h \
+    sweep_line.h \
+    debug_utils.h
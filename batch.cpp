@@ -0,0 +1,264 @@
+// Headless batch measurement: reads shapes from a text file and writes their sizes, measured with the same Shape code as the app.
+//
+// Usage: AreaMeasurementBatch <input file or -> [<output file>]
+//
+// Input, one record per line; empty lines and lines starting with '#' are skipped:
+//   etalon <size> <type> x1 y1 x2 y2 ...   etalon shape and its real size: length in meters or area in square meters
+//   <type> x1 y1 x2 y2 ...                 shape to measure
+// Types are "segment", "polyline", "closed_polyline", "rectangle", "polygon" and "region". Coordinates are pixels of the original image.
+// A region is its boundary rings one after another, each closed, as the app saves them.
+// An etalon applies to all the shapes after it.
+//
+// Output, one tab-separated line per shape, in input order:
+//   <line number> <type> <status> <size in pixels> <size in meters or square meters>
+// Status is "ok", "self-intersecting" or "error: ...". Size in meters is "-" while there is no etalon.
+// A self-intersecting polygon is measured by the union of the regions it encloses.
+//
+// Lines are processed in chunks; a chunk is measured on all cores while the next one is being read.
+
+#include <cmath>
+#include <cstdio>
+
+#include <QFile>
+#include <QFuture>
+#include <QList>
+#include <QStringList>
+#include <QTextStream>
+#include <QtConcurrentMap>
+
+#include "defines.h"
+#include "shape.h"
+
+
+const int chunkSize = 16384;
+const int sizeOutputPrecision = 10;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Parsing
+
+struct Record
+{
+  int lineNumber;
+  QString text;
+  double metersPerPixel;  // 0 if there is no etalon yet
+};
+
+static bool isEtalonLine(const QString& trimmedLine)
+{
+  return trimmedLine.startsWith("etalon") && (trimmedLine.size() == 6 || trimmedLine[6].isSpace());
+}
+
+static bool parseShape(const QStringList& fields, int firstField, Shape& shape, QString& error)
+{
+  ShapeType shapeType;
+  if (firstField >= fields.size() || !parseShapeType(fields[firstField], shapeType)) {
+    error = "unknown shape type";
+    return false;
+  }
+  int nCoordinates = fields.size() - firstField - 1;
+  if (nCoordinates % 2 != 0) {
+    error = "odd number of coordinates";
+    return false;
+  }
+  int nVertices = nCoordinates / 2;
+  switch (shapeType) {
+    case SEGMENT:
+    case RECTANGLE:
+      if (nVertices != 2) {
+        error = "exactly 2 vertices expected";
+        return false;
+      }
+      break;
+    case POLYLINE:
+    case CLOSED_POLYLINE:
+      if (nVertices < 2) {
+        error = "at least 2 vertices expected";
+        return false;
+      }
+      break;
+    case POLYGON:
+      if (nVertices < 3) {
+        error = "at least 3 vertices expected";
+        return false;
+      }
+      break;
+    case REGION:
+      if (nVertices < 5) {
+        error = "at least 5 vertices expected";
+        return false;
+      }
+      break;
+  }
+
+  QPolygonF points;
+  for (int i = 0; i < nVertices; ++i) {
+    bool xIsOk = false;
+    bool yIsOk = false;
+    double x = fields[firstField + 1 + 2 * i    ].toDouble(&xIsOk);
+    double y = fields[firstField + 1 + 2 * i + 1].toDouble(&yIsOk);
+    if (!xIsOk || !yIsOk) {
+      error = "bad coordinate";
+      return false;
+    }
+    points.append(QPointF(x, y));
+  }
+
+  if (shapeType == REGION) {
+    shape = Shape(REGION, points);
+    if (!shape.regionRings().last().isClosed()) {
+      error = "region ring is not closed";
+      return false;
+    }
+    return true;
+  }
+  shape = Shape(shapeType);
+  foreach (QPointF point, points)
+    shape.addPoint(point);
+  if (!shape.isFinished())
+    shape.finish();
+  return true;
+}
+
+static double pixelSize(const Shape& shape)
+{
+  switch (shape.dimensionality()) {
+    case SHAPE_1D: return shape.length();
+    case SHAPE_2D: return shape.area();
+  }
+  ERROR_RETURN_V(0.);
+}
+
+// Same as CanvasWidget::defineEtalon
+static bool parseEtalon(const QStringList& fields, double& metersPerPixel, QString& error)
+{
+  bool sizeIsOk = false;
+  double etalonMetersSize = fields.size() > 1 ? fields[1].toDouble(&sizeIsOk) : 0.;
+  if (!sizeIsOk || etalonMetersSize <= 0.) {
+    error = "bad etalon size";
+    return false;
+  }
+  Shape shape(DEFAULT_TYPE);
+  if (!parseShape(fields, 2, shape, error))
+    return false;
+  if (!shape.isValid()) {
+    error = "self-intersecting etalon";
+    return false;
+  }
+  double size = pixelSize(shape);
+  if (size <= 0.) {
+    error = "degenerate etalon";
+    return false;
+  }
+  switch (shape.dimensionality()) {
+    case SHAPE_1D: metersPerPixel = etalonMetersSize / size;                       break;
+    case SHAPE_2D: metersPerPixel = std::sqrt(etalonMetersSize) / std::sqrt(size); break;
+  }
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Measurement
+
+// Called on worker threads
+static QString measureRecord(const Record& record)
+{
+  QStringList fields = record.text.simplified().split(' ');
+  QString result = QString::number(record.lineNumber) + '\t' + fields.first() + '\t';
+  Shape shape(DEFAULT_TYPE);
+  QString error;
+  if (!parseShape(fields, 0, shape, error))
+    return result + "error: " + error + "\t-\t-";
+
+  QString status = shape.isValid() ? "ok" : "self-intersecting";
+  double size = pixelSize(shape);
+  result += status + '\t' + QString::number(size, 'g', sizeOutputPrecision) + '\t';
+  if (record.metersPerPixel <= 0.)
+    return result + '-';
+  double metersSize = 0.;
+  switch (shape.dimensionality()) {
+    case SHAPE_1D: metersSize = size * record.metersPerPixel;      break;
+    case SHAPE_2D: metersSize = size * sqr(record.metersPerPixel); break;
+  }
+  return result + QString::number(metersSize, 'g', sizeOutputPrecision);
+}
+
+static void writeResults(const QFuture<QString>& results, QTextStream& output)
+{
+  for (int i = 0; i < results.resultCount(); ++i)
+    output << results.resultAt(i) << '\n';
+  output.flush();
+}
+
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2 || argc > 3) {
+    std::fprintf(stderr, "Usage: %s <input file or -> [<output file>]\n", argv[0]);
+    return 2;
+  }
+
+  QFile inputFile;
+  bool inputIsOpen = false;
+  if (QString(argv[1]) == "-") {
+    inputIsOpen = inputFile.open(stdin, QIODevice::ReadOnly | QIODevice::Text);
+  }
+  else {
+    inputFile.setFileName(QString::fromLocal8Bit(argv[1]));
+    inputIsOpen = inputFile.open(QIODevice::ReadOnly | QIODevice::Text);
+  }
+  if (!inputIsOpen) {
+    std::fprintf(stderr, "Cannot open input file %s\n", argv[1]);
+    return 1;
+  }
+
+  QFile outputFile;
+  bool outputIsOpen = false;
+  if (argc < 3) {
+    outputIsOpen = outputFile.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+  }
+  else {
+    outputFile.setFileName(QString::fromLocal8Bit(argv[2]));
+    outputIsOpen = outputFile.open(QIODevice::WriteOnly | QIODevice::Text);
+  }
+  if (!outputIsOpen) {
+    std::fprintf(stderr, "Cannot open output file %s\n", argv[2]);
+    return 1;
+  }
+
+  QTextStream input(&inputFile);
+  QTextStream output(&outputFile);
+  double metersPerPixel = 0.;
+  int lineNumber = 0;
+  bool hasFailed = false;
+  QFuture<QString> previousChunk;
+  while (!input.atEnd() && !hasFailed) {
+    QList<Record> chunk;
+    while (chunk.size() < chunkSize && !input.atEnd() && !hasFailed) {
+      QString line = input.readLine();
+      lineNumber++;
+      QString trimmedLine = line.trimmed();
+      if (trimmedLine.isEmpty() || trimmedLine.startsWith('#'))
+        continue;
+      // Etalon changes the meaning of the lines after it, so it is handled right away
+      if (isEtalonLine(trimmedLine)) {
+        QString error;
+        if (!parseEtalon(trimmedLine.simplified().split(' '), metersPerPixel, error)) {
+          std::fprintf(stderr, "Line %d: %s\n", lineNumber, qPrintable(error));
+          hasFailed = true;  // shapes before the bad etalon are still measured
+        }
+        continue;
+      }
+      Record record = { lineNumber, line, metersPerPixel };
+      chunk.append(record);
+    }
+    QFuture<QString> currentChunk = QtConcurrent::mapped(chunk, measureRecord);
+    previousChunk.waitForFinished();
+    writeResults(previousChunk, output);
+    previousChunk = currentChunk;
+  }
+  previousChunk.waitForFinished();
+  writeResults(previousChunk, output);
+  return hasFailed ? 1 : 0;
+}
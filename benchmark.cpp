@@ -0,0 +1,580 @@
+// Performance benchmarks for geometry and interaction hot paths. Run a release build.
+//
+// Usage: AreaMeasurementBenchmark [--no-gui] [<name filter>]
+//   --no-gui       skip benchmarks that need a display (figure drawing and canvas)
+//   <name filter>  run only benchmarks whose names contain it
+//
+// Output is tab-separated, one line per measurement, so that results of two releases can be diffed or loaded as a table:
+//   <benchmark> <vertices> <nanoseconds per operation> <number of operations>
+// For image benchmarks the second column is the number of pixels.
+// Lines starting with '#' are comments.
+
+#include <cmath>
+#include <cstdio>
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QLabel>
+#include <QPainter>
+#include <QPolygonF>
+#include <QScrollArea>
+#include <QStringList>
+#include <QWheelEvent>
+
+#include "canvaswidget.h"
+#include "color_census.h"
+#include "edge_index.h"
+#include "edge_snapping.h"
+#include "figure.h"
+#include "flood_fill.h"
+#include "gradient_pyramid.h"
+#include "image_pyramid.h"
+#include "measure_kernels.h"
+#include "mainwindow.h"
+#include "selection.h"
+#include "session.h"
+#include "shape.h"
+#include "simplification.h"
+#include "sweep_line.h"
+#include "tile_source.h"
+
+
+const int minVertices = 10;
+const int maxVertices = 1000000;
+const int maxBruteForceVertices = 20000;
+const qint64 minMeasurementMilliseconds = 200;
+const int canvasImageSize = 2048;
+const QPointF shapeCenter = QPointF(canvasImageSize / 2, canvasImageSize / 2);
+const int gradientTileSize = 256;  // as in ImagePyramid
+const int lassoWindowSize = 256;   // the largest one the canvas traces in
+const int floodFillImageSize = 4096;
+
+static QString nameFilter;
+static volatile double sink = 0.;  // results go here, so that the compiler can't throw the work away
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Synthetic shapes
+
+// Simple star-shaped polygon with a wavy boundary, similar to a traced one.
+// It is the worst case for the self-intersection test: without a crossing there is nothing to stop early at.
+static QPolygonF makeStarPolygon(int nVertices)
+{
+  QPolygonF polygon;
+  for (int i = 0; i < nVertices; ++i) {
+    double angle = 2. * M_PI * i / nVertices;
+    double radius = 1000. * (1. + 0.3 * std::sin(7. * angle) + 0.01 * std::sin(997. * angle));
+    polygon.append(QPointF(radius * std::cos(angle), radius * std::sin(angle)));
+  }
+  polygon.append(polygon.first());
+  return polygon;
+}
+
+// Same polygon with a small twist every 50 vertices, like a hand-traced boundary crossing itself by accident
+static QPolygonF makeTangledPolygon(int nVertices)
+{
+  QPolygonF polygon = makeStarPolygon(nVertices);
+  for (int i = 1; i + 2 < polygon.size(); i += 50)
+    qSwap(polygon[i], polygon[i + 1]);
+  return polygon;
+}
+
+// Same polygon without the closing vertex, placed over the canvas image, as Shape keeps it
+static QPolygonF makeShapePoints(int nVertices)
+{
+  QPolygonF points = makeStarPolygon(nVertices);
+  points.pop_back();
+  return points.translated(shapeCenter);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Measurement
+
+class Operation
+{
+public:
+  virtual ~Operation()  { }
+  virtual void run() = 0;
+};
+
+static bool isEnabled(const char* benchmark)
+{
+  return QString(benchmark).contains(nameFilter);
+}
+
+// Repeats the operation for at least minMeasurementMilliseconds
+static void measure(const char* benchmark, int nVertices, Operation& operation)
+{
+  QElapsedTimer timer;
+  qint64 nRuns = 0;
+  timer.start();
+  do {
+    operation.run();
+    nRuns++;
+  } while (timer.elapsed() < minMeasurementMilliseconds);
+  std::printf("%s\t%d\t%.1f\t%lld\n", benchmark, nVertices, double(timer.nsecsElapsed()) / nRuns, (long long)nRuns);
+  std::fflush(stdout);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Geometry
+
+typedef bool (*SelfintersectionTest)(const QPolygonF&);
+
+class SelfintersectionOperation : public Operation
+{
+public:
+  SelfintersectionOperation(SelfintersectionTest test, const QPolygonF& polygon) : test_(test), polygon_(polygon)  { }
+  virtual void run()  { sink = sink + test_(polygon_); }
+
+private:
+  SelfintersectionTest test_;
+  QPolygonF polygon_;
+};
+
+class PolygonAreasOperation : public Operation
+{
+public:
+  PolygonAreasOperation(const QPolygonF& polygon) : polygon_(polygon)  { }
+  virtual void run()  { sink = sink + computePolygonAreas(polygon_).enclosedArea; }
+
+private:
+  QPolygonF polygon_;
+};
+
+class SimplificationOperation : public Operation
+{
+public:
+  SimplificationOperation(const QPolygonF& polygon, double tolerance) : polygon_(polygon), tolerance_(tolerance)  { }
+  virtual void run()  { sink = sink + simplifyPolyline(polygon_, tolerance_).size(); }
+
+private:
+  QPolygonF polygon_;
+  double tolerance_;
+};
+
+// Dragging one vertex back and forth, as the canvas does on every mouse move
+class IncrementalDragOperation : public Operation
+{
+public:
+  IncrementalDragOperation(const QPolygonF& points) :
+    edgeIndex_(points),
+    iVertex_(points.size() / 2),
+    originalPos_(points[iVertex_]),
+    draggedPos_(originalPos_ + (points[iVertex_ + 1] - originalPos_) * 0.3),
+    nDrags_(0)
+  { }
+  virtual void run()  { edgeIndex_.moveVertex(iVertex_, nDrags_++ % 2 ? originalPos_ : draggedPos_); }
+
+private:
+  EdgeIndex edgeIndex_;
+  int iVertex_;
+  QPointF originalPos_;
+  QPointF draggedPos_;
+  int nDrags_;
+};
+
+// Shape caches its measurements, so every run measures a fresh shape. Vertices are shared, not copied.
+class ShapeMeasurementOperation : public Operation
+{
+public:
+  enum Measurement { LENGTH, AREA, CORRECTNESS };
+
+  ShapeMeasurementOperation(ShapeType type, const QPolygonF& points, Measurement measurement) :
+    type_(type), points_(points), measurement_(measurement)
+  { }
+  virtual void run()
+  {
+    Shape shape(type_, points_);
+    switch (measurement_) {
+      case LENGTH:      sink = sink + shape.length();      break;
+      case AREA:        sink = sink + shape.area();        break;
+      case CORRECTNESS: sink = sink + shape.correctness(); break;
+    }
+  }
+
+private:
+  ShapeType type_;
+  QPolygonF points_;
+  Measurement measurement_;
+};
+
+// The kernel alone, on coordinates that are already split into arrays
+class ChainKernelOperation : public Operation
+{
+public:
+  ChainKernelOperation(const QPolygonF& points) : xs_(points.size()), ys_(points.size())
+  {
+    for (int i = 0; i < points.size(); ++i) {
+      xs_[i] = points[i].x();
+      ys_[i] = points[i].y();
+    }
+  }
+  virtual void run()  { sink = sink + measureChain(xs_.constData(), ys_.constData(), xs_.size(), true).signedArea; }
+
+private:
+  QVector<double> xs_;
+  QVector<double> ys_;
+};
+
+// Cursor lies just outside the shape, so that nothing is selected early
+class SelectionOperation : public Operation
+{
+public:
+  enum Test { POLYLINE_TEST, POLYGON_TEST, VERTEX_TEST };
+
+  SelectionOperation(const QPolygonF& polygon, Test test) :
+    polygon_(polygon), test_(test), cursorPos_(polygon.boundingRect().topLeft() - QPointF(5., 5.))
+  { }
+  virtual void run()
+  {
+    SelectionFinder finder(cursorPos_);
+    switch (test_) {
+      case POLYLINE_TEST:
+        finder.testPolyline(polygon_, FigureHandle(0, 0));
+        break;
+      case POLYGON_TEST:
+        finder.testPolygon(polygon_, FigureHandle(0, 0));
+        break;
+      case VERTEX_TEST:
+        for (int i = 0; i < polygon_.size(); ++i)
+          finder.testVertex(polygon_[i], FigureHandle(0, 0), i);
+        break;
+    }
+    sink = sink + finder.bestSelection().iVertex;
+  }
+
+private:
+  QPolygonF polygon_;
+  Test test_;
+  QPointF cursorPos_;
+};
+
+static void benchmarkGeometry()
+{
+  for (int nVertices = minVertices; nVertices <= maxVertices; nVertices *= 10) {
+    QPolygonF polygon = makeStarPolygon(nVertices);
+    QPolygonF points = makeShapePoints(nVertices);
+
+    if (isEnabled("self-intersection/sweep")) {
+      SelfintersectionOperation operation(isSelfintersectingPolygon, polygon);
+      measure("self-intersection/sweep", nVertices, operation);
+    }
+    if (isEnabled("self-intersection/brute-force") && nVertices <= maxBruteForceVertices) {
+      SelfintersectionOperation operation(isSelfintersectingPolygonBruteForce, polygon);
+      measure("self-intersection/brute-force", nVertices, operation);
+    }
+    if (isEnabled("polygon-areas/sweep")) {
+      PolygonAreasOperation operation(makeTangledPolygon(nVertices));
+      measure("polygon-areas/sweep", nVertices, operation);
+    }
+    if (isEnabled("simplification/douglas-peucker")) {
+      SimplificationOperation operation(polygon, 16.);  // half a pixel at 3% zoom
+      measure("simplification/douglas-peucker", nVertices, operation);
+    }
+    if (isEnabled("edge-index/drag")) {
+      IncrementalDragOperation operation(points);
+      measure("edge-index/drag", nVertices, operation);
+    }
+    if (isEnabled("shape/length")) {
+      ShapeMeasurementOperation operation(POLYLINE, points, ShapeMeasurementOperation::LENGTH);
+      measure("shape/length", nVertices, operation);
+    }
+    if (isEnabled("shape/area")) {
+      ShapeMeasurementOperation operation(POLYGON, points, ShapeMeasurementOperation::AREA);
+      measure("shape/area", nVertices, operation);
+    }
+    if (isEnabled("measure-kernel/soa")) {
+      ChainKernelOperation operation(points);
+      measure("measure-kernel/soa", nVertices, operation);
+    }
+    if (isEnabled("shape/correctness")) {
+      ShapeMeasurementOperation operation(POLYGON, points, ShapeMeasurementOperation::CORRECTNESS);
+      measure("shape/correctness", nVertices, operation);
+    }
+    if (isEnabled("selection/polyline")) {
+      SelectionOperation operation(polygon, SelectionOperation::POLYLINE_TEST);
+      measure("selection/polyline", nVertices, operation);
+    }
+    if (isEnabled("selection/polygon")) {
+      SelectionOperation operation(polygon, SelectionOperation::POLYGON_TEST);
+      measure("selection/polygon", nVertices, operation);
+    }
+    if (isEnabled("selection/vertex")) {
+      SelectionOperation operation(points, SelectionOperation::VERTEX_TEST);
+      measure("selection/vertex", nVertices, operation);
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Image edges
+
+// Luminance of a bright disk on a noisy background, with the 1-pixel border the Sobel operator needs
+static QVector<qint16> makeDiskLuminance(int size)
+{
+  QVector<qint16> result((size + 2) * (size + 2));
+  qsrand(1);
+  for (int y = 0; y < size + 2; ++y)
+    for (int x = 0; x < size + 2; ++x)
+      result[y * (size + 2) + x] = qint16((sqr(x - size / 2) + sqr(y - size / 2) < sqr(size / 3) ? 180 : 60) + qrand() % 16);
+  return result;
+}
+
+class SobelOperation : public Operation
+{
+public:
+  SobelOperation(int size) : size_(size), luminance_(makeDiskLuminance(size)), magnitude_(size * size), direction_(size * size)  { }
+  virtual void run()
+  {
+    computeSobel(luminance_.constData(), size_ + 2, size_, size_, magnitude_.data(), direction_.data(), size_);
+    sink = sink + magnitude_[size_ / 2];
+  }
+
+private:
+  int size_;
+  QVector<qint16> luminance_;
+  QVector<quint16> magnitude_;
+  QVector<quint8> direction_;
+};
+
+// Lasso along a half of the disk boundary, from its leftmost point to the rightmost one
+class LassoTraceOperation : public Operation
+{
+public:
+  LassoTraceOperation(int size) : from_(size / 2 - size / 3, size / 2), to_(size / 2 + size / 3, size / 2)
+  {
+    QVector<qint16> luminance = makeDiskLuminance(size);
+    field_.rect = QRect(0, 0, size, size);
+    field_.magnitude.resize(size * size);
+    field_.direction.resize(size * size);
+    computeSobel(luminance.constData(), size + 2, size, size, field_.magnitude.data(), field_.direction.data(), size);
+  }
+  virtual void run()  { sink = sink + traceEdge(field_, from_, to_).size(); }
+
+private:
+  GradientField field_;
+  QPoint from_;
+  QPoint to_;
+};
+
+static void benchmarkEdges()
+{
+  if (isEnabled("gradient/sobel-tile")) {
+    SobelOperation operation(gradientTileSize);
+    measure("gradient/sobel-tile", gradientTileSize * gradientTileSize, operation);
+  }
+  if (isEnabled("lasso/trace")) {
+    LassoTraceOperation operation(lassoWindowSize);
+    measure("lasso/trace", lassoWindowSize * lassoWindowSize, operation);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Image regions
+
+// Noisy disk with noisy holes, so that the fill has many spans and the outline has many rings
+static QImage makeSpottedDiskImage(int size)
+{
+  QImage result(size, size, QImage::Format_RGB32);
+  qsrand(1);
+  for (int y = 0; y < size; ++y) {
+    QRgb* line = reinterpret_cast<QRgb*>(result.scanLine(y));
+    for (int x = 0; x < size; ++x) {
+      bool isInside = sqr(x - size / 2) + sqr(y - size / 2) < sqr(size / 3) && (x / 16 + y / 16) % 5 != 0;
+      int value = (isInside ? 180 : 60) + qrand() % 16;
+      line[x] = qRgb(value, value, value);
+    }
+  }
+  return result;
+}
+
+// Filling the disk from its center; tiles are decoded once, before the measurement
+class FloodFillOperation : public Operation
+{
+public:
+  FloodFillOperation(int size) : pyramid_(new ImageTileSource(makeSpottedDiskImage(size))), seed_(size / 2 + 8, size / 2 + 8)
+  {
+    run();
+  }
+  virtual void run()
+  {
+    FloodFillResult result;
+    floodFill(&pyramid_, seed_, 32, result);
+    sink = sink + result.nPixels;
+  }
+
+private:
+  ImagePyramid pyramid_;
+  QPoint seed_;
+};
+
+// Counting the disk and the background as two classes in one thread; the census splits the image between cores
+class CensusCountOperation : public Operation
+{
+public:
+  CensusCountOperation(int size) : image_(makeSpottedDiskImage(size))
+  {
+    classRanges_.append(ColorRange(qRgb(188, 188, 188), 8));
+    classRanges_.append(ColorRange(qRgb(68, 68, 68), 8));
+  }
+  virtual void run()
+  {
+    qint64 counts[2] = { 0, 0 };
+    for (int y = 0; y < image_.height(); ++y)
+      countColorClasses(reinterpret_cast<const QRgb*>(image_.constScanLine(y)), image_.width(), classRanges_, counts);
+    sink = sink + counts[0] + counts[1];
+  }
+
+private:
+  QImage image_;
+  QList<ColorRange> classRanges_;
+};
+
+static void benchmarkRegions()
+{
+  if (isEnabled("region/flood-fill")) {
+    FloodFillOperation operation(floodFillImageSize);
+    measure("region/flood-fill", floodFillImageSize * floodFillImageSize, operation);
+  }
+  if (isEnabled("census/count")) {
+    CensusCountOperation operation(floodFillImageSize);
+    measure("census/count", floodFillImageSize * floodFillImageSize, operation);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Drawing and canvas
+
+// Redrawing a figure whose geometry is cached, as on scroll or repaint
+class FigureDrawOperation : public Operation
+{
+public:
+  FigureDrawOperation(const Figure& figure, QImage& target) : figure_(figure), target_(target)  { }
+  virtual void run()
+  {
+    QPainter painter(&target_);
+    figure_.draw(painter);
+  }
+
+private:
+  const Figure& figure_;
+  QImage& target_;
+};
+
+// Drawing a figure that has just changed, including recomputation of the cached geometry
+class FigureColdDrawOperation : public Operation
+{
+public:
+  FigureColdDrawOperation(const Shape& shape, const CanvasWidget* canvas, QImage& target) :
+    shape_(shape), canvas_(canvas), target_(target)
+  { }
+  virtual void run()
+  {
+    Figure figure(shape_, false, canvas_);
+    QPainter painter(&target_);
+    figure.draw(painter);
+  }
+
+private:
+  Shape shape_;
+  const CanvasWidget* canvas_;
+  QImage& target_;
+};
+
+// Zooming in and out with the mouse wheel; the canvas handles it in scaleChanged
+class ZoomOperation : public Operation
+{
+public:
+  ZoomOperation(QWidget* viewport) : viewport_(viewport), nSteps_(0)  { }
+  virtual void run()
+  {
+    QWheelEvent event(viewport_->rect().center(), nSteps_++ % 2 ? -120 : 120, Qt::NoButton, Qt::NoModifier);
+    QApplication::sendEvent(viewport_, &event);
+  }
+
+private:
+  QWidget* viewport_;
+  int nSteps_;
+};
+
+static void benchmarkCanvas()
+{
+  if (!isEnabled("figure/draw") && !isEnabled("figure/draw-cold") && !isEnabled("canvas/zoom") && !isEnabled("canvas/zoom-out"))
+    return;
+  QImage image(canvasImageSize, canvasImageSize, QImage::Format_RGB32);
+  image.fill(qRgb(255, 255, 255));
+  MainWindow mainWindow;
+  QScrollArea scrollArea;
+  QLabel scaleLabel;
+  QLabel statusLabel;
+  scrollArea.resize(1280, 1024);
+  CanvasWidget* canvas = new CanvasWidget(new ImageTileSource(image), &mainWindow, &scrollArea, &scaleLabel, &statusLabel);
+  scrollArea.setWidget(canvas);
+  QImage target(scrollArea.size(), QImage::Format_ARGB32_Premultiplied);
+  target.fill(0);
+
+  for (int nVertices = minVertices; nVertices <= maxVertices; nVertices *= 10) {
+    Shape shape(POLYGON, makeShapePoints(nVertices));
+
+    if (isEnabled("figure/draw")) {
+      Figure figure(shape, false, canvas);
+      FigureDrawOperation operation(figure, target);
+      measure("figure/draw", nVertices, operation);
+    }
+    if (isEnabled("figure/draw-cold")) {
+      FigureColdDrawOperation operation(shape, canvas, target);
+      measure("figure/draw-cold", nVertices, operation);
+    }
+    if (isEnabled("canvas/zoom")) {
+      Session session;
+      SessionFigure sessionFigure;
+      sessionFigure.type = POLYGON;
+      sessionFigure.vertices = shape.points();
+      session.figures.append(sessionFigure);
+      canvas->restoreSession(session);
+      ZoomOperation operation(scrollArea.viewport());
+      measure("canvas/zoom", nVertices, operation);
+    }
+    // Far zoomed out figures are drawn simplified
+    if (isEnabled("canvas/zoom-out")) {
+      Session session;
+      SessionFigure sessionFigure;
+      sessionFigure.type = POLYGON;
+      sessionFigure.vertices = shape.points();
+      session.figures.append(sessionFigure);
+      session.scale = 0.05;
+      canvas->restoreSession(session);
+      ZoomOperation operation(scrollArea.viewport());
+      measure("canvas/zoom-out", nVertices, operation);
+    }
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  bool useGui = true;
+  for (int i = 1; i < argc; ++i) {
+    QString arg = QString::fromLocal8Bit(argv[i]);
+    if (arg == "--no-gui")
+      useGui = false;
+    else
+      nameFilter = arg;
+  }
+  QApplication app(argc, argv, useGui);
+
+  std::printf("# benchmark\tvertices\tns/op\toperations\n");
+  benchmarkGeometry();
+  benchmarkEdges();
+  benchmarkRegions();
+  if (useGui)
+    benchmarkCanvas();
+  return 0;
+}
@@ -1,25 +1,36 @@
 // TODO: make cursor the fixed point of the zoom
-// TODO: compute area for selfintersecting polygons
 // TODO: polygon editing: move caption, change color, move segments (?), add points (?), delete points (?)
 // TODO: set scale by two points GPS coordinates
 // TODO: result printing
 // TODO: perhaps, it's time to use 3 modes instead of 2: normal draw, draw etalon, edit?
-// TODO: won't it be easier to use weak pointers (e.g., QPointers) to figures?
 // TODO: reduce number of digits after the decimal point
 
 #include <cmath>
 
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageWriter>
 #include <QInputDialog>
 #include <QLabel>
+#include <QMessageBox>
 #include <QPainter>
 #include <QPaintEvent>
+#include <QPrinter>
+#include <QScopedPointer>
 #include <QScrollArea>
 #include <QScrollBar>
+#include <QSvgGenerator>
+#include <QUrl>
 
 #include "canvaswidget.h"
+#include "edge_snapping.h"
 #include "mainwindow.h"
 #include "paint_utils.h"
 #include "shape.h"
+#include "simplification.h"
+#include "tiff_writer.h"
 
 
 const int rulerMargin         = 16;
@@ -32,17 +43,40 @@ const int rulerMinLength      = 40;
 const QColor rulerBodyColor   = Qt::black;
 const QColor rulerFrameColor  = Qt::white;
 
-const int maxImageSize = 4096;
+const int exportBandHeight    = 256;
 
+const int mouseMoveFrameMsec  = 16;  // display frame at 60 Hz
 
-CanvasWidget::CanvasWidget(const QPixmap& image, MainWindow* mainWindow, QScrollArea* scrollArea,
+// Edges are looked for at the pyramid level that is displayed, so the sizes below are in its pixels, unless noted otherwise
+const int edgeSnapRadius                 = 8;    // in screen pixels
+const int lassoWindowMargin              = 16;   // around the rect of the path ends
+const int maxLassoWindowSize             = 256;  // the lasso goes straight between further points, tracing would take longer than a frame
+const double maxLassoSimplificationError = 0.5;
+
+const int defaultFillTolerance = 32;
+const int censusOutputPrecision = 4;
+
+const int perfOverlayMargin         = 8;
+const int perfOverlayPadding        = 4;
+const int perfOverlayRefreshMsec    = 500;
+const QColor perfOverlayBodyColor   = QColor(0, 0, 0, 180);
+const QColor perfOverlayTextColor   = Qt::white;
+
+
+CanvasWidget::CanvasWidget(TileSource* imageSource, MainWindow* mainWindow, QScrollArea* scrollArea,
                            QLabel* scaleLabel, QLabel* statusLabel, QWidget* parent) :
   QWidget(parent),
   mainWindow_(mainWindow),
   scrollArea_(scrollArea),
   scaleLabel_(scaleLabel),
   statusLabel_(statusLabel),
-  originalImage_(image)
+  imagePyramid_(imageSource),
+  zoomRenderer_(&imagePyramid_),
+  tileLoader_(&imagePyramid_),
+  gradientPyramid_(&imagePyramid_),
+  regionFiller_(&imagePyramid_),
+  colorCensus_(&imagePyramid_),
+  censusOverlay_(&imagePyramid_)
 {
   acceptableScales_ << 0.01 << 0.015 << 0.02 << 0.025 << 0.03 << 0.04 << 0.05 << 0.06 << 0.07 << 0.08 << 0.09;
   acceptableScales_ << 0.10 << 0.12 << 0.14 << 0.17 << 0.20 << 0.23 << 0.26 << 0.30 << 0.35 << 0.40 << 0.45;
@@ -50,14 +84,32 @@ CanvasWidget::CanvasWidget(const QPixmap& image, MainWindow* mainWindow, QScroll
   acceptableScales_ << 1.00 << 1.25 << 1.50 << 1.75 << 2.00 << 2.50 << 3.00 << 4.00;
   iScale_ = acceptableScales_.indexOf(1.00);
 
+  connect(&zoomRenderer_, SIGNAL(updated(QRect)), this, SLOT(smoothImageReady(QRect)));
+  connect(&tileLoader_, SIGNAL(loaded(QRect)), this, SLOT(imageTileLoaded(QRect)));
+  connect(&gradientPyramid_, SIGNAL(computed(QRect)), this, SLOT(gradientTileComputed(QRect)));
+  connect(&regionFiller_, SIGNAL(filled()), this, SLOT(regionFilled()));
+  connect(&colorCensus_, SIGNAL(counted()), this, SLOT(censusCounted()));
+  connect(scrollArea_->horizontalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(visibleAreaChanged()));
+  connect(scrollArea_->verticalScrollBar(),   SIGNAL(valueChanged(int)), this, SLOT(visibleAreaChanged()));
+  connect(&perfOverlayTimer_, SIGNAL(timeout()), this, SLOT(refreshPerfOverlay()));
+  perfOverlayTimer_.setInterval(perfOverlayRefreshMsec);
+  connect(&mouseMoveTimer_, SIGNAL(timeout()), this, SLOT(processPendingMouseMove()));
+  mouseMoveTimer_.setSingleShot(true);
+  hasPendingMouseMove_ = false;
+  pendingMouseButtons_ = Qt::NoButton;
+  setFont(mainWindow_->getInscriptionFont());  // figures use it to compute their screen bounding rects
   scrollArea_->viewport()->installEventFilter(this);
   setFocusPolicy(Qt::StrongFocus);
   setMouseTracking(true);
   shapeType_ = DEFAULT_TYPE;
   isDefiningEtalon_ = true;
   showRuler_ = false;
-  etalonFigure_ = 0;
-  activeFigure_ = 0;
+  isSnappingToEdges_ = false;
+  isMagneticLasso_ = false;
+  fillTolerance_ = defaultFillTolerance;
+  figureScreenMargin_ = -1;
+  etalonFigure_ = FigureHandle();
+  activeFigure_ = FigureHandle();
   clearEtalon();
   scaleChanged();
 }
@@ -67,50 +119,92 @@ CanvasWidget::~CanvasWidget()
 }
 
 
+// A repaint of the performance overlay alone is not a frame: it would report its own timing and counters instead of the last real frame
 void CanvasWidget::paintEvent(QPaintEvent* event)
 {
-  QPainter painter(this);
-  painter.setFont(mainWindow_->getInscriptionFont());
-  painter.setRenderHint(QPainter::Antialiasing, true);
-  painter.drawPixmap(event->rect().topLeft(), image_, event->rect());
-  foreach (const Figure& figure, figures_)
-    figure.draw(painter);
-  if (showRuler_)
-    drawRuler(painter, event->rect());
+  bool isPerfOverlayRefresh = perfStats_.isEnabled() && (event->region() - QRegion(perfOverlayRect_)).isEmpty();
+  {
+    ScopedPerfTimer perfTimer(perfStats_, PerfStats::PAINT_EVENT, !isPerfOverlayRefresh);
+    QPainter painter(this);
+    drawImage(painter, event->rect());
+    censusOverlay_.draw(painter, event->rect(), scale_);
+    requestVisibleGradient();
+    drawStaticFigures(painter, event->rect());
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    for (int i = 0; i < figures_.size(); ++i) {
+      if (isStatic(figures_.handleAt(i)))
+        continue;
+      bool isDrawn = event->region().intersects(figures_.at(i).screenBoundingRect());
+      if (isDrawn)
+        figures_.at(i).draw(painter);
+      if (!isPerfOverlayRefresh)
+        perfStats_.count(isDrawn ? PerfStats::FIGURES_DRAWN : PerfStats::FIGURES_CULLED);
+    }
+    if (showRuler_) {
+      // The ruler stays in the corner of the viewport
+      rulerVisibleRect_ = visibleRegion().boundingRect();
+      rulerRect_ = drawRuler(&painter, rulerVisibleRect_, metersPerPixel_);
+    }
+    if (perfStats_.isEnabled())
+      perfOverlayRect_ = drawPerfOverlay(painter, visibleRegion().boundingRect());
+  }
+  if (!isPerfOverlayRefresh)
+    perfStats_.finishFrame();  // after the timer has stopped, so that the frame is complete
   event->accept();
 }
 
 void CanvasWidget::keyPressEvent(QKeyEvent* event)
 {
+  processPendingMouseMove();
   if (event->key() == Qt::Key_Delete) {
-    if (!selection_.isEmpty() && !selection_.figure->isEtalon()) {
+    const Figure* selectedFigure = figures_.get(selection_.figure);
+    if (selectedFigure && !selectedFigure->isEtalon()) {
       removeFigure(selection_.figure);
-      updateAll();
+      updateHoverAndStatus();
     }
   }
+  else if (event->key() == Qt::Key_F12) {
+    togglePerfOverlay();
+  }
   else {
     QWidget::keyPressEvent(event);
   }
 }
 
+// Other mouse events go after the pending move, so that e.g. a drag ends exactly where the cursor was released
 void CanvasWidget::mousePressEvent(QMouseEvent* event)
 {
+  processPendingMouseMove();
+  invalidateFigure(activeFigure_);
   updateMousePos(event->pos());
   if (event->buttons() == Qt::LeftButton) {
-    selection_ = hover_;
-    if (hover_.isEmpty()) {
-      if (!activeFigure_) {
+    setSelection(hover_);
+    if (hover_.isEmpty() && shapeType_ == REGION) {
+      // The pixel under the cursor itself, not snapped to an edge
+      QSize imageSize = imagePyramid_.size();
+      QPointF originalPos = pointUnderMouse_ / scale_;
+      fillRegion(QPoint(qBound(0, int(std::floor(originalPos.x())), imageSize.width() - 1),
+                        qBound(0, int(std::floor(originalPos.y())), imageSize.height() - 1)));
+    }
+    else if (hover_.isEmpty()) {
+      if (activeFigure_.isNull()) {
         if (isDefiningEtalon_) {
           clearEtalon();
           removeFigure(etalonFigure_);
         }
         addActiveFigure();
       }
-      bool polygonFinished = activeFigure_->addPoint(originalPointUnderMouse_);
+      invalidateFigure(activeFigure_);
+      Figure* activeFigure = figures_.get(activeFigure_);
+      foreach (QPointF lassoPoint, lassoPath_)
+        activeFigure->addPoint(lassoPoint);
+      lassoPath_.clear();
+      bool polygonFinished = activeFigure->addPoint(originalPointUnderMouse_);
+      invalidateFigure(activeFigure_);
       if (polygonFinished)
         finishDrawing();
     }
-    updateAll();
+    updateHoverAndStatus();
   }
   else if (event->buttons() == Qt::RightButton) {
     scrollStartPoint_ = event->globalPos();
@@ -122,39 +216,34 @@ void CanvasWidget::mousePressEvent(QMouseEvent* event)
 
 void CanvasWidget::mouseReleaseEvent(QMouseEvent* event)
 {
+  processPendingMouseMove();
   updateHover();
   event->accept();
 }
 
+// Mice and tablets can report moves many times per frame; all but the latest one would be wasted on hover, status and repaints
 void CanvasWidget::mouseMoveEvent(QMouseEvent* event)
 {
-  if (event->buttons() == Qt::NoButton) {
-    updateMousePos(event->pos());
-    updateAll();
-  }
-  else if (event->buttons() == Qt::LeftButton) {
-    updateMousePos(event->pos());
-    selection_.dragTo(originalPointUnderMouse_);
-    if (!selection_.isEmpty() && selection_.figure->isEtalon())
-      defineEtalon(selection_.figure);
-    updateAll();
-  }
-  else if (event->buttons() == Qt::RightButton) {
-    QPoint scrollBy = scrollStartPoint_ - event->globalPos();
-    scrollArea_->horizontalScrollBar()->setValue(scrollStartHValue_ + scrollBy.x());
-    scrollArea_->verticalScrollBar()  ->setValue(scrollStartVValue_ + scrollBy.y());
+  hasPendingMouseMove_ = true;
+  pendingMousePos_ = event->pos();
+  pendingGlobalMousePos_ = event->globalPos();
+  pendingMouseButtons_ = event->buttons();
+  if (!mouseMoveTimer_.isActive()) {
+    qint64 msecSinceProcessed = sinceMouseMoveProcessed_.isValid() ? sinceMouseMoveProcessed_.elapsed() : mouseMoveFrameMsec;
+    mouseMoveTimer_.start(int(qMax<qint64>(0, mouseMoveFrameMsec - msecSinceProcessed)));
   }
   event->accept();
 }
 
 void CanvasWidget::mouseDoubleClickEvent(QMouseEvent* event)
 {
+  processPendingMouseMove();
   if (event->buttons() == Qt::LeftButton) {
-    if (activeFigure_) {
-      if (activeFigure_->originalShape().nVertices() == 1) {
+    if (!activeFigure_.isNull()) {
+      if (figures_.get(activeFigure_)->originalShape().nVertices() == 1) {
         removeFigure(activeFigure_);
-        selection_.clear();
-        updateAll();
+        setSelection(Selection());
+        updateHoverAndStatus();
       }
       else {
         finishDrawing();
@@ -167,12 +256,10 @@ void CanvasWidget::mouseDoubleClickEvent(QMouseEvent* event)
 bool CanvasWidget::eventFilter(QObject* object, QEvent* event__)
 {
   if (object == scrollArea_->viewport() && event__->type() == QEvent::Wheel) {
+    processPendingMouseMove();
     QWheelEvent* event = static_cast<QWheelEvent*>(event__);
     int numSteps = event->delta() / 120;
     iScale_ = qBound(0, iScale_ + numSteps, acceptableScales_.size() - 1);
-    int size = qMax(originalImage_.width(), originalImage_.height());
-    while (size * acceptableScales_[iScale_] > maxImageSize && acceptableScales_[iScale_] > 1.)
-      iScale_--;
     scaleChanged();
     return true;
   }
@@ -192,22 +279,121 @@ bool CanvasWidget::hasEtalon() const
   return originalMetersPerPixel_ > 0.;
 }
 
-QPixmap CanvasWidget::getModifiedImage()
+// Renders the image with the figures and the ruler at the original scale and writes it to the file. The view is not affected.
+// The image is rendered band by band. TIFF is written as the bands are ready, so it's never held in memory as a whole;
+// other formats have to be passed to QImageWriter in one piece.
+bool CanvasWidget::saveModifiedImage(const QString& filename) const
 {
-  Selection oldSelection_ = selection_;
-  Selection oldHover = hover_;
-  int oldIScale = iScale_;
-  iScale_ = acceptableScales_.indexOf(1.00);
-  selection_.clear();
-  hover_.clear();
-  scaleChanged();
-  QPixmap resultingImage(size());
-  render(&resultingImage);
-  iScale_ = oldIScale;
-  selection_ = oldSelection_;
-  hover_ = oldHover;
-  scaleChanged();
-  return resultingImage;
+  QSize size = imagePyramid_.size();
+  QList<QRect> figureRects;
+  for (int i = 0; i < figures_.size(); ++i)
+    figureRects.append(figures_.at(i).originalPaintedRect());
+
+  bool isTiff = QFileInfo(filename).suffix().toLower().startsWith("tif");
+  QScopedPointer<TiffWriter> tiffWriter;
+  QImage wholeImage;
+  if (isTiff) {
+    tiffWriter.reset(new TiffWriter(filename, size, imagePyramid_.hasAlphaChannel()));
+    if (!tiffWriter->open())
+      return false;
+  }
+  else {
+    wholeImage = QImage(size, imagePyramid_.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    if (wholeImage.isNull())
+      return false;
+  }
+
+  for (int top = 0; top < size.height(); top += exportBandHeight) {
+    QRect band(0, top, size.width(), qMin(exportBandHeight, size.height() - top));
+    QImage bandImage = imagePyramid_.readOriginal(band);
+    QPainter painter(&bandImage);
+    painter.translate(-band.topLeft());
+    drawOriginalOverlay(painter, band, figureRects);
+    painter.end();
+
+    if (isTiff) {
+      if (!tiffWriter->writeRows(bandImage)) {
+        tiffWriter.reset();
+        QFile::remove(filename);  // a truncated file would look like a valid one
+        return false;
+      }
+    }
+    else {
+      QPainter wholeImagePainter(&wholeImage);
+      wholeImagePainter.setCompositionMode(QPainter::CompositionMode_Source);
+      wholeImagePainter.drawImage(band.topLeft(), bandImage);
+    }
+  }
+
+  bool isWritten = false;
+  if (isTiff) {
+    isWritten = tiffWriter->close();
+    tiffWriter.reset();
+  }
+  else {
+    QImageWriter writer(filename);
+    isWritten = writer.write(wholeImage);
+  }
+  if (!isWritten)
+    QFile::remove(filename);
+  return isWritten;
+}
+
+// Writes figures, inscriptions and the ruler as vector graphics in original image coordinates, without the image itself.
+// SVG may refer to the image file by a relative path, so that viewers show the overlay on top of it.
+bool CanvasWidget::exportOverlay(const QString& filename, const QString& linkedImageFilename) const
+{
+  QSize size = imagePyramid_.size();
+  QRect imageRect(QPoint(), size);
+  QList<QRect> figureRects;
+  for (int i = 0; i < figures_.size(); ++i)
+    figureRects.append(figures_.at(i).originalPaintedRect());
+
+  if (QFileInfo(filename).suffix().toLower() == "pdf") {
+    // One point per pixel, so that painter coordinates are image coordinates
+    QPrinter printer(QPrinter::ScreenResolution);
+    printer.setOutputFormat(QPrinter::PdfFormat);
+    printer.setOutputFileName(filename);
+    printer.setResolution(72);
+    printer.setFullPage(true);
+    printer.setPaperSize(QSizeF(size), QPrinter::DevicePixel);
+    printer.setPageMargins(0., 0., 0., 0., QPrinter::DevicePixel);
+    QPainter painter;
+    if (!painter.begin(&printer))
+      return false;
+    painter.setClipRect(imageRect);
+    drawOriginalOverlay(painter, imageRect, figureRects);
+    return painter.end();
+  }
+
+  QBuffer svgBuffer;
+  QSvgGenerator generator;
+  generator.setOutputDevice(&svgBuffer);
+  generator.setSize(size);
+  generator.setViewBox(imageRect);
+  generator.setTitle(QFileInfo(linkedImageFilename).fileName());
+  QPainter painter;
+  if (!painter.begin(&generator))
+    return false;
+  painter.setClipRect(imageRect);
+  drawOriginalOverlay(painter, imageRect, figureRects);
+  if (!painter.end())
+    return false;
+
+  QByteArray svg = svgBuffer.data();
+  if (!linkedImageFilename.isEmpty()) {
+    // QSvgGenerator can only embed images, so the reference is put under the figures by hand
+    QString imagePath = QFileInfo(filename).absoluteDir().relativeFilePath(QFileInfo(linkedImageFilename).absoluteFilePath());
+    QByteArray imageElement = "<image x=\"0\" y=\"0\" width=\"" + QByteArray::number(size.width())
+                            + "\" height=\"" + QByteArray::number(size.height())
+                            + "\" xlink:href=\"" + QUrl::toPercentEncoding(imagePath, "/") + "\"/>\n";
+    const QByteArray defsEnd = "</defs>\n";
+    int insertPos = svg.indexOf(defsEnd);
+    ASSERT_RETURN_V(insertPos >= 0, false);
+    svg.insert(insertPos + defsEnd.size(), imageElement);
+  }
+  QFile file(filename);
+  return file.open(QIODevice::WriteOnly) && file.write(svg) == svg.size();
 }
 
 
@@ -224,58 +410,262 @@ void CanvasWidget::toggleRuler(bool showRuler)
   if (showRuler_ == showRuler)
     return;
   showRuler_ = showRuler;
+  update(rulerRect_);
+  update(visibleRegion().boundingRect());
+}
+
+void CanvasWidget::toggleEdgeSnapping(bool snapToEdges)
+{
+  if (isSnappingToEdges_ == snapToEdges)
+    return;
+  isSnappingToEdges_ = snapToEdges;
+  if (!isSnappingToEdges_ && !isMagneticLasso_)
+    gradientPyramid_.cancel();
+  requestVisibleGradient();
+  refreshMousePos();
+}
+
+void CanvasWidget::toggleMagneticLasso(bool isMagneticLasso)
+{
+  if (isMagneticLasso_ == isMagneticLasso)
+    return;
+  isMagneticLasso_ = isMagneticLasso;
+  if (!isSnappingToEdges_ && !isMagneticLasso_)
+    gradientPyramid_.cancel();
+  requestVisibleGradient();
+  refreshMousePos();
+}
+
+void CanvasWidget::addCensusClass(const QColor& color)
+{
+  censusClasses_.append(ColorClass(color.rgb(), fillTolerance_));
+  colorCensus_.request(censusClasses_);
+  censusOverlay_.setClasses(censusClasses_);
   update();
 }
 
+void CanvasWidget::clearCensus()
+{
+  colorCensus_.cancel();
+  censusClasses_.clear();
+  censusOverlay_.setClasses(censusClasses_);
+  update();
+}
+
+QColor CanvasWidget::regionSeedColor() const
+{
+  if (regionFigure_.isNull())
+    return QColor();
+  QImage seedPixel = imagePyramid_.readOriginal(QRect(regionSeed_, QSize(1, 1)));
+  return seedPixel.isNull() ? QColor() : QColor(seedPixel.pixel(0, 0));
+}
+
+// The region being filled, or the latest one while it's selected, is filled again with the new tolerance
+void CanvasWidget::setFillTolerance(int tolerance)
+{
+  if (fillTolerance_ == tolerance)
+    return;
+  fillTolerance_ = tolerance;
+  if (regionFiller_.isBusy() || (!regionFigure_.isNull() && selection_.figure == regionFigure_))
+    regionFiller_.request(regionSeed_, fillTolerance_);
+}
+
 
 void CanvasWidget::addActiveFigure()
 {
-  ASSERT_RETURN(!activeFigure_);
-  figures_.append(Figure(shapeType_, isDefiningEtalon_, this));
-  activeFigure_ = &figures_.last();
+  ASSERT_RETURN(activeFigure_.isNull());
+  activeFigure_ = figures_.insert(Figure(shapeType_, isDefiningEtalon_, this));
 }
 
-void CanvasWidget::removeFigure(const Figure* figure)
+void CanvasWidget::removeFigure(FigureHandle figure)
 {
-  if (!figure)
+  if (figure.isNull())
     return;
+  ASSERT_RETURN(figures_.contains(figure));
 
+  invalidateFigure(figure);
   if (etalonFigure_ == figure)
-    etalonFigure_ = 0;
-  if (activeFigure_ == figure)
-    activeFigure_ = 0;
+    etalonFigure_ = FigureHandle();
+  if (activeFigure_ == figure) {
+    activeFigure_ = FigureHandle();
+    lassoPath_.clear();
+  }
+  if (regionFigure_ == figure) {
+    regionFigure_ = FigureHandle();
+    regionFiller_.cancel();
+  }
   if (selection_.figure == figure)
     selection_.clear();
   if (hover_.figure == figure)
     hover_.clear();
 
-  bool erased = false;
-  for (FigureIter it = figures_.begin(); it != figures_.end(); ++it) {
-    if (&(*it) == figure) {
-      figures_.erase(it);
-      erased = true;
-      break;
+  figureIndex_.removeFigure(figure);
+  bakedFigures_.remove(figure);
+  figures_.remove(figure);
+}
+
+// The region is added when the fill is done, see regionFilled
+void CanvasWidget::fillRegion(QPoint seed)
+{
+  regionSeed_ = seed;
+  regionFigure_ = FigureHandle();
+  regionFiller_.request(regionSeed_, fillTolerance_);
+}
+
+
+Session CanvasWidget::session() const
+{
+  Session result;
+  for (int i = 0; i < figures_.size(); ++i) {
+    const Figure& figure = figures_.at(i);
+    if (!figure.isFinished())
+      continue;
+    if (figures_.handleAt(i) == etalonFigure_ && originalMetersPerPixel_ > 0.) {
+      result.iEtalonFigure = result.figures.size();
+      result.etalonMetersSize = etalonMetersSize_;
     }
+    SessionFigure sessionFigure;
+    sessionFigure.type = figure.shapeType();
+    sessionFigure.vertices = figure.originalShape().points();
+    result.figures.append(sessionFigure);
+  }
+  result.scale = scale_;
+  result.scrollPos = QPoint(scrollArea_->horizontalScrollBar()->value(), scrollArea_->verticalScrollBar()->value());
+  return result;
+}
+
+// Replaces all the figures; the image is supposed to be the one the session was saved for
+void CanvasWidget::restoreSession(const Session& session)
+{
+  resetAll();
+  while (!figures_.isEmpty())
+    removeFigure(figures_.handleAt(figures_.size() - 1));
+  clearEtalon();
+
+  FigureHandle newEtalonFigure;
+  for (int i = 0; i < session.figures.size(); ++i) {
+    const SessionFigure& sessionFigure = session.figures[i];
+    bool isEtalon = (i == session.iEtalonFigure);
+    FigureHandle figure = figures_.insert(Figure(Shape(sessionFigure.type, sessionFigure.vertices), isEtalon, this));
+    figureIndex_.setFigure(figure, figures_.get(figure)->originalBoundingRect());
+    if (isEtalon)
+      newEtalonFigure = figure;
+  }
+  if (!newEtalonFigure.isNull() && session.etalonMetersSize > 0.) {
+    etalonMetersSize_ = session.etalonMetersSize;
+    etalonFigure_ = newEtalonFigure;  // so that defineEtalon doesn't ask for the size
+    defineEtalon(newEtalonFigure);
+    mainWindow_->toggleEtalonDefinition(false);
   }
-  ASSERT_RETURN(erased);
+
+  int iNearestScale = 0;
+  for (int i = 1; i < acceptableScales_.size(); ++i)
+    if (qAbs(acceptableScales_[i] - session.scale) < qAbs(acceptableScales_[iNearestScale] - session.scale))
+      iNearestScale = i;
+  iScale_ = iNearestScale;
+  scaleChanged();
+  restoredScrollPos_ = session.scrollPos;
+  QMetaObject::invokeMethod(this, "applyRestoredScrollPos", Qt::QueuedConnection);
 }
 
 
-void CanvasWidget::drawRuler(QPainter& painter, const QRect& rect)
+// Draws smooth image if it's ready, otherwise draws a nearest-neighbour preview and requests smooth image.
+// Only decoded tiles are drawn, the rest are requested from the loader.
+void CanvasWidget::drawImage(QPainter& painter, const QRect& rect)
+{
+  if (!imagePyramid_.needsFiltering(scale_)) {
+    if (!imagePyramid_.drawCached(painter, rect, scale_))
+      tileLoader_.request(imagePyramid_.missingTiles(visibleRegion().boundingRect().united(rect), scale_));
+    return;
+  }
+  if (zoomRenderer_.draw(painter, rect, scale_))
+    return;
+  imagePyramid_.drawCached(painter, rect, scale_);
+  zoomRenderer_.request(smoothRenderRect().united(rect), scale_);
+}
+
+void CanvasWidget::drawStaticFigures(QPainter& painter, const QRect& rect)
+{
+  QRect tiles = overlayCache_.tilesCovering(rect);
+  for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty) {
+    for (int tx = tiles.left(); tx <= tiles.right(); ++tx) {
+      QRect tileRect = overlayCache_.tileRect(tx, ty).intersected(this->rect());
+      if (tileRect.isEmpty())
+        continue;
+      const QImage* cachedTile = overlayCache_.tile(tx, ty);
+      if (cachedTile) {
+        painter.drawImage(tileRect.topLeft(), *cachedTile);
+      }
+      else {
+        QImage tile = renderStaticFigures(tileRect);
+        painter.drawImage(tileRect.topLeft(), tile);
+        overlayCache_.insert(tx, ty, tile);
+      }
+    }
+  }
+}
+
+QImage CanvasWidget::renderStaticFigures(const QRect& rect)
+{
+  QImage result(rect.size(), QImage::Format_ARGB32_Premultiplied);
+  result.fill(0);
+  QPainter painter(&result);
+  painter.setFont(font());
+  painter.setRenderHint(QPainter::Antialiasing, true);
+  painter.translate(-rect.topLeft());
+  if (figureScreenMargin_ < 0) {
+    figureScreenMargin_ = 0;
+    for (int i = 0; i < figures_.size(); ++i)
+      figureScreenMargin_ = qMax(figureScreenMargin_, screenMargin(figures_.at(i)));
+  }
+  double originalMargin = figureScreenMargin_ / scale_;
+  QRectF originalRect = QRectF(QPointF(rect.topLeft()) / scale_, QSizeF(rect.size()) / scale_)
+                          .adjusted(-originalMargin, -originalMargin, originalMargin, originalMargin);
+  foreach (FigureHandle figure, figureIndex_.figuresNear(originalRect)) {
+    if (!isStatic(figure))
+      continue;
+    const Figure* figurePtr = figures_.get(figure);
+    if (figurePtr->screenBoundingRect().intersects(rect)) {
+      figurePtr->draw(painter);
+      bakedFigures_.insert(figure);
+      perfStats_.count(PerfStats::FIGURES_DRAWN);
+    }
+    else {
+      perfStats_.count(PerfStats::FIGURES_CULLED);
+    }
+  }
+  return result;
+}
+
+// Figures and the ruler at the original scale, for saving. Only figures whose painted rects touch the rect are drawn.
+void CanvasWidget::drawOriginalOverlay(QPainter& painter, const QRect& rect, const QList<QRect>& figureRects) const
+{
+  painter.setFont(font());
+  painter.setRenderHint(QPainter::Antialiasing, true);
+  for (int i = 0; i < figures_.size(); ++i)
+    if (figureRects[i].intersects(rect))
+      figures_.at(i).drawOriginal(painter);
+  QRect imageRect(QPoint(), imagePyramid_.size());  // the ruler is in its corner
+  if (showRuler_ && drawRuler(0, imageRect, originalMetersPerPixel_).intersects(rect))
+    drawRuler(&painter, imageRect, originalMetersPerPixel_);
+}
+
+// Returns the rect covered by the ruler; with a null painter only computes it
+QRect CanvasWidget::drawRuler(QPainter* painter, const QRect& rect, double metersPerPixel) const
 {
   int maxLength = qMin(rulerMaxLength, rect.width() - 2 * rulerMargin);
   if (!hasEtalon() || maxLength < rulerMinLength)
-    return;
+    return QRect();
 
   double pixelLengthF;
   double metersLength;
   double base = 1e10;
   while (base > 1e-10) {
-    if ((pixelLengthF = (metersLength = base * 5.) / metersPerPixel_) < maxLength)
+    if ((pixelLengthF = (metersLength = base * 5.) / metersPerPixel) < maxLength)
       break;
-    if ((pixelLengthF = (metersLength = base * 2.) / metersPerPixel_) < maxLength)
+    if ((pixelLengthF = (metersLength = base * 2.) / metersPerPixel) < maxLength)
       break;
-    if ((pixelLengthF = (metersLength = base * 1.) / metersPerPixel_) < maxLength)
+    if ((pixelLengthF = (metersLength = base * 1.) / metersPerPixel) < maxLength)
       break;
     base /= 10.;
   }
@@ -287,58 +677,275 @@ void CanvasWidget::drawRuler(QPainter& painter, const QRect& rect)
   ruler.append(QRect(rulerLeft, rulerY - rulerThickness / 2, pixelLength, rulerThickness));
   ruler.append(QRect(rulerLeft - rulerThickness, rulerY - rulerSerifsSize / 2, rulerThickness, rulerSerifsSize));
   ruler.append(QRect(rulerLeft + pixelLength   , rulerY - rulerSerifsSize / 2, rulerThickness, rulerSerifsSize));
-  drawFramed(painter, ruler, rulerFrameThickness, rulerBodyColor, rulerFrameColor);
-
+  QFontMetrics fontMetrics = painter ? painter->fontMetrics() : this->fontMetrics();
   QString rulerLabel = QString::number(metersLength) + " " + linearUnitSuffix;
   QPoint labelPos(rulerLeft + rulerFrameThickness + rulerTextMargin,
-                  rulerY - rulerThickness / 2 - rulerFrameThickness - rulerTextMargin - painter.fontMetrics().descent());
-  drawTextWithBackground(painter, rulerLabel, labelPos);
+                  rulerY - rulerThickness / 2 - rulerFrameThickness - rulerTextMargin - fontMetrics.descent());
+  if (painter) {
+    drawFramed(*painter, ruler, rulerFrameThickness, rulerBodyColor, rulerFrameColor);
+    drawTextWithBackground(*painter, rulerLabel, labelPos);
+  }
+
+  QRect rulerRect = fontMetrics.boundingRect(rulerLabel).translated(labelPos).adjusted(-2, -2, 3, 3);
+  foreach (const QRect& part, ruler)
+    rulerRect |= part.adjusted(-rulerFrameThickness, -rulerFrameThickness, rulerFrameThickness, rulerFrameThickness);
+  return rulerRect;
+}
+
+// Returns the rect covered by the overlay
+QRect CanvasWidget::drawPerfOverlay(QPainter& painter, const QRect& visibleRect) const
+{
+  QStringList lines = perfStats_.report();
+  painter.save();
+  painter.setFont(QFont());
+  QFontMetrics fontMetrics = painter.fontMetrics();
+  int width = 0;
+  foreach (const QString& line, lines)
+    width = qMax(width, fontMetrics.width(line));
+  QRect rect(visibleRect.topLeft() + QPoint(perfOverlayMargin, perfOverlayMargin),
+             QSize(width, lines.size() * fontMetrics.lineSpacing()) + 2 * QSize(perfOverlayPadding, perfOverlayPadding));
+  painter.fillRect(rect, perfOverlayBodyColor);
+  painter.setPen(perfOverlayTextColor);
+  for (int i = 0; i < lines.size(); ++i)
+    painter.drawText(rect.topLeft() + QPoint(perfOverlayPadding, perfOverlayPadding + i * fontMetrics.lineSpacing() + fontMetrics.ascent()),
+                     lines[i]);
+  painter.restore();
+  return rect;
+}
+
+// Visible part of the canvas with some margin, so that small scrolls don't require new rendering
+QRect CanvasWidget::smoothRenderRect() const
+{
+  QRect visibleRect = visibleRegion().boundingRect();
+  int marginX = visibleRect.width()  / 2;
+  int marginY = visibleRect.height() / 2;
+  return visibleRect.adjusted(-marginX, -marginY, marginX, marginY).intersected(rect());
+}
+
+
+// How far the painted rect of the figure sticks out of its scaled original bounding rect, e.g. with the inscription
+int CanvasWidget::screenMargin(const Figure& figure) const
+{
+  QRectF originalRect = figure.originalBoundingRect();
+  QRectF scaledRect(originalRect.topLeft() * scale_, originalRect.size() * scale_);
+  QRect screenRect = figure.screenBoundingRect();
+  double margin = qMax(qMax(scaledRect.left() - screenRect.left(), scaledRect.top() - screenRect.top()),
+                       qMax(screenRect.right() + 1 - scaledRect.right(), screenRect.bottom() + 1 - scaledRect.bottom()));
+  return qMax(0, int(std::ceil(margin)) + 1);
+}
+
+// Static figures are drawn from the overlay cache, the rest are drawn on every repaint
+bool CanvasWidget::isStatic(FigureHandle figure) const
+{
+  return figure != activeFigure_ && figure != selection_.figure && figure != hover_.figure;
+}
+
+// Schedules repainting of everything the figure has drawn or will draw in its current state.
+// Should be called both before and after the figure changes, including becoming (not) hovered or selected.
+void CanvasWidget::invalidateFigure(FigureHandle figure)
+{
+  const Figure* figurePtr = figures_.get(figure);
+  if (!figurePtr)
+    return;
+  QRect rect = figurePtr->screenBoundingRect();
+  if (figureScreenMargin_ >= 0)
+    figureScreenMargin_ = qMax(figureScreenMargin_, screenMargin(*figurePtr));
+  if (bakedFigures_.remove(figure) || isStatic(figure))
+    overlayCache_.invalidate(rect);
+  update(rect);
+}
+
+// Figures use the widget font to compute their screen bounding rects, so all of them are invalidated
+void CanvasWidget::setInscriptionFont(const QFont& font)
+{
+  setFont(font);
+  for (int i = 0; i < figures_.size(); ++i)
+    figures_.at(i).fontChanged();
+  invalidateAllFigures();
 }
 
+// A figure that stops being selected or hovered becomes static, and the overlay tiles rendered while it was live
+// don't have it, so the old figure is invalidated after the change too
+void CanvasWidget::setSelection(const Selection& newSelection)
+{
+  FigureHandle oldFigure = selection_.figure;
+  invalidateFigure(oldFigure);
+  invalidateFigure(newSelection.figure);
+  selection_ = newSelection;
+  invalidateFigure(oldFigure);
+  invalidateFigure(selection_.figure);
+}
+
+void CanvasWidget::setHover(const Selection& newHover)
+{
+  FigureHandle oldFigure = hover_.figure;
+  invalidateFigure(oldFigure);
+  invalidateFigure(newHover.figure);
+  hover_ = newHover;
+  invalidateFigure(oldFigure);
+  invalidateFigure(hover_.figure);
+}
+
+// For changes that affect every figure, e.g. scale or inscriptions
+void CanvasWidget::invalidateAllFigures()
+{
+  figureScreenMargin_ = -1;
+  overlayCache_.clear();
+  bakedFigures_.clear();
+  update();
+}
 
 void CanvasWidget::updateMousePos(QPoint mousePos)
 {
-  mousePos.setX(qBound(0, mousePos.x(), image_.width()));
-  mousePos.setY(qBound(0, mousePos.y(), image_.height()));
+  mousePos.setX(qBound(0, mousePos.x(), width()));
+  mousePos.setY(qBound(0, mousePos.y(), height()));
   pointUnderMouse_ = mousePos;
   originalPointUnderMouse_ = pointUnderMouse_ / scale_;
+  gradientRectInUse_ = QRect();
+  if (isSnappingToEdges_)
+    originalPointUnderMouse_ = snappedToEdge(originalPointUnderMouse_);
+  updateLassoPath();
+}
+
+// For changes of what the cursor position depends on
+void CanvasWidget::refreshMousePos()
+{
+  invalidateFigure(activeFigure_);
+  updateMousePos(pointUnderMouse_.toPoint());
+  invalidateFigure(activeFigure_);
+  updateHoverAndStatus();
+}
+
+// Tiles that are not computed yet read as zero gradient, i.e. no edges
+GradientField CanvasWidget::readGradient(int level, const QRect& levelRect)
+{
+  GradientField result;
+  gradientPyramid_.readCached(level, levelRect, result);
+  int levelPixel = 1 << level;
+  gradientRectInUse_ |= QRect(result.rect.topLeft() * levelPixel, result.rect.size() * levelPixel);
+  return result;
+}
+
+// The cursor stays within the viewport, so computing its gradient in advance is enough for snapping and lasso
+void CanvasWidget::requestVisibleGradient()
+{
+  if (!isSnappingToEdges_ && !isMagneticLasso_)
+    return;
+  int level = imagePyramid_.levelForScale(scale_);
+  double levelScale = scale_ * (1 << level);
+  QRect visibleRect = visibleRegion().boundingRect();
+  QRect levelRect(QPoint(int(std::floor(visibleRect.left() / levelScale)),        int(std::floor(visibleRect.top() / levelScale))),
+                  QPoint(int(std::floor((visibleRect.right() + 1) / levelScale)), int(std::floor((visibleRect.bottom() + 1) / levelScale))));
+  gradientPyramid_.request(gradientPyramid_.missingTiles(level, levelRect));
+}
+
+QPointF CanvasWidget::snappedToEdge(QPointF originalPoint)
+{
+  int level = imagePyramid_.levelForScale(scale_);
+  int levelPixel = 1 << level;
+  int radius = qMax(1, qRound(edgeSnapRadius / (scale_ * levelPixel)));
+  QPoint center(int(std::floor(originalPoint.x() / levelPixel)), int(std::floor(originalPoint.y() / levelPixel)));
+  GradientField field = readGradient(level, QRect(center - QPoint(radius, radius), center + QPoint(radius, radius)));
+  QPoint edge;
+  if (!findStrongestEdge(field, center, radius, edge))
+    return originalPoint;
+  return (QPointF(edge) + QPointF(0.5, 0.5)) * levelPixel;
+}
+
+void CanvasWidget::updateLassoPath()
+{
+  lassoPath_.clear();
+  const Figure* activeFigure = figures_.get(activeFigure_);
+  if (!isMagneticLasso_ || !activeFigure || activeFigure->isFinished())
+    return;
+  ShapeType shapeType = activeFigure->shapeType();
+  if (shapeType != POLYLINE && shapeType != CLOSED_POLYLINE && shapeType != POLYGON)
+    return;
+  QPolygonF vertices = activeFigure->originalShape().vertices();
+  if (vertices.isEmpty())
+    return;
+
+  int level = imagePyramid_.levelForScale(scale_);
+  int levelPixel = 1 << level;
+  QPointF from = vertices.last();
+  QPointF to = originalPointUnderMouse_;
+  QPoint levelFrom(int(std::floor(from.x() / levelPixel)), int(std::floor(from.y() / levelPixel)));
+  QPoint levelTo  (int(std::floor(to.x()   / levelPixel)), int(std::floor(to.y()   / levelPixel)));
+  QRect window = QRect(QPoint(qMin(levelFrom.x(), levelTo.x()), qMin(levelFrom.y(), levelTo.y())),
+                       QPoint(qMax(levelFrom.x(), levelTo.x()), qMax(levelFrom.y(), levelTo.y())))
+                 .adjusted(-lassoWindowMargin, -lassoWindowMargin, lassoWindowMargin, lassoWindowMargin);
+  if (window.width() > maxLassoWindowSize || window.height() > maxLassoWindowSize)
+    return;
+  QPolygon levelPath = traceEdge(readGradient(level, window), levelFrom, levelTo);
+  if (levelPath.size() <= 2)
+    return;
+
+  // Pixel steps are replaced with as few vertices as the edge allows; the ends are the real points, not pixel centers
+  QPolygonF path;
+  path.append(from);
+  for (int i = 1; i < levelPath.size() - 1; ++i)
+    path.append((QPointF(levelPath[i]) + QPointF(0.5, 0.5)) * levelPixel);
+  path.append(to);
+  QVector<int> keptVertices = simplifyPolyline(path, maxLassoSimplificationError * levelPixel);
+  for (int i = 1; i < keptVertices.size() - 1; ++i)
+    lassoPath_.append(path[keptVertices[i]]);
+}
+
+void CanvasWidget::dragSelectionTo(QPointF originalPos)
+{
+  Figure* selectedFigure = figures_.get(selection_.figure);
+  if (!selectedFigure)
+    return;
+  invalidateFigure(selection_.figure);
+  selectedFigure->dragTo(selection_, originalPos);
+  invalidateFigure(selection_.figure);
+  figureIndex_.setFigure(selection_.figure, selectedFigure->originalBoundingRect());
+  if (selectedFigure->isEtalon())
+    defineEtalon(selection_.figure);
 }
 
 void CanvasWidget::updateHover()
 {
+  ScopedPerfTimer perfTimer(perfStats_, PerfStats::UPDATE_HOVER);
   Selection newHover;
-  if (activeFigure_) {
+  if (!activeFigure_.isNull()) {
     newHover.clear();
   }
   else {
+    // Hover follows the cursor itself, not the point snapped to an edge
     SelectionFinder selectionFinder(pointUnderMouse_);
-    for (FigureIter it = figures_.begin(); it != figures_.end(); ++it)
-      if (it->isFinished())
-        it->testSelection(selectionFinder);
+    QPointF originalCursorPos = pointUnderMouse_ / scale_;
+    double originalRadius = maxActivationRadius / scale_;
+    QRectF originalSearchRect(originalCursorPos - QPointF(originalRadius, originalRadius),
+                              originalCursorPos + QPointF(originalRadius, originalRadius));
+    foreach (FigureHandle figure, figureIndex_.figuresNear(originalSearchRect))
+      figures_.get(figure)->testSelection(selectionFinder, figure);
     newHover = selectionFinder.bestSelection();
   }
-  if (hover_ != newHover) {
-    hover_ = newHover;
-    update();
-  }
+  if (hover_ != newHover)
+    setHover(newHover);
 }
 
 void CanvasWidget::updateStatus()
 {
+  ScopedPerfTimer perfTimer(perfStats_, PerfStats::UPDATE_STATUS);
   QString statusString;
-  if (activeFigure_)
-    statusString = activeFigure_->statusString();
-  else if (!selection_.isEmpty())
-    statusString = selection_.figure->statusString();
+  const Figure* activeFigure = figures_.get(activeFigure_);
+  const Figure* selectedFigure = figures_.get(selection_.figure);
+  if (activeFigure)
+    statusString = activeFigure->statusString();
+  else if (selectedFigure)
+    statusString = selectedFigure->statusString();
   statusLabel_->setText(statusString);
 }
 
-void CanvasWidget::defineEtalon(Figure* newEtalonFigure)
+void CanvasWidget::defineEtalon(FigureHandle newEtalonFigure)
 {
-  ASSERT_RETURN(newEtalonFigure && newEtalonFigure->isFinished());
+  const Figure* newEtalonFigurePtr = figures_.get(newEtalonFigure);
+  ASSERT_RETURN(newEtalonFigurePtr && newEtalonFigurePtr->isFinished());
   bool isResizing = (etalonFigure_ == newEtalonFigure);
   etalonFigure_ = newEtalonFigure;
-  const Shape originalShapeDrawn = newEtalonFigure->originalShape();
+  const Shape originalShapeDrawn = newEtalonFigurePtr->originalShape();
   double originalEtalonPixelLength = 0.;
   QString prompt;
   switch (originalShapeDrawn.dimensionality()) {
@@ -368,6 +975,7 @@ void CanvasWidget::defineEtalon(Figure* newEtalonFigure)
   }
   if (!isResizing)
     mainWindow_->toggleEtalonDefinition(false);
+  invalidateAllFigures();  // all the inscriptions have changed
 }
 
 void CanvasWidget::clearEtalon(bool invalidateOnly)
@@ -376,39 +984,182 @@ void CanvasWidget::clearEtalon(bool invalidateOnly)
     etalonMetersSize_ = 0;
   originalMetersPerPixel_ = 0.;
   metersPerPixel_ = 0.;
+  invalidateAllFigures();  // all the inscriptions have changed
 }
 
 void CanvasWidget::finishDrawing()
 {
-  ASSERT_RETURN(activeFigure_);
-  activeFigure_->finish();
-  Figure *oldActiveFigure = activeFigure_;
-  activeFigure_ = 0;
+  ASSERT_RETURN(figures_.contains(activeFigure_));
+  invalidateFigure(activeFigure_);
+  figures_.get(activeFigure_)->finish();
+  invalidateFigure(activeFigure_);
+  FigureHandle oldActiveFigure = activeFigure_;
+  activeFigure_ = FigureHandle();
+  lassoPath_.clear();
+  figureIndex_.setFigure(oldActiveFigure, figures_.get(oldActiveFigure)->originalBoundingRect());
   if (isDefiningEtalon_)
     defineEtalon(oldActiveFigure);
-  selection_.setFigure(oldActiveFigure);
-  updateAll();
+  Selection newSelection;
+  newSelection.setFigure(oldActiveFigure);
+  setSelection(newSelection);
+  updateHoverAndStatus();
 }
 
 void CanvasWidget::resetAll()
 {
   removeFigure(activeFigure_);
-  updateAll();
+  regionFiller_.cancel();
+  regionFigure_ = FigureHandle();
+  updateHoverAndStatus();
 }
 
 void CanvasWidget::scaleChanged()
 {
+  ScopedPerfTimer perfTimer(perfStats_, PerfStats::SCALE_CHANGED);
   scale_ = acceptableScales_[iScale_];
-  image_ = originalImage_.scaled(originalImage_.size() * scale_, Qt::KeepAspectRatio, Qt::SmoothTransformation);
   metersPerPixel_ = originalMetersPerPixel_ / scale_;
-  setFixedSize(image_.size());
+  setFixedSize(imagePyramid_.size() * scale_);
   scaleLabel_->setText(QString::number(scale_ * 100.) + "%");
+  invalidateAllFigures();
   updateAll();
 }
 
-void CanvasWidget::updateAll()
+// Figures that have changed should be invalidated by the caller
+void CanvasWidget::updateHoverAndStatus()
 {
   updateHover();
   updateStatus();
+}
+
+void CanvasWidget::updateAll()
+{
+  updateHoverAndStatus();
   update();
 }
+
+void CanvasWidget::togglePerfOverlay()
+{
+  perfStats_.setEnabled(!perfStats_.isEnabled());
+  if (perfStats_.isEnabled())
+    perfOverlayTimer_.start();
+  else
+    perfOverlayTimer_.stop();
+  update(perfOverlayRect_);
+  update(visibleRegion().boundingRect());  // the overlay is not drawn yet, so its rect is unknown
+}
+
+
+void CanvasWidget::smoothImageReady(const QRect& rect)
+{
+  update(rect);
+}
+
+void CanvasWidget::imageTileLoaded(const QRect& originalRect)
+{
+  update(QRect(QPoint(int(std::floor(originalRect.left() * scale_)),       int(std::floor(originalRect.top() * scale_))),
+               QPoint(int(std::ceil((originalRect.right() + 1) * scale_)), int(std::ceil((originalRect.bottom() + 1) * scale_)))));
+}
+
+// Snapped point and lasso path were computed without this tile, so they may be different now
+void CanvasWidget::gradientTileComputed(const QRect& originalRect)
+{
+  if (gradientRectInUse_.intersects(originalRect))
+    refreshMousePos();
+}
+
+// A new region replaces the etalon if it's being defined; a refilled one keeps its place, selection and etalon role
+void CanvasWidget::regionFilled()
+{
+  Shape shape(REGION, regionFiller_.result().outline);
+  Figure* figure = figures_.get(regionFigure_);
+  if (figure) {
+    invalidateFigure(regionFigure_);
+    *figure = Figure(shape, figure->isEtalon(), this);
+    invalidateFigure(regionFigure_);
+    figureIndex_.setFigure(regionFigure_, figure->originalBoundingRect());
+    if (regionFigure_ == etalonFigure_)
+      defineEtalon(regionFigure_);
+  }
+  else {
+    if (isDefiningEtalon_) {
+      clearEtalon();
+      removeFigure(etalonFigure_);
+    }
+    regionFigure_ = figures_.insert(Figure(shape, isDefiningEtalon_, this));
+    figureIndex_.setFigure(regionFigure_, figures_.get(regionFigure_)->originalBoundingRect());
+    Selection newSelection;
+    newSelection.setFigure(regionFigure_);
+    setSelection(newSelection);
+    if (isDefiningEtalon_)
+      defineEtalon(regionFigure_);
+  }
+  updateHoverAndStatus();
+}
+
+void CanvasWidget::censusCounted()
+{
+  CensusResult census = colorCensus_.result();
+  QStringList lines;
+  for (int i = 0; i < census.classes.size(); ++i) {
+    QString area;
+    if (hasEtalon())
+      area = QString("%1 %2").arg(census.nPixels[i] * sqr(originalMetersPerPixel_), 0, 'g', censusOutputPrecision).arg(squareUnitSuffix);
+    else
+      area = QString::fromUtf8("%1 пикс.").arg(census.nPixels[i]);
+    lines.append(QString::fromUtf8("%1 ± %2: %3").arg(QColor(census.classes[i].color).name())
+                                                  .arg(census.classes[i].tolerance).arg(area));
+  }
+  QMessageBox::information(this, mainWindow_->appName(), lines.join("\n"));
+}
+
+// Scrolling moves the old ruler and performance overlay together with the image, so it has to be erased and drawn again at the new place
+void CanvasWidget::visibleAreaChanged()
+{
+  QRect visibleRect = visibleRegion().boundingRect();
+  if (perfStats_.isEnabled()) {
+    update(perfOverlayRect_);
+    update(perfOverlayRect_.translated(visibleRect.topLeft() + QPoint(perfOverlayMargin, perfOverlayMargin)
+                                       - perfOverlayRect_.topLeft()));
+  }
+  if (!showRuler_)
+    return;
+  update(rulerRect_);
+  update(rulerRect_.translated(visibleRect.bottomLeft() - rulerVisibleRect_.bottomLeft()));
+}
+
+void CanvasWidget::applyRestoredScrollPos()
+{
+  scrollArea_->horizontalScrollBar()->setValue(restoredScrollPos_.x());
+  scrollArea_->verticalScrollBar()->setValue(restoredScrollPos_.y());
+}
+
+void CanvasWidget::refreshPerfOverlay()
+{
+  update(perfOverlayRect_);
+}
+
+void CanvasWidget::processPendingMouseMove()
+{
+  mouseMoveTimer_.stop();
+  if (!hasPendingMouseMove_)
+    return;
+  hasPendingMouseMove_ = false;
+  sinceMouseMoveProcessed_.start();
+  if (pendingMouseButtons_ == Qt::NoButton) {
+    // Unfinished figure follows the cursor
+    invalidateFigure(activeFigure_);
+    updateMousePos(pendingMousePos_);
+    invalidateFigure(activeFigure_);
+    updateHoverAndStatus();
+  }
+  else if (pendingMouseButtons_ == Qt::LeftButton) {
+    updateMousePos(pendingMousePos_);
+    dragSelectionTo(originalPointUnderMouse_);
+    updateHoverAndStatus();
+  }
+  else if (pendingMouseButtons_ == Qt::RightButton) {
+    QPoint scrollBy = scrollStartPoint_ - pendingGlobalMousePos_;
+    scrollArea_->horizontalScrollBar()->setValue(scrollStartHValue_ + scrollBy.x());
+    scrollArea_->verticalScrollBar()  ->setValue(scrollStartVValue_ + scrollBy.y());
+  }
+}
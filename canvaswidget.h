@@ -1,17 +1,32 @@
 #ifndef CANVASWIDGET_H
 #define CANVASWIDGET_H
 
-#include <QLinkedList>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QTimer>
 #include <QWidget>
 
+#include "color_census.h"
 #include "defines.h"
 #include "figure.h"
+#include "figure_index.h"
+#include "flood_fill.h"
+#include "gradient_pyramid.h"
+#include "image_pyramid.h"
+#include "overlay_cache.h"
+#include "perf_stats.h"
 #include "selection.h"
+#include "session.h"
+#include "slot_map.h"
+#include "tile_loader.h"
+#include "zoom_renderer.h"
 
 class MainWindow;
 class QLabel;
 class QScrollArea;
 
+extern const int defaultFillTolerance;
+
 // in all variables ``original'' prefix means ``in original scale''
 //TODO: change naming, it's counterintuitive
 
@@ -20,33 +35,52 @@ class CanvasWidget : public QWidget
   Q_OBJECT
 
 public:
-  CanvasWidget(const QPixmap& image, MainWindow* mainWindow, QScrollArea* scrollArea,
+  CanvasWidget(TileSource* imageSource, MainWindow* mainWindow, QScrollArea* scrollArea,
                QLabel* scaleLabel, QLabel* statusLabel, QWidget* parent = 0);
   ~CanvasWidget();
 
   void setMode(ShapeType newMode);
   bool hasEtalon() const;
-  QPixmap getModifiedImage();
+  bool saveModifiedImage(const QString& filename) const;
+  bool exportOverlay(const QString& filename, const QString& linkedImageFilename) const;
+  Session session() const;  // without image filename and fingerprint, the canvas doesn't know them
+  void restoreSession(const Session& session);
+  void setInscriptionFont(const QFont& font);
+
+  // Colour census: every added class is counted over the whole image with the current fill tolerance,
+  // its pixels are highlighted and the areas are reported when the count is done
+  void addCensusClass(const QColor& color);
+  void clearCensus();
+  QColor regionSeedColor() const;  // of the latest flood fill; invalid if there is none
 
 public slots:
   void toggleEtalonDefinition(bool isDefiningEtalon);
   void toggleRuler(bool showRuler);
+  void toggleEdgeSnapping(bool snapToEdges);
+  void toggleMagneticLasso(bool isMagneticLasso);
+  void setFillTolerance(int tolerance);
 
 private:
-  typedef QLinkedList<Figure>::Iterator FigureIter;
-
   // Global
   MainWindow* mainWindow_;
   QScrollArea* scrollArea_;
   QLabel* scaleLabel_;
   QLabel* statusLabel_;
-  QPixmap originalImage_;
-  QPixmap image_;
+  ImagePyramid imagePyramid_;
+  ZoomRenderer zoomRenderer_;
+  TileLoader tileLoader_;
+  GradientPyramid gradientPyramid_;  // only computed while edge snapping or magnetic lasso is on
+  RegionFiller regionFiller_;
+  ColorCensus colorCensus_;
+  CensusOverlay censusOverlay_;
 
   // Current state
   ShapeType shapeType_;
   bool isDefiningEtalon_;
   bool showRuler_;
+  bool isSnappingToEdges_;
+  bool isMagneticLasso_;
+  int fillTolerance_;
 
   // Scale
   QList<double> acceptableScales_;
@@ -60,19 +94,46 @@ private:
 
   // Drawings
   QPointF pointUnderMouse_;
-  QPointF originalPointUnderMouse_;
-  QLinkedList<Figure> figures_;  // We want pointers not to be invalidated after insertions
+  QPointF originalPointUnderMouse_;  // snapped to an image edge if isSnappingToEdges_
+  QPolygonF lassoPath_;              // magnetic lasso: vertices along an edge between the last vertex and the cursor
+  QRect gradientRectInUse_;          // original rect of the gradient that the cursor position was computed from
+  SlotMap<Figure> figures_;
+  FigureIndex figureIndex_;      // finished figures
+  OverlayCache overlayCache_;    // static figures, see isStatic
+  QSet<FigureHandle> bakedFigures_;  // figures that may be present in overlay tiles
+  int figureScreenMargin_;           // the largest screenMargin of figures since invalidateAllFigures; -1 if not computed yet
+  QPoint regionSeed_;                // of the latest flood fill
+  FigureHandle regionFigure_;        // made by the latest flood fill; it's filled again when the tolerance changes
+  QList<ColorClass> censusClasses_;
 
   // Current state
-  Figure* etalonFigure_;
-  Figure* activeFigure_;
+  FigureHandle etalonFigure_;
+  FigureHandle activeFigure_;
   Selection selection_;
   Selection hover_;
 
+  // Ruler, as it was painted last time
+  QRect rulerRect_;
+  QRect rulerVisibleRect_;
+
+  // Performance overlay (F12)
+  mutable PerfStats perfStats_;  // figures count their recomputations in it
+  QTimer perfOverlayTimer_;      // timings change without repaints, so the overlay is refreshed periodically
+  QRect perfOverlayRect_;        // as it was painted last time
+
+  // Mouse moves are coalesced: only the latest one is processed, at most once per display frame
+  QTimer mouseMoveTimer_;
+  QElapsedTimer sinceMouseMoveProcessed_;
+  bool hasPendingMouseMove_;
+  QPoint pendingMousePos_;
+  QPoint pendingGlobalMousePos_;
+  Qt::MouseButtons pendingMouseButtons_;
+
   // Scroll
   QPoint scrollStartPoint_;
   int scrollStartHValue_;
   int scrollStartVValue_;
+  QPoint restoredScrollPos_;  // applied when scroll bars have adapted to the restored scale
 
 private:
   virtual void paintEvent(QPaintEvent* event);
@@ -84,19 +145,51 @@ private:
   virtual bool eventFilter(QObject* object, QEvent* event);
 
   void addActiveFigure();
-  void removeFigure(const Figure* figure);
-
-  void drawRuler(QPainter& painter, const QRect& rect);
-
+  void removeFigure(FigureHandle figure);
+  void fillRegion(QPoint seed);
+
+  void drawImage(QPainter& painter, const QRect& rect);
+  void drawStaticFigures(QPainter& painter, const QRect& rect);
+  QImage renderStaticFigures(const QRect& rect);
+  void drawOriginalOverlay(QPainter& painter, const QRect& rect, const QList<QRect>& figureRects) const;
+  QRect drawRuler(QPainter* painter, const QRect& rect, double metersPerPixel) const;
+  QRect drawPerfOverlay(QPainter& painter, const QRect& visibleRect) const;
+  QRect smoothRenderRect() const;
+
+  bool isStatic(FigureHandle figure) const;
+  int screenMargin(const Figure& figure) const;
+  void invalidateFigure(FigureHandle figure);
+  void invalidateAllFigures();
+  void setSelection(const Selection& newSelection);
+  void setHover(const Selection& newHover);
   void updateMousePos(QPoint mousePos);
+  void refreshMousePos();
+  GradientField readGradient(int level, const QRect& levelRect);
+  void requestVisibleGradient();
+  QPointF snappedToEdge(QPointF originalPoint);
+  void updateLassoPath();
+  void dragSelectionTo(QPointF originalPos);
   void updateHover();
   void updateStatus();
-  void defineEtalon(Figure* etalonFigure);
+  void defineEtalon(FigureHandle etalonFigure);
   void clearEtalon(bool invalidateOnly = false);
   void finishDrawing();
   void resetAll();
   void scaleChanged();
+  void updateHoverAndStatus();
   void updateAll();
+  void togglePerfOverlay();
+
+private slots:
+  void smoothImageReady(const QRect& rect);
+  void imageTileLoaded(const QRect& originalRect);
+  void gradientTileComputed(const QRect& originalRect);
+  void regionFilled();
+  void censusCounted();
+  void visibleAreaChanged();
+  void applyRestoredScrollPos();
+  void refreshPerfOverlay();
+  void processPendingMouseMove();
 
   friend class Figure;
 };
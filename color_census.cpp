@@ -0,0 +1,249 @@
+#include <cmath>
+
+#include <QMutexLocker>
+#include <QPainter>
+#include <QtConcurrentRun>
+
+#include "color_census.h"
+#include "debug_utils.h"
+
+
+const int censusBlockSize = 1024;                 // original pixels; a block is read and counted as a whole
+const int maxCensusOverlayKBytes = 32 * 1024;
+const int censusMaskAlpha = 144;
+
+static const int bitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Classification
+
+ColorClass::ColorClass() :
+  color(0),
+  tolerance(0)
+{
+}
+
+ColorClass::ColorClass(QRgb color__, int tolerance__) :
+  color(color__),
+  tolerance(tolerance__)
+{
+}
+
+CensusResult::CensusResult() :
+  classes(),
+  nPixels()
+{
+}
+
+void countColorClasses(const QRgb* pixels, int nPixels, const QList<ColorRange>& classRanges, qint64* counts)
+{
+  int nClasses = classRanges.size();
+  int i = 0;
+  for (; i + 4 <= nPixels; i += 4) {
+    int unclassified = 0xf;
+    for (int iClass = 0; iClass < nClasses && unclassified; ++iClass) {
+      int mask = classRanges[iClass].matchMask(pixels + i) & unclassified;
+      counts[iClass] += bitCount[mask];
+      unclassified &= ~mask;
+    }
+  }
+  for (; i < nPixels; ++i) {
+    for (int iClass = 0; iClass < nClasses; ++iClass) {
+      if (classRanges[iClass].matches(pixels[i])) {
+        counts[iClass]++;
+        break;
+      }
+    }
+  }
+}
+
+void paintColorClasses(const QRgb* pixels, int nPixels, const QList<ColorRange>& classRanges,
+                       const QVector<QRgb>& classColors, QRgb* mask)
+{
+  int nClasses = classRanges.size();
+  int i = 0;
+  for (; i + 4 <= nPixels; i += 4) {
+    mask[i] = mask[i + 1] = mask[i + 2] = mask[i + 3] = 0;
+    int unclassified = 0xf;
+    for (int iClass = 0; iClass < nClasses && unclassified; ++iClass) {
+      int classMask = classRanges[iClass].matchMask(pixels + i) & unclassified;
+      for (int j = 0; j < 4; ++j)
+        if (classMask & (1 << j))
+          mask[i + j] = classColors[iClass];
+      unclassified &= ~classMask;
+    }
+  }
+  for (; i < nPixels; ++i) {
+    mask[i] = 0;
+    for (int iClass = 0; iClass < nClasses; ++iClass) {
+      if (classRanges[iClass].matches(pixels[i])) {
+        mask[i] = classColors[iClass];
+        break;
+      }
+    }
+  }
+}
+
+// Hues are spread by the golden angle, so that neighbouring classes differ a lot
+QRgb censusMaskColor(int iClass)
+{
+  QColor color = QColor::fromHsv((300 + iClass * 137) % 360, 255, 255);
+  int alpha = censusMaskAlpha;
+  return qRgba(color.red() * alpha / 255, color.green() * alpha / 255, color.blue() * alpha / 255, alpha);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ColorCensus
+
+// Runs in a worker thread. The last block of a request reports that the census is done.
+void ColorCensus::countBlock(ColorCensus* census, QRect block, QList<ColorRange> classRanges, int jobGeneration)
+{
+  if (census->generation_ != jobGeneration)
+    return;
+  QImage image = census->pyramid_->readOriginal(block);
+  ASSERT_RETURN(image.depth() == 32 && image.size() == block.size());
+  QVector<qint64> counts(classRanges.size(), 0);
+  for (int y = 0; y < image.height(); ++y) {
+    if (census->generation_ != jobGeneration)
+      return;
+    countColorClasses(reinterpret_cast<const QRgb*>(image.constScanLine(y)), image.width(), classRanges, counts.data());
+  }
+
+  bool isLastBlock = false;
+  {
+    QMutexLocker locker(&census->resultMutex_);
+    if (census->generation_ != jobGeneration)
+      return;
+    for (int i = 0; i < counts.size(); ++i)
+      census->result_.nPixels[i] += counts[i];
+    isLastBlock = (--census->nBlocksLeft_ == 0);
+  }
+  if (isLastBlock)
+    QMetaObject::invokeMethod(census, "countFinished", Qt::QueuedConnection, Q_ARG(int, jobGeneration));
+}
+
+
+ColorCensus::ColorCensus(const ImagePyramid* pyramid, QObject* parent) :
+  QObject(parent),
+  pyramid_(pyramid),
+  generation_(0),
+  isBusy_(false),
+  resultMutex_(),
+  result_(),
+  nBlocksLeft_(0)
+{
+}
+
+ColorCensus::~ColorCensus()
+{
+  cancel();
+  foreach (QFuture<void> job, runningJobs_)
+    job.waitForFinished();
+}
+
+
+void ColorCensus::request(const QList<ColorClass>& classes)
+{
+  ASSERT_RETURN(!classes.isEmpty() && !pyramid_->isEmpty());
+  cancel();
+  int jobGeneration = generation_;
+  QList<QFuture<void> > stillRunning;
+  foreach (QFuture<void> oldJob, runningJobs_)
+    if (oldJob.isRunning())
+      stillRunning.append(oldJob);
+  runningJobs_ = stillRunning;
+
+  QList<ColorRange> classRanges;
+  foreach (const ColorClass& colorClass, classes)
+    classRanges.append(ColorRange(colorClass.color, colorClass.tolerance));
+  QList<QRect> blocks;
+  QSize size = pyramid_->size();
+  for (int top = 0; top < size.height(); top += censusBlockSize)
+    for (int left = 0; left < size.width(); left += censusBlockSize)
+      blocks.append(QRect(left, top, qMin(censusBlockSize, size.width() - left), qMin(censusBlockSize, size.height() - top)));
+  {
+    QMutexLocker locker(&resultMutex_);
+    result_.classes = classes;
+    result_.nPixels = QVector<qint64>(classes.size(), 0);
+    nBlocksLeft_ = blocks.size();
+  }
+  foreach (const QRect& block, blocks)
+    runningJobs_.append(QtConcurrent::run(countBlock, this, block, classRanges, jobGeneration));
+  isBusy_ = true;
+}
+
+void ColorCensus::cancel()
+{
+  QMutexLocker locker(&resultMutex_);  // a block that is being added is either added as a whole or not at all
+  generation_.fetchAndAddOrdered(1);
+  isBusy_ = false;
+}
+
+CensusResult ColorCensus::result() const
+{
+  QMutexLocker locker(&resultMutex_);
+  return result_;
+}
+
+
+void ColorCensus::countFinished(int jobGeneration)
+{
+  if (jobGeneration != generation_)
+    return;
+  isBusy_ = false;
+  emit counted();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CensusOverlay
+
+CensusOverlay::CensusOverlay(const ImagePyramid* pyramid) :
+  pyramid_(pyramid),
+  tiles_(maxCensusOverlayKBytes)
+{
+}
+
+void CensusOverlay::setClasses(const QList<ColorClass>& classes)
+{
+  classRanges_.clear();
+  classColors_.clear();
+  for (int i = 0; i < classes.size(); ++i) {
+    classRanges_.append(ColorRange(classes[i].color, classes[i].tolerance));
+    classColors_.append(censusMaskColor(i));
+  }
+  tiles_.clear();
+}
+
+void CensusOverlay::draw(QPainter& painter, const QRect& targetRect, double scale) const
+{
+  if (isEmpty() || pyramid_->isEmpty() || targetRect.isEmpty())
+    return;
+  int level = pyramid_->levelForScale(scale);
+  double levelScale = std::ldexp(scale, level);
+  QRect levelRect(QPoint(int(std::floor(targetRect.left() / levelScale)),
+                         int(std::floor(targetRect.top() / levelScale))),
+                  QPoint(int(std::floor((targetRect.right() + 1) / levelScale)),
+                         int(std::floor((targetRect.bottom() + 1) / levelScale))));
+  foreach (const ImagePyramid::TileKey& key, pyramid_->tilesInLevelRect(level, levelRect)) {
+    QRect tileTargetRect = pyramid_->targetTileRect(key, scale);
+    if (!tileTargetRect.intersects(targetRect))
+      continue;
+    const QImage* mask = tiles_.object(key.toUInt64());
+    if (!mask) {
+      QImage image = pyramid_->cachedTile(key);
+      if (image.isNull())
+        continue;  // it's drawn when the image tile is loaded
+      ASSERT_RETURN(image.depth() == 32);
+      QImage* newMask = new QImage(image.size(), QImage::Format_ARGB32_Premultiplied);
+      for (int y = 0; y < image.height(); ++y)
+        paintColorClasses(reinterpret_cast<const QRgb*>(image.constScanLine(y)), image.width(), classRanges_, classColors_,
+                          reinterpret_cast<QRgb*>(newMask->scanLine(y)));
+      tiles_.insert(key.toUInt64(), newMask, qMax(1, newMask->byteCount() / 1024));
+      mask = newMask;
+    }
+    painter.drawImage(tileTargetRect, *mask);
+  }
+}
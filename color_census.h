@@ -0,0 +1,102 @@
+#ifndef COLOR_CENSUS_H
+#define COLOR_CENSUS_H
+
+#include <QAtomicInt>
+#include <QCache>
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+#include "color_range.h"
+#include "image_pyramid.h"
+
+class QPainter;
+
+// Area of every colour class over the whole original image, e.g. all green areas of a map. The image is scanned
+// in blocks on all cores, pixels are compared with SSE2 four at a time. A pixel that matches several classes
+// counts in the first one.
+
+struct ColorClass
+{
+  QRgb color;
+  int tolerance;  // in every channel, like in a flood fill
+
+  ColorClass();
+  ColorClass(QRgb color__, int tolerance__);
+};
+
+struct CensusResult
+{
+  QList<ColorClass> classes;
+  QVector<qint64> nPixels;  // of every class
+
+  CensusResult();
+};
+
+// Adds the number of pixels of every class to counts
+void countColorClasses(const QRgb* pixels, int nPixels, const QList<ColorRange>& classRanges, qint64* counts);
+
+// Makes mask pixels of every class its class colour, and the rest transparent
+void paintColorClasses(const QRgb* pixels, int nPixels, const QList<ColorRange>& classRanges,
+                       const QVector<QRgb>& classColors, QRgb* mask);
+
+QRgb censusMaskColor(int iClass);  // premultiplied, half transparent
+
+class ColorCensus : public QObject
+{
+  Q_OBJECT
+
+public:
+  ColorCensus(const ImagePyramid* pyramid, QObject* parent = 0);
+  ~ColorCensus();
+
+  void request(const QList<ColorClass>& classes);
+  void cancel();
+  bool isBusy() const  { return isBusy_; }
+  CensusResult result() const;  // of the latest request, after counted() is emitted
+
+signals:
+  void counted();
+
+private:
+  const ImagePyramid* pyramid_;
+  QAtomicInt generation_;
+  QList<QFuture<void> > runningJobs_;
+  bool isBusy_;
+  mutable QMutex resultMutex_;
+  CensusResult result_;
+  int nBlocksLeft_;  // of the latest request
+
+  Q_DISABLE_COPY(ColorCensus)
+
+  static void countBlock(ColorCensus* census, QRect block, QList<ColorRange> classRanges, int jobGeneration);
+
+private slots:
+  void countFinished(int jobGeneration);
+};
+
+// Shows what a census counts. Tiles of the displayed pyramid level are classified as they are drawn, so when zoomed out
+// the mask is only as precise as the level.
+class CensusOverlay
+{
+public:
+  explicit CensusOverlay(const ImagePyramid* pyramid);
+
+  bool isEmpty() const  { return classRanges_.isEmpty(); }
+  void setClasses(const QList<ColorClass>& classes);
+
+  // Only over the image tiles that are decoded, like ImagePyramid::drawCached
+  void draw(QPainter& painter, const QRect& targetRect, double scale) const;
+
+private:
+  const ImagePyramid* pyramid_;
+  QList<ColorRange> classRanges_;
+  QVector<QRgb> classColors_;
+  mutable QCache<quint64, QImage> tiles_;
+
+  Q_DISABLE_COPY(CensusOverlay)
+};
+
+#endif // COLOR_CENSUS_H
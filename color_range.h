@@ -0,0 +1,85 @@
+#ifndef COLOR_RANGE_H
+#define COLOR_RANGE_H
+
+#include <QColor>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+// Colours not further than tolerance from a colour in every channel; alpha is ignored
+class ColorRange
+{
+public:
+  ColorRange(QRgb color, int tolerance) :
+    color_(color),
+    tolerance_(qBound(0, tolerance, 255))
+  { }
+
+  bool matches(QRgb color) const
+  {
+    return    qAbs(qRed(color)   - qRed(color_))   <= tolerance_
+           && qAbs(qGreen(color) - qGreen(color_)) <= tolerance_
+           && qAbs(qBlue(color)  - qBlue(color_))  <= tolerance_;
+  }
+
+#if defined(__SSE2__)
+  // Bit i is set if pixel i of the four matches
+  int matchMask(const QRgb* pixels) const
+  {
+    const __m128i center = _mm_set1_epi32(int(color_));
+    const __m128i tolerance = _mm_set1_epi32(int(qRgba(tolerance_, tolerance_, tolerance_, 255)));
+    __m128i colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+    __m128i difference = _mm_or_si128(_mm_subs_epu8(colors, center), _mm_subs_epu8(center, colors));
+    int byteMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(difference, tolerance), _mm_setzero_si128()));
+    byteMask &= byteMask >> 1;  // a pixel matches if all of its 4 bytes do
+    byteMask &= byteMask >> 2;
+    return (byteMask & 1) | ((byteMask >> 3) & 2) | ((byteMask >> 6) & 4) | ((byteMask >> 9) & 8);
+  }
+#else
+  int matchMask(const QRgb* pixels) const
+  {
+    return int(matches(pixels[0])) | (int(matches(pixels[1])) << 1) | (int(matches(pixels[2])) << 2) | (int(matches(pixels[3])) << 3);
+  }
+#endif
+
+  // Number of pixels from pixels[0] forward (or backward) that match (or don't, if !isMatching), at most n
+  int runLength(const QRgb* pixels, int n, bool isMatching) const
+  {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+      int mask = matchMask(pixels + i) ^ (isMatching ? 0 : 0xf);
+      if (mask != 0xf)
+        return i + lowestZeroBit(mask);
+    }
+#endif
+    while (i < n && matches(pixels[i]) == isMatching)
+      ++i;
+    return i;
+  }
+
+  int runLengthBackward(const QRgb* pixels, int n, bool isMatching) const
+  {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+      int mask = matchMask(pixels - i - 3) ^ (isMatching ? 0 : 0xf);
+      if (mask != 0xf)
+        return i + 3 - highestZeroBit(mask);
+    }
+#endif
+    while (i < n && matches(pixels[-i]) == isMatching)
+      ++i;
+    return i;
+  }
+
+private:
+  QRgb color_;
+  int tolerance_;
+
+  static int lowestZeroBit(int mask)   { int i = 0;  while (mask & (1 << i)) ++i;  return i; }
+  static int highestZeroBit(int mask)  { int i = 3;  while (mask & (1 << i)) --i;  return i; }
+};
+
+#endif // COLOR_RANGE_H
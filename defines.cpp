@@ -23,7 +23,33 @@ Dimensionality getDimensionality(ShapeType shapeType)
       return SHAPE_1D;
     case POLYGON:
     case RECTANGLE:
+    case REGION:
       return SHAPE_2D;
   }
   ERROR_RETURN_V(SHAPE_1D);
 }
+
+QString shapeTypeName(ShapeType shapeType)
+{
+  switch (shapeType) {
+    case SEGMENT:         return "segment";
+    case POLYLINE:        return "polyline";
+    case CLOSED_POLYLINE: return "closed_polyline";
+    case RECTANGLE:       return "rectangle";
+    case POLYGON:         return "polygon";
+    case REGION:          return "region";
+  }
+  ERROR_RETURN_V(QString());
+}
+
+bool parseShapeType(const QString& name, ShapeType& shapeType)
+{
+  const ShapeType allTypes[] = { SEGMENT, POLYLINE, CLOSED_POLYLINE, RECTANGLE, POLYGON, REGION };
+  for (size_t i = 0; i < sizeof(allTypes) / sizeof(allTypes[0]); ++i) {
+    if (name == shapeTypeName(allTypes[i])) {
+      shapeType = allTypes[i];
+      return true;
+    }
+  }
+  return false;
+}
@@ -1,6 +1,8 @@
 #ifndef DEFINES_H
 #define DEFINES_H
 
+#include <QString>
+
 #include "debug_utils.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -23,6 +25,8 @@ enum ShapeType
   CLOSED_POLYLINE,
   RECTANGLE,
   POLYGON,
+  REGION,  // pixels of similar colour found by a flood fill; points are its boundary rings one after another, each closed
+           // and not passing its first point in between
 
   DEFAULT_TYPE = SEGMENT
 };
@@ -41,4 +45,8 @@ enum ShapeCorrectness
 
 Dimensionality getDimensionality(ShapeType shapeType);
 
+// Names used in text files: "segment", "polyline", "closed_polyline", "rectangle", "polygon", "region"
+QString shapeTypeName(ShapeType shapeType);
+bool parseShapeType(const QString& name, ShapeType& shapeType);  // returns false for unknown names
+
 #endif // DEFINES_H
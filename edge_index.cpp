@@ -0,0 +1,200 @@
+#include <cmath>
+
+#include <QLineF>
+
+#include "debug_utils.h"
+#include "edge_index.h"
+#include "geometry.h"
+
+
+// Makes cell lookup conservative: an edge passing within this distance (relative to cell size) from a cell boundary is put in both cells
+const double cellMargin = 1e-6;
+
+static inline quint64 makeCellKey(int cx, int cy)
+{
+  return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+
+static inline int cellCoordinate(double x, double cellSize)
+{
+  return int(std::floor(x / cellSize));
+}
+
+static inline bool areAdjacentEdges(int iEdge1, int iEdge2, int nEdges)
+{
+  return    iEdge1 == iEdge2
+         || (iEdge1 + 1) % nEdges == iEdge2
+         || (iEdge2 + 1) % nEdges == iEdge1;
+}
+
+
+EdgeIndex::EdgeIndex(const QPolygonF& vertices) :
+  vertices_(vertices),
+  cellSize_(1.),
+  cells_(),
+  nVerticesAtRebuild_(0),
+  nCrossings_(0),
+  visitStamps_(),
+  currentStamp_(0)
+{
+  rebuild();
+}
+
+
+int EdgeIndex::nCrossingsWithAppendedVertex(QPointF newVertex) const
+{
+  int n = nEdges();
+  if (n == 0)
+    return 0;
+  // Closing edge is replaced with two new edges: (last vertex, new vertex) and (new vertex, first vertex)
+  int closingEdge = n - 1;
+  return   nCrossings_
+         - countCrossings(closingEdge, -1)
+         + countCrossings(vertices_.last(), newVertex, n - 1, n + 1, closingEdge)
+         + countCrossings(newVertex, vertices_.first(), n, n + 1, closingEdge);
+}
+
+void EdgeIndex::moveVertex(int iVertex, QPointF newPos)
+{
+  int n = nEdges();
+  ASSERT_RETURN(0 <= iVertex && iVertex < n);
+  int prevEdge = (iVertex + n - 1) % n;
+  int nextEdge = iVertex;
+  if (prevEdge == nextEdge) {
+    vertices_[iVertex] = newPos;
+    return;
+  }
+  nCrossings_ -= countCrossings(prevEdge, nextEdge) + countCrossings(nextEdge, prevEdge);
+  removeEdge(prevEdge);
+  removeEdge(nextEdge);
+  vertices_[iVertex] = newPos;
+  insertEdge(prevEdge);
+  insertEdge(nextEdge);
+  nCrossings_ += countCrossings(prevEdge, nextEdge) + countCrossings(nextEdge, prevEdge);
+}
+
+void EdgeIndex::appendVertex(QPointF newVertex)
+{
+  int n = nEdges();
+  // Cell size is chosen for the current edge length, so start over when the polygon has grown considerably
+  if (n == 0 || n + 1 > 2 * nVerticesAtRebuild_) {
+    vertices_.append(newVertex);
+    rebuild();
+    return;
+  }
+  int closingEdge = n - 1;
+  nCrossings_ -= countCrossings(closingEdge, -1);
+  removeEdge(closingEdge);
+  vertices_.append(newVertex);
+  visitStamps_.append(0);
+  insertEdge(n - 1);
+  insertEdge(n);
+  nCrossings_ += countCrossings(n - 1, n) + countCrossings(n, n - 1);
+}
+
+
+void EdgeIndex::rebuild()
+{
+  // Cells should be about the size of an edge, but not much larger than the area per edge: long edges make
+  // a few extra cell lookups, while overcrowded cells make every lookup slow
+  int n = nEdges();
+  double perimeter = 0.;
+  for (int i = 0; i < n; ++i)
+    perimeter += QLineF(edgeStart(i), edgeEnd(i)).length();
+  QRectF boundingRect = vertices_.boundingRect();
+  cellSize_ = 1.;
+  if (perimeter > 0.)
+    cellSize_ = perimeter / n;
+  if (boundingRect.width() > 0. && boundingRect.height() > 0.)
+    cellSize_ = qMin(cellSize_, std::sqrt(boundingRect.width() * boundingRect.height() / n));
+  nVerticesAtRebuild_ = n;
+  visitStamps_.fill(0, n);
+  currentStamp_ = 0;
+
+  cells_.clear();
+  for (int i = 0; i < n; ++i)
+    insertEdge(i);
+  nCrossings_ = 0;
+  for (int i = 0; i < n; ++i)
+    nCrossings_ += countCrossings(i, -1);
+  nCrossings_ /= 2;  // each pair has been counted twice
+}
+
+// All cells the segment passes through (and maybe a few neighbouring ones)
+QVector<EdgeIndex::CellKey> EdgeIndex::cellsAlong(QPointF a, QPointF b) const
+{
+  QVector<CellKey> result;
+  double margin = cellMargin * cellSize_;
+  if (a.x() > b.x())
+    qSwap(a, b);
+  int cx0 = cellCoordinate(a.x() - margin, cellSize_);
+  int cx1 = cellCoordinate(b.x() + margin, cellSize_);
+  for (int cx = cx0; cx <= cx1; ++cx) {
+    double y0 = a.y();
+    double y1 = b.y();
+    if (a.x() != b.x()) {
+      double slope = (b.y() - a.y()) / (b.x() - a.x());
+      double columnLeft  = qMax(a.x(), cx * cellSize_);
+      double columnRight = qMin(b.x(), (cx + 1) * cellSize_);
+      y0 = a.y() + slope * (columnLeft  - a.x());
+      y1 = a.y() + slope * (columnRight - a.x());
+    }
+    int cy0 = cellCoordinate(qMin(y0, y1) - margin, cellSize_);
+    int cy1 = cellCoordinate(qMax(y0, y1) + margin, cellSize_);
+    for (int cy = cy0; cy <= cy1; ++cy)
+      result.append(makeCellKey(cx, cy));
+  }
+  return result;
+}
+
+void EdgeIndex::insertEdge(int iEdge)
+{
+  foreach (CellKey key, cellsAlong(edgeStart(iEdge), edgeEnd(iEdge)))
+    cells_[key].append(iEdge);
+}
+
+void EdgeIndex::removeEdge(int iEdge)
+{
+  foreach (CellKey key, cellsAlong(edgeStart(iEdge), edgeEnd(iEdge))) {
+    QHash<CellKey, QVector<int> >::iterator cell = cells_.find(key);
+    ASSERT_RETURN(cell != cells_.end());
+    QVector<int>& edges = cell.value();
+    int position = edges.indexOf(iEdge);
+    ASSERT_RETURN(position >= 0);
+    edges[position] = edges.last();
+    edges.pop_back();
+    if (edges.isEmpty())
+      cells_.erase(cell);
+  }
+}
+
+int EdgeIndex::countCrossings(int iEdge, int skippedEdge) const
+{
+  return countCrossings(edgeStart(iEdge), edgeEnd(iEdge), iEdge, nEdges(), skippedEdge);
+}
+
+// Counts the indexed edges crossing segment ab, which is treated as edge number iEdge of a polygon with nEdgesTotal edges
+int EdgeIndex::countCrossings(QPointF a, QPointF b, int iEdge, int nEdgesTotal, int skippedEdge) const
+{
+  int result = 0;
+  currentStamp_++;
+  foreach (CellKey key, cellsAlong(a, b)) {
+    QHash<CellKey, QVector<int> >::const_iterator cell = cells_.find(key);
+    if (cell == cells_.end())
+      continue;
+    foreach (int iOtherEdge, cell.value()) {
+      if (iOtherEdge == skippedEdge || visitStamps_[iOtherEdge] == currentStamp_)
+        continue;
+      visitStamps_[iOtherEdge] = currentStamp_;
+      if (areAdjacentEdges(iEdge, iOtherEdge, nEdgesTotal))
+        continue;
+      // Always test in the same order, so that the pair gives the same answer whichever edge is being updated
+      bool cross = (iEdge < iOtherEdge)
+          ? testSegmentsCross(a, b, edgeStart(iOtherEdge), edgeEnd(iOtherEdge))
+          : testSegmentsCross(edgeStart(iOtherEdge), edgeEnd(iOtherEdge), a, b);
+      if (cross)
+        result++;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,46 @@
+#ifndef EDGE_INDEX_H
+#define EDGE_INDEX_H
+
+#include <QHash>
+#include <QPolygonF>
+#include <QVector>
+
+// Uniform grid over the edges of a closed polygon that keeps the number of crossing edge pairs up to date.
+// Moving or appending a vertex only re-tests the edges next to it against the edges from the cells they pass through.
+// Edges follow the same rules as in isSelfintersectingPolygon: adjacent edges may touch at their common vertex.
+
+class EdgeIndex
+{
+public:
+  explicit EdgeIndex(const QPolygonF& vertices);  // vertices must not be closed
+
+  int nCrossings() const  { return nCrossings_; }
+  int nCrossingsWithAppendedVertex(QPointF newVertex) const;
+
+  void moveVertex(int iVertex, QPointF newPos);
+  void appendVertex(QPointF newVertex);
+
+private:
+  typedef quint64 CellKey;
+
+  QPolygonF vertices_;
+  double cellSize_;
+  QHash<CellKey, QVector<int> > cells_;
+  int nVerticesAtRebuild_;
+  int nCrossings_;
+  mutable QVector<int> visitStamps_;
+  mutable int currentStamp_;
+
+  int nEdges() const                  { return vertices_.size(); }
+  QPointF edgeStart(int iEdge) const  { return vertices_[iEdge]; }
+  QPointF edgeEnd(int iEdge) const    { return vertices_[(iEdge + 1) % nEdges()]; }
+
+  void rebuild();
+  QVector<CellKey> cellsAlong(QPointF a, QPointF b) const;
+  void insertEdge(int iEdge);
+  void removeEdge(int iEdge);
+  int countCrossings(int iEdge, int skippedEdge) const;
+  int countCrossings(QPointF a, QPointF b, int iEdge, int nEdgesTotal, int skippedEdge) const;
+};
+
+#endif // EDGE_INDEX_H
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include "defines.h"
+#include "edge_snapping.h"
+
+
+const int minEdgeMagnitude = 96;  // a brightness step of about 24 levels; weaker gradients are mostly noise and texture
+
+// Path cost per pixel of length, see traceEdge
+const double straightnessCost = 0.05;
+const double weakEdgeCost     = 1.;
+const double crossingEdgeCost = 0.3;
+
+// Neighbours in the order of increasing angle; y goes down, like in the image
+const int nNeighbours = 8;
+const int neighbourDx[nNeighbours]    = { 1, 1, 0, -1, -1, -1,  0,  1 };
+const int neighbourDy[nNeighbours]    = { 0, 1, 1,  1,  0, -1, -1, -1 };
+const int neighbourAngle[nNeighbours] = { 0, 32, 64, 96, 128, 160, 192, 224 };  // a full turn is 256, as for gradients
+
+
+bool findStrongestEdge(const GradientField& field, QPoint center, int radius, QPoint& result)
+{
+  QRect searchRect = QRect(center - QPoint(radius, radius), center + QPoint(radius, radius)).intersected(field.rect);
+  int bestMagnitude = minEdgeMagnitude - 1;
+  int bestSquaredDistance = 0;
+  for (int y = searchRect.top(); y <= searchRect.bottom(); ++y) {
+    const quint16* row = field.magnitude.constData() + field.index(QPoint(searchRect.left(), y));
+    for (int x = searchRect.left(); x <= searchRect.right(); ++x) {
+      int magnitude = row[x - searchRect.left()];
+      if (magnitude < bestMagnitude)
+        continue;
+      int squaredDistance = sqr(x - center.x()) + sqr(y - center.y());
+      if (squaredDistance > sqr(radius))
+        continue;
+      if (magnitude > bestMagnitude || squaredDistance < bestSquaredDistance) {
+        bestMagnitude = magnitude;
+        bestSquaredDistance = squaredDistance;
+        result = QPoint(x, y);
+      }
+    }
+  }
+  return bestMagnitude >= minEdgeMagnitude;
+}
+
+// Dijkstra's algorithm over the pixels of the field
+QPolygon traceEdge(const GradientField& field, QPoint from, QPoint to)
+{
+  QPolygon result;
+  if (!field.contains(from) || !field.contains(to))
+    return result;
+
+  int width = field.rect.width();
+  int nPixels = field.magnitude.size();
+  int maxMagnitude = minEdgeMagnitude;
+  for (int i = 0; i < nPixels; ++i)
+    maxMagnitude = qMax(maxMagnitude, int(field.magnitude[i]));
+  // Edges are across their gradient, so a step is the cheapest when it's perpendicular to the gradient
+  double crossingFactor[256];
+  for (int angle = 0; angle < 256; ++angle)
+    crossingFactor[angle] = std::fabs(std::cos(angle * (M_PI / 128.)));
+
+  typedef std::pair<double, int> QueueItem;  // cost so far, pixel
+  std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > queue;
+  std::vector<double> cost(nPixels, std::numeric_limits<double>::infinity());
+  std::vector<int> previous(nPixels, -1);
+  int iFrom = field.index(from);
+  int iTo = field.index(to);
+  cost[iFrom] = 0.;
+  queue.push(QueueItem(0., iFrom));
+  while (!queue.empty()) {
+    QueueItem item = queue.top();
+    queue.pop();
+    int iPixel = item.second;
+    if (item.first > cost[iPixel])
+      continue;  // an outdated entry
+    if (iPixel == iTo)
+      break;
+    int x = iPixel % width;
+    int y = iPixel / width;
+    for (int k = 0; k < nNeighbours; ++k) {
+      int nx = x + neighbourDx[k];
+      int ny = y + neighbourDy[k];
+      if (nx < 0 || nx >= width || ny < 0 || ny >= field.rect.height())
+        continue;
+      int iNeighbour = ny * width + nx;
+      double strength = double(field.magnitude[iNeighbour]) / maxMagnitude;
+      int crossingAngle = (neighbourAngle[k] - field.direction[iNeighbour]) & 0xff;
+      double stepLength = (k % 2 == 0) ? 1. : M_SQRT2;
+      double newCost = cost[iPixel] + stepLength * (  straightnessCost + weakEdgeCost * (1. - strength)
+                                                    + crossingEdgeCost * strength * crossingFactor[crossingAngle]);
+      if (newCost < cost[iNeighbour]) {
+        cost[iNeighbour] = newCost;
+        previous[iNeighbour] = iPixel;
+        queue.push(QueueItem(newCost, iNeighbour));
+      }
+    }
+  }
+
+  for (int iPixel = iTo; iPixel != -1; iPixel = previous[iPixel])
+    result.append(field.rect.topLeft() + QPoint(iPixel % width, iPixel / width));
+  std::reverse(result.begin(), result.end());
+  return result;
+}
@@ -0,0 +1,20 @@
+#ifndef EDGE_SNAPPING_H
+#define EDGE_SNAPPING_H
+
+#include <QPoint>
+#include <QPolygon>
+
+#include "gradient_pyramid.h"
+
+// Looking for image edges in a gradient field: snapping vertices to them and the magnetic lasso, which follows
+// an edge between two vertices. Everything is in pixels of the field's level.
+
+// Pixel with the strongest edge within radius from center, the nearest one of equals.
+// Returns false if there is no distinct edge there
+bool findStrongestEdge(const GradientField& field, QPoint center, int radius, QPoint& result);
+
+// Cheapest 8-connected path from ``from'' to ``to'', both included. Steps onto strong edges and along them are cheap,
+// so the path follows edges and goes straight where there are none. Returns an empty path if an end is outside the field
+QPolygon traceEdge(const GradientField& field, QPoint from, QPoint to);
+
+#endif // EDGE_SNAPPING_H
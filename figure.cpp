@@ -1,11 +1,14 @@
+#include <algorithm>
 #include <cmath>
 
 #include <QPainter>
+#include <QPainterPath>
 
 #include "canvaswidget.h"
 #include "figure.h"
 #include "paint_utils.h"
 #include "selection.h"
+#include "simplification.h"
 
 
 const int sizeOutputPrecision = 4;
@@ -15,6 +18,10 @@ const QString squareUnitSuffix = linearUnitSuffix + QString::fromUtf8("²");
 
 const double selectionBallRadius = 3;
 
+// When zoomed out, figures are drawn and hit-tested simplified, with an error below this many screen pixels
+const double maxSimplificationError = 0.5;
+const int minVerticesToSimplify = 64;
+
 const QColor etalonDefaultPen_ = QColor(  0, 150,   0);
 const QColor defaultPen_       = QColor(  0,  50, 240);
 const QColor errorPen_         = QColor(255,   0,   0);
@@ -38,36 +45,99 @@ Figure::Figure(ShapeType shapeType, bool isEtalon, const CanvasWidget* canvas) :
   originalInscriptionPos_(),
   canvas_(canvas),
   size_(0.),
-  penColor_(isEtalon ? etalonDefaultPen_ : defaultPen_)
+  windingSize_(0.),
+  penColor_(isEtalon ? etalonDefaultPen_ : defaultPen_),
   //penColor_(QColor::fromHsv(rand() % 360, 255, 127))
+  cacheIsValid_(false),
+  cachedCorrectness_(VALID_SHAPE),
+  cachedMetersPerPixel_(-1.),
+  cachedScale_(-1.),
+  screenRectIsValid_(false)
 {
+  originalShape_.enableIncrementalChecks();
 }
 
+Figure::Figure(const Shape& originalShape, bool isEtalon, const CanvasWidget* canvas) :
+  originalShape_(originalShape),
+  isEtalon_(isEtalon),
+  originalInscriptionPos_(),
+  canvas_(canvas),
+  size_(0.),
+  windingSize_(0.),
+  penColor_(isEtalon ? etalonDefaultPen_ : defaultPen_),
+  cacheIsValid_(false),
+  cachedCorrectness_(VALID_SHAPE),
+  cachedMetersPerPixel_(-1.),
+  cachedScale_(-1.),
+  screenRectIsValid_(false)
+{
+  originalShape_.enableIncrementalChecks();
+}
+
+
+void Figure::swap(Figure& other)
+{
+  originalShape_.swap(other.originalShape_);
+  std::swap(isEtalon_, other.isEtalon_);
+  std::swap(originalInscriptionPos_, other.originalInscriptionPos_);
+  std::swap(canvas_, other.canvas_);
+  std::swap(size_, other.size_);
+  std::swap(windingSize_, other.windingSize_);
+  std::swap(penColor_, other.penColor_);
+  std::swap(cacheIsValid_, other.cacheIsValid_);
+  std::swap(cachedPreviewPoint_, other.cachedPreviewPoint_);
+  std::swap(cachedLassoPath_, other.cachedLassoPath_);
+  std::swap(cachedPolygon_, other.cachedPolygon_);
+  std::swap(cachedVertices_, other.cachedVertices_);
+  std::swap(cachedRings_, other.cachedRings_);
+  std::swap(cachedCorrectness_, other.cachedCorrectness_);
+  std::swap(cachedInscriptionPivot_, other.cachedInscriptionPivot_);
+  std::swap(cachedMetersPerPixel_, other.cachedMetersPerPixel_);
+  std::swap(cachedSizeString_, other.cachedSizeString_);
+  std::swap(cachedWindingSizeString_, other.cachedWindingSizeString_);
+  std::swap(cachedInscription_, other.cachedInscription_);
+  std::swap(cachedScale_, other.cachedScale_);
+  std::swap(cachedScaledPolygon_, other.cachedScaledPolygon_);
+  std::swap(cachedScaledVertices_, other.cachedScaledVertices_);
+  std::swap(cachedScaledVertexIndices_, other.cachedScaledVertexIndices_);
+  std::swap(cachedLevelsOfDetail_, other.cachedLevelsOfDetail_);
+  std::swap(cachedSnappedPolygon_, other.cachedSnappedPolygon_);
+  std::swap(cachedScaledRings_, other.cachedScaledRings_);
+  std::swap(cachedSnappedRings_, other.cachedSnappedRings_);
+  std::swap(screenRectIsValid_, other.screenRectIsValid_);
+  std::swap(cachedScreenRect_, other.cachedScreenRect_);
+}
 
 bool Figure::addPoint(QPointF originalNewPoint)
 {
+  invalidateCache();
   return originalShape_.addPoint(originalNewPoint);
 }
 
 void Figure::finish()
 {
+  invalidateCache();
   originalShape_.finish();
 }
 
 
-void Figure::testSelection(SelectionFinder& selectionFinder)
+void Figure::testSelection(SelectionFinder& selectionFinder, FigureHandle handle)
 {
-  Shape activeShape = getActiveOriginalShape();
-  activeShape.scale(canvas_->scale_);
+  updateScaledCache();
 
-  switch (originalShape_.dimensionality()) {
-    case SHAPE_1D: selectionFinder.testPolyline(activeShape.polygon(), this); break;
-    case SHAPE_2D: selectionFinder.testPolygon (activeShape.polygon(), this); break;
+  if (shapeType() == REGION) {
+    selectionFinder.testRegion(cachedScaledRings_, handle);
+  }
+  else {
+    switch (originalShape_.dimensionality()) {
+      case SHAPE_1D: selectionFinder.testPolyline(cachedScaledPolygon_, handle); break;
+      case SHAPE_2D: selectionFinder.testPolygon (cachedScaledPolygon_, handle); break;
+    }
   }
 
-  QPolygonF vertices = activeShape.vertices();
-  for (int i = 0; i < vertices.size(); ++i)
-    selectionFinder.testVertex(vertices[i], this, i);
+  for (int i = 0; i < cachedScaledVertices_.size(); ++i)
+    selectionFinder.testVertex(cachedScaledVertices_[i], handle,
+                               cachedScaledVertexIndices_.isEmpty() ? i : cachedScaledVertexIndices_[i]);
 
 //  selectionFinder.testInscription();  // TODO
 }
@@ -78,6 +148,7 @@ void Figure::dragTo(const Selection& selection, QPointF newPos)
     case Selection::FIGURE:
       break;
     case Selection::VERTEX:
+      invalidateCache();
       originalShape_.dragVertex(selection.iVertex, newPos);
       break;
     case Selection::INSCRIPTION:
@@ -88,45 +159,262 @@ void Figure::dragTo(const Selection& selection, QPointF newPos)
 
 void Figure::draw(QPainter& painter) const
 {
+  updateScaledCache();
+  drawScaled(painter, cachedSnappedPolygon_, cachedSnappedRings_, cachedScaledVertexIndices_, canvas_->scale_,
+             isSelected(), isHovered());
+}
+
+// Draws the figure in original image coordinates, as it's saved to a file
+void Figure::drawOriginal(QPainter& painter) const
+{
+  updateCache();
+  QPolygonF snappedPolygon = cachedPolygon_;
+  snapPolygonToPixelGrid(snappedPolygon);
+  QList<QPolygonF> snappedRings = cachedRings_;
+  for (int i = 0; i < snappedRings.size(); ++i)
+    snapPolygonToPixelGrid(snappedRings[i]);
+  drawScaled(painter, snappedPolygon, snappedRings, QVector<int>(), 1., false, false);
+}
+
+QRectF Figure::originalBoundingRect() const
+{
+  updateCache();
+  return cachedPolygon_.boundingRect();
+}
+
+QRect Figure::screenBoundingRect() const
+{
+  updateScaledCache();
+  updateTextCache();
+  if (screenRectIsValid_)
+    return cachedScreenRect_;
+  cachedScreenRect_ = paintedRect(cachedSnappedPolygon_, canvas_->scale_);
+  screenRectIsValid_ = true;
+  return cachedScreenRect_;
+}
+
+void Figure::fontChanged()
+{
+  screenRectIsValid_ = false;
+}
+
+QRect Figure::originalPaintedRect() const
+{
+  updateTextCache();
+  QPolygonF snappedPolygon = cachedPolygon_;
+  snapPolygonToPixelGrid(snappedPolygon);
+  return paintedRect(snappedPolygon, 1.);
+}
+
+QString Figure::statusString() const
+{
+  ShapeCorrectness correctness;
+  QString sizeString = getSizeString(correctness);
+
+  switch (correctness) {
+    case VALID_SHAPE: {
+      if (sizeString.isEmpty())
+        return QString();
+      QString etalonString = isEtalon_ ? QString::fromUtf8(" эталона") : QString();
+      switch (originalShape_.dimensionality()) {
+        case SHAPE_1D: return QString::fromUtf8("Длина%1: %2"  ).arg(etalonString).arg(sizeString);
+        case SHAPE_2D: return QString::fromUtf8("Площадь%1: %2").arg(etalonString).arg(sizeString);
+      }
+      break;
+    }
+    case SELF_INTERSECTING_POLYGON: {
+      if (sizeString.isEmpty())
+        return QString::fromUtf8("Многоугольник самопересекается");
+      return QString::fromUtf8("Многоугольник самопересекается. Площадь: %1, с учётом кратности обхода: %2")
+          .arg(sizeString).arg(cachedWindingSizeString_);
+    }
+  }
+  ERROR_RETURN_V(QString());
+}
+
+
+void Figure::invalidateCache()
+{
+  cacheIsValid_ = false;
+}
+
+void Figure::updateCache() const
+{
+  QPointF previewPoint = canvas_->originalPointUnderMouse_;
+  if (cacheIsValid_ && (isFinished() || (previewPoint == cachedPreviewPoint_ && canvas_->lassoPath_ == cachedLassoPath_)))
+    return;
+
+  canvas_->perfStats_.count(PerfStats::GEOMETRY_RECOMPUTED);
   Shape activeShape = getActiveOriginalShape();
-  activeShape.scale(canvas_->scale_);
-  QPolygonF activePolygon = activeShape.polygon();
+  cachedPreviewPoint_ = previewPoint;
+  cachedLassoPath_ = canvas_->lassoPath_;
+  cachedPolygon_ = activeShape.polygon();
+  // A region is drawn ring by ring and has no vertices to drag
+  cachedRings_ = activeShape.type() == REGION ? activeShape.regionRings() : QList<QPolygonF>();
+  cachedVertices_ = activeShape.type() == REGION ? QPolygonF() : activeShape.vertices();
+  cachedLevelsOfDetail_.clear();
+  cachedCorrectness_ = getActiveCorrectness();
+  switch (activeShape.dimensionality()) {
+    case SHAPE_1D: size_ = activeShape.length(); windingSize_ = size_;                     break;
+    case SHAPE_2D: size_ = activeShape.area();   windingSize_ = activeShape.windingArea(); break;
+  }
+
+  QPointF pivot = cachedPolygon_.first();
+  foreach (QPointF v, cachedPolygon_)
+    if (    v.y() <  pivot.y()
+        || (v.y() == pivot.y() && v.x() < pivot.x()))
+      pivot = v;
+  cachedInscriptionPivot_ = pivot;
+
+  cachedMetersPerPixel_ = -1.;
+  cachedScale_ = -1.;
+  cacheIsValid_ = true;
+}
 
+void Figure::updateTextCache() const
+{
+  updateCache();
+  if (cachedMetersPerPixel_ == canvas_->originalMetersPerPixel_)
+    return;
+  cachedMetersPerPixel_ = canvas_->originalMetersPerPixel_;
+  screenRectIsValid_ = false;
+  cachedSizeString_.clear();
+  cachedWindingSizeString_.clear();
+  cachedInscription_.clear();
+  if (!canvas_->hasEtalon())
+    return;
+  switch (originalShape_.dimensionality()) {
+    case SHAPE_1D: {
+      double length = size_ * canvas_->originalMetersPerPixel_;
+      cachedSizeString_ = QString("%1 %2").arg(length, 0, 'g', sizeOutputPrecision).arg(linearUnitSuffix);
+      break;
+    }
+    case SHAPE_2D: {
+      double area = size_ * sqr(canvas_->originalMetersPerPixel_);
+      cachedSizeString_ = QString("%1 %2").arg(area, 0, 'g', sizeOutputPrecision).arg(squareUnitSuffix);
+      if (cachedCorrectness_ == SELF_INTERSECTING_POLYGON) {
+        double windingArea = windingSize_ * sqr(canvas_->originalMetersPerPixel_);
+        cachedWindingSizeString_ = QString("%1 %2").arg(windingArea, 0, 'g', sizeOutputPrecision).arg(squareUnitSuffix);
+      }
+      break;
+    }
+  }
+  cachedInscription_ = cachedSizeString_ + (isEtalon_ ? QString::fromUtf8(" [эталон]") : QString());
+}
+
+void Figure::updateScaledCache() const
+{
+  updateCache();
+  double scale = canvas_->scale_;
+  if (cachedScale_ == scale)
+    return;
+  cachedScale_ = scale;
+  screenRectIsValid_ = false;
+  canvas_->perfStats_.count(PerfStats::SCALED_GEOMETRY_RECOMPUTED);
+  const QVector<int>& iKeptVertices = levelOfDetail(scale);
+  if (iKeptVertices.isEmpty()) {
+    cachedScaledPolygon_ = cachedPolygon_;
+    for (int i = 0; i < cachedScaledPolygon_.size(); ++i)
+      cachedScaledPolygon_[i] *= scale;
+    cachedScaledVertices_ = cachedVertices_;
+    for (int i = 0; i < cachedScaledVertices_.size(); ++i)
+      cachedScaledVertices_[i] *= scale;
+    cachedScaledVertexIndices_.clear();
+  }
+  else {
+    cachedScaledPolygon_.resize(iKeptVertices.size());
+    for (int i = 0; i < iKeptVertices.size(); ++i)
+      cachedScaledPolygon_[i] = cachedPolygon_[iKeptVertices[i]] * scale;
+    // The closing vertex of a closed polygon is the first one again
+    int nKeptVertices = iKeptVertices.back() < cachedVertices_.size() ? iKeptVertices.size() : iKeptVertices.size() - 1;
+    cachedScaledVertices_ = cachedScaledPolygon_.mid(0, nKeptVertices);
+    cachedScaledVertexIndices_ = iKeptVertices.mid(0, nKeptVertices);
+  }
+  cachedSnappedPolygon_ = cachedScaledPolygon_;
+  snapPolygonToPixelGrid(cachedSnappedPolygon_);
+
+  // Rings of a region are simplified one by one, they are not a single polyline
+  cachedScaledRings_.clear();
+  cachedSnappedRings_.clear();
+  foreach (const QPolygonF& ring, cachedRings_) {
+    QPolygonF scaledRing;
+    if (scale < 1. && ring.size() >= minVerticesToSimplify) {
+      foreach (int iVertex, simplifyPolyline(ring, maxSimplificationError / scale))
+        scaledRing.append(ring[iVertex] * scale);
+    }
+    else {
+      scaledRing = ring;
+      for (int i = 0; i < scaledRing.size(); ++i)
+        scaledRing[i] *= scale;
+    }
+    cachedScaledRings_.append(scaledRing);
+    snapPolygonToPixelGrid(scaledRing);
+    cachedSnappedRings_.append(scaledRing);
+  }
+}
+
+// Vertices to draw and hit-test when zoomed out, empty if all of them are needed.
+// A zoom band is scales in [2^(k-1), 2^k); the whole band shares one simplification, which is precise enough for scale 2^k.
+const QVector<int>& Figure::levelOfDetail(double scale) const
+{
+  static const QVector<int> allVertices;
+  // Joins between the rings of a region must stay in place, so it's simplified ring by ring in updateScaledCache
+  if (scale >= 1. || cachedPolygon_.size() < minVerticesToSimplify || shapeType() == REGION)
+    return allVertices;
+  int zoomBand;
+  std::frexp(scale, &zoomBand);
+  QMap<int, QVector<int> >::iterator it = cachedLevelsOfDetail_.find(zoomBand);
+  if (it == cachedLevelsOfDetail_.end()) {
+    QVector<int> iKeptVertices = simplifyPolyline(cachedPolygon_, std::ldexp(maxSimplificationError, -zoomBand));
+    if (iKeptVertices.size() == cachedPolygon_.size())
+      iKeptVertices.clear();  // nothing to gain
+    it = cachedLevelsOfDetail_.insert(zoomBand, iKeptVertices);
+  }
+  return *it;
+}
+
+
+// Vertex indices tell which vertex of the shape each point of the active polygon is; empty if they go one by one.
+// A region is drawn by its rings instead of the polygon, so that the joins between them are not seen.
+void Figure::drawScaled(QPainter& painter, const QPolygonF& activePolygon, const QList<QPolygonF>& activeRings,
+                        const QVector<int>& vertexIndices, double scale, bool isSelected, bool isHovered) const
+{
   TextDrawer inscriptionTextDrawer;
   QString inscription = getInscription();
-  if (!inscription.isEmpty()) {
-    QPointF pivot = activePolygon.first();
-    foreach (QPointF v, activePolygon)
-      if (    v.y() <  pivot.y()
-          || (v.y() == pivot.y() && v.x() < pivot.x()))
-        pivot = v;
-    QPoint inscriptionPos = pivot.toPoint() + QPoint(painter.fontMetrics().averageCharWidth() / 2, painter.fontMetrics().height());
-    inscriptionTextDrawer = drawTextWithBackground(painter, inscription, inscriptionPos);
-  }
+  if (!inscription.isEmpty())
+    inscriptionTextDrawer = drawTextWithBackground(painter, inscription, inscriptionPos(painter.fontMetrics(), scale));
 
-  if (activeShape.correctness() != VALID_SHAPE) {
+  if (cachedCorrectness_ != VALID_SHAPE) {
     setColor(painter, errorPen_);
   }
   else {
-    if (isHovered())
+    if (isHovered)
       setColor(painter, penColor_.lighter(130));
     else
       setColor(painter, penColor_);
   }
 
-  snapPolygonToPixelGrid(activePolygon);
-  switch (originalShape_.dimensionality()) {
-    case SHAPE_1D: painter.drawPolyline(activePolygon); break;
-    case SHAPE_2D: painter.drawPolygon (activePolygon); break;
+  if (shapeType() == REGION) {
+    QPainterPath path;  // odd-even fill leaves the holes empty
+    foreach (const QPolygonF& ring, activeRings)
+      path.addPolygon(ring);
+    painter.drawPath(path);
+  }
+  else {
+    switch (originalShape_.dimensionality()) {
+      case SHAPE_1D: painter.drawPolyline(activePolygon); break;
+      case SHAPE_2D: painter.drawPolygon (activePolygon); break;
+    }
   }
 
-  if (activePolygon.isClosed())
-    activePolygon.pop_back();
-  if (isSelected() || isHovered()) {
+  int nBalls = activePolygon.isClosed() ? activePolygon.size() - 1 : activePolygon.size();
+  if (shapeType() == REGION)
+    nBalls = 0;
+  if (isSelected || isHovered) {
     QColor brushColor(255, 255, 255);
     QColor hoveredBrushColor(255, 255, 80);
     QColor penColor(0, 0, 0);
-    if (!isSelected()) {
+    if (!isSelected) {
       brushColor.setAlpha(100);
       hoveredBrushColor.setAlpha(100);
       penColor.setAlpha(100);
@@ -134,45 +422,55 @@ void Figure::draw(QPainter& painter) const
     painter.setBrush(brushColor);
     painter.setPen(penColor);
 
-    for (int i = 0; i < activePolygon.size(); ++i) {
-      painter.setBrush(i == hoveredVertex() ? hoveredBrushColor : brushColor);
+    for (int i = 0; i < nBalls; ++i) {
+      int iVertex = vertexIndices.isEmpty() ? i : vertexIndices[i];
+      painter.setBrush(isHovered && iVertex == hoveredVertex() ? hoveredBrushColor : brushColor);
       painter.drawEllipse(activePolygon[i], selectionBallRadius, selectionBallRadius);
     }
   }
 }
 
-QString Figure::statusString() const
+// Everything drawScaled can paint, including inscription and selection balls
+QRect Figure::paintedRect(const QPolygonF& snappedPolygon, double scale) const
 {
-  ShapeCorrectness correctness;
-  QString sizeString = getSizeString(correctness);
-
-  switch (correctness) {
-    case VALID_SHAPE: {
-      if (sizeString.isEmpty())
-        return QString();
-      QString etalonString = isEtalon_ ? QString::fromUtf8(" эталона") : QString();
-      switch (originalShape_.dimensionality()) {
-        case SHAPE_1D: return QString::fromUtf8("Длина%1: %2"  ).arg(etalonString).arg(sizeString);
-        case SHAPE_2D: return QString::fromUtf8("Площадь%1: %2").arg(etalonString).arg(sizeString);
-      }
-      break;
-    }
-    case SELF_INTERSECTING_POLYGON: {
-      return QString::fromUtf8("Многоугольник не должен самопересекаться!");
-    }
+  // Antialiased outline and selection balls stick out of the polygon a bit
+  int margin = int(std::ceil(selectionBallRadius)) + 2;
+  QRect result = snappedPolygon.boundingRect().toAlignedRect().adjusted(-margin, -margin, margin, margin);
+  if (!cachedInscription_.isEmpty()) {
+    QFontMetrics fontMetrics = canvas_->fontMetrics();
+    QRect textRect = fontMetrics.boundingRect(cachedInscription_).translated(inscriptionPos(fontMetrics, scale));
+    result |= textRect.adjusted(-2, -2, 3, 3);  // background and halo, see drawTextWithBackground
   }
-  ERROR_RETURN_V(QString());
+  return result;
 }
 
-
 Shape Figure::getActiveOriginalShape() const
 {
   Shape activeOriginalShape = originalShape_;
-  if (!activeOriginalShape.isFinished())
+  if (!activeOriginalShape.isFinished()) {
+    foreach (QPointF lassoPoint, canvas_->lassoPath_)
+      activeOriginalShape.addPoint(lassoPoint);
     activeOriginalShape.addPoint(canvas_->originalPointUnderMouse_);
+  }
   return activeOriginalShape;
 }
 
+// Same as getActiveOriginalShape().correctness(), but doesn't lose the edge index of the original shape
+ShapeCorrectness Figure::getActiveCorrectness() const
+{
+  if (originalShape_.isFinished())
+    return originalShape_.correctness();
+  if (!canvas_->lassoPath_.isEmpty())
+    return getActiveOriginalShape().correctness();  // lasso adds several points at once
+  return originalShape_.correctnessWithAddedPoint(canvas_->originalPointUnderMouse_);
+}
+
+QPoint Figure::inscriptionPos(const QFontMetrics& fontMetrics, double scale) const
+{
+  QPointF pivot = cachedInscriptionPivot_ * scale;
+  return pivot.toPoint() + QPoint(fontMetrics.averageCharWidth() / 2, fontMetrics.height());
+}
+
 // QPainter with antialiasing gives clearer results for horisontal and vertical lines after this function
 void Figure::snapPolygonToPixelGrid(QPolygonF& polygon) const
 {
@@ -182,47 +480,25 @@ void Figure::snapPolygonToPixelGrid(QPolygonF& polygon) const
 
 QString Figure::getSizeString(ShapeCorrectness& correctness) const
 {
-  Shape activeShape = getActiveOriginalShape();
-  correctness = activeShape.correctness();
-  if (!canvas_->hasEtalon())
-    return QString();
-  switch (correctness) {
-    case VALID_SHAPE:
-      switch (activeShape.dimensionality()) {
-        case SHAPE_1D: {
-          double length = activeShape.length() * canvas_->originalMetersPerPixel_;
-          return QString("%1 %2").arg(length, 0, 'g', sizeOutputPrecision).arg(linearUnitSuffix);
-        }
-        case SHAPE_2D: {
-          double area = activeShape.area() * sqr(canvas_->originalMetersPerPixel_);
-          return QString("%1 %2").arg(area, 0, 'g', sizeOutputPrecision).arg(squareUnitSuffix);
-        }
-      }
-      break;
-    case SELF_INTERSECTING_POLYGON:
-      break;
-  }
-  return QString();
+  updateTextCache();
+  correctness = cachedCorrectness_;
+  return cachedSizeString_;
 }
 
 QString Figure::getInscription() const
 {
-  ShapeCorrectness correctness;
-  QString sizeString = getSizeString(correctness);
-  if (correctness == VALID_SHAPE && !sizeString.isEmpty())
-    return sizeString + (isEtalon_ ? QString::fromUtf8(" [эталон]") : QString());
-  else
-    return QString();
+  updateTextCache();
+  return cachedInscription_;
 }
 
 bool Figure::isSelected() const
 {
-  return canvas_->selection_.figure == this;
+  return canvas_->figures_.get(canvas_->selection_.figure) == this;
 }
 
 bool Figure::isHovered() const
 {
-  return canvas_->hover_.figure == this;
+  return canvas_->figures_.get(canvas_->hover_.figure) == this;
 }
 
 int Figure::hoveredVertex() const
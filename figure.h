@@ -2,11 +2,16 @@
 #define FIGURE_H
 
 #include <QColor>
+#include <QList>
+#include <QMap>
 #include <QPolygonF>
+#include <QVector>
 
 #include "defines.h"
 #include "shape.h"
+#include "slot_map.h"
 
+class QFontMetrics;
 class QPainter;
 class CanvasWidget;
 class Selection;
@@ -15,10 +20,15 @@ class SelectionFinder;
 extern const QString linearUnitSuffix;
 extern const QString squareUnitSuffix;
 
+typedef SlotHandle FigureHandle;  // figures are stored in SlotMap<Figure>
+
 class Figure
 {
 public:
   Figure(ShapeType shapeType, bool isEtalon, const CanvasWidget* canvas);
+  Figure(const Shape& originalShape, bool isEtalon, const CanvasWidget* canvas);  // for a restored finished shape
+
+  void swap(Figure& other);  // cheaper than copying, see Shape::swap
 
   bool isEtalon() const             { return isEtalon_; }
   bool isFinished() const           { return originalShape_.isFinished(); }
@@ -28,21 +38,64 @@ public:
   bool addPoint(QPointF originalNewPoint);
   void finish();
 
-  void testSelection(SelectionFinder& selectionFinder);  // for a closed polygon return first (not last) vertex
+  void testSelection(SelectionFinder& selectionFinder, FigureHandle handle);  // for a closed polygon return first (not last) vertex
   void dragTo(const Selection& selection, QPointF newPos);
   void draw(QPainter& painter) const;
+  void drawOriginal(QPainter& painter) const;  // at scale 1, without selection and hover
+  QRectF originalBoundingRect() const;  // of the active shape
+  QRect screenBoundingRect() const;     // everything draw() can paint, including inscription and selection balls
+  QRect originalPaintedRect() const;    // everything drawOriginal() can paint
   QString statusString() const;
+  void fontChanged();  // inscriptions take a different space now
 
 private:
   Shape originalShape_;
   bool isEtalon_;
   QPointF originalInscriptionPos_;  // TODO: Use it
   const CanvasWidget* canvas_;
-  double size_;   // length or area  // TODO: Use it or delete it
+  mutable double size_;         // length or area of the active shape
+  mutable double windingSize_;  // area counted by winding number; differs from size_ only for a self-intersecting polygon
   QColor penColor_;
 
+  // Everything needed to draw the figure. Geometry is recomputed only when the figure changes
+  // (for an unfinished figure the cursor position and the lasso path are a part of the shape), texts - when etalon changes,
+  // screen coordinates - when scale changes.
+  mutable bool             cacheIsValid_;
+  mutable QPointF          cachedPreviewPoint_;
+  mutable QPolygonF        cachedLassoPath_;
+  mutable QPolygonF        cachedPolygon_;
+  mutable QPolygonF        cachedVertices_;
+  mutable QList<QPolygonF> cachedRings_;  // only for a region
+  mutable ShapeCorrectness cachedCorrectness_;
+  mutable QPointF          cachedInscriptionPivot_;
+  mutable double           cachedMetersPerPixel_;
+  mutable QString          cachedSizeString_;
+  mutable QString          cachedWindingSizeString_;  // only for a self-intersecting polygon
+  mutable QString          cachedInscription_;
+  mutable double           cachedScale_;
+  mutable QPolygonF        cachedScaledPolygon_;
+  mutable QPolygonF        cachedScaledVertices_;
+  mutable QVector<int>     cachedScaledVertexIndices_;  // of every scaled vertex in the shape; empty if there are all of them
+  mutable QMap<int, QVector<int> > cachedLevelsOfDetail_;  // see levelOfDetail
+  mutable QPolygonF        cachedSnappedPolygon_;
+  mutable QList<QPolygonF> cachedScaledRings_;
+  mutable QList<QPolygonF> cachedSnappedRings_;
+  mutable bool             screenRectIsValid_;
+  mutable QRect            cachedScreenRect_;
+
+  void invalidateCache();
+  void updateCache() const;
+  void updateTextCache() const;
+  void updateScaledCache() const;
+  const QVector<int>& levelOfDetail(double scale) const;
+
   Shape getActiveOriginalShape() const;
+  ShapeCorrectness getActiveCorrectness() const;
   void snapPolygonToPixelGrid(QPolygonF& polygon) const;
+  void drawScaled(QPainter& painter, const QPolygonF& activePolygon, const QList<QPolygonF>& activeRings,
+                  const QVector<int>& vertexIndices, double scale, bool isSelected, bool isHovered) const;
+  QRect paintedRect(const QPolygonF& snappedPolygon, double scale) const;
+  QPoint inscriptionPos(const QFontMetrics& fontMetrics, double scale) const;
   QString getSizeString(ShapeCorrectness& correctness) const;
   QString getInscription() const;
   bool isSelected() const;
@@ -50,4 +103,6 @@ private:
   int hoveredVertex() const;  // -1 if not hovered
 };
 
+inline void swap(Figure& a, Figure& b)  { a.swap(b); }
+
 #endif // FIGURE_H
@@ -0,0 +1,132 @@
+#include <cmath>
+
+#include <QMap>
+
+#include "debug_utils.h"
+#include "figure_index.h"
+
+
+// A figure covering more cells is cheaper to test every time than to register in all of them
+const int maxCellsPerFigure = 64;
+
+static inline quint64 makeCellKey(int cx, int cy)
+{
+  return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+
+static inline int cellCoordinate(double x, double cellSize)
+{
+  return int(std::floor(x / cellSize));
+}
+
+
+FigureIndex::FigureIndex(double cellSize) :
+  cellSize_(cellSize),
+  nextOrder_(0),
+  entries_(),
+  cells_(),
+  oversizedFigures_()
+{
+  ASSERT_RETURN(cellSize_ > 0.);
+}
+
+
+void FigureIndex::clear()
+{
+  entries_.clear();
+  cells_.clear();
+  oversizedFigures_.clear();
+}
+
+void FigureIndex::setFigure(FigureHandle figure, const QRectF& boundingRect)
+{
+  ASSERT_RETURN(!figure.isNull());
+  QRect newCells = cellsCovering(boundingRect);
+  if (newCells.width() * newCells.height() > maxCellsPerFigure)
+    newCells = QRect();
+
+  QHash<FigureHandle, Entry>::iterator it = entries_.find(figure);
+  if (it == entries_.end()) {
+    Entry entry = { nextOrder_++, QRect() };
+    it = entries_.insert(figure, entry);
+    oversizedFigures_.append(figure);
+  }
+  else if (it->cells == newCells) {
+    return;
+  }
+
+  // Oversized figures have empty cell rect, so moving between the list and the grid is the same as moving between cells
+  Entry& entry = it.value();
+  if (entry.cells.isEmpty())
+    oversizedFigures_.remove(oversizedFigures_.indexOf(figure));
+  else
+    removeFromCells(figure, entry.cells);
+  entry.cells = newCells;
+  if (entry.cells.isEmpty())
+    oversizedFigures_.append(figure);
+  else
+    insertToCells(figure, entry.cells);
+}
+
+void FigureIndex::removeFigure(FigureHandle figure)
+{
+  QHash<FigureHandle, Entry>::iterator it = entries_.find(figure);
+  if (it == entries_.end())
+    return;
+  if (it->cells.isEmpty())
+    oversizedFigures_.remove(oversizedFigures_.indexOf(figure));
+  else
+    removeFromCells(figure, it->cells);
+  entries_.erase(it);
+}
+
+
+QList<FigureHandle> FigureIndex::figuresNear(const QRectF& rect) const
+{
+  QMap<int, FigureHandle> found;  // by order
+  foreach (FigureHandle figure, oversizedFigures_)
+    found[entries_[figure].order] = figure;
+  QRect cells = cellsCovering(rect);
+  for (int cy = cells.top(); cy <= cells.bottom(); ++cy) {
+    for (int cx = cells.left(); cx <= cells.right(); ++cx) {
+      QHash<CellKey, QVector<FigureHandle> >::const_iterator cell = cells_.find(makeCellKey(cx, cy));
+      if (cell == cells_.end())
+        continue;
+      foreach (FigureHandle figure, cell.value())
+        found[entries_[figure].order] = figure;
+    }
+  }
+  return found.values();
+}
+
+
+QRect FigureIndex::cellsCovering(const QRectF& rect) const
+{
+  QRectF normalizedRect = rect.normalized();
+  return QRect(QPoint(cellCoordinate(normalizedRect.left(),  cellSize_), cellCoordinate(normalizedRect.top(),    cellSize_)),
+               QPoint(cellCoordinate(normalizedRect.right(), cellSize_), cellCoordinate(normalizedRect.bottom(), cellSize_)));
+}
+
+void FigureIndex::insertToCells(FigureHandle figure, const QRect& cells)
+{
+  for (int cy = cells.top(); cy <= cells.bottom(); ++cy)
+    for (int cx = cells.left(); cx <= cells.right(); ++cx)
+      cells_[makeCellKey(cx, cy)].append(figure);
+}
+
+void FigureIndex::removeFromCells(FigureHandle figure, const QRect& cells)
+{
+  for (int cy = cells.top(); cy <= cells.bottom(); ++cy) {
+    for (int cx = cells.left(); cx <= cells.right(); ++cx) {
+      QHash<CellKey, QVector<FigureHandle> >::iterator cell = cells_.find(makeCellKey(cx, cy));
+      ASSERT_RETURN(cell != cells_.end());
+      QVector<FigureHandle>& figures = cell.value();
+      int position = figures.indexOf(figure);
+      ASSERT_RETURN(position >= 0);
+      figures[position] = figures.last();
+      figures.pop_back();
+      if (figures.isEmpty())
+        cells_.erase(cell);
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef FIGURE_INDEX_H
+#define FIGURE_INDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QVector>
+
+#include "figure.h"
+
+// Uniform grid over bounding rects of figures (in original coordinates) that finds the figures near a point
+// without looking at all the others. Figures spanning too many cells are kept in a separate list and are always returned.
+// Figures are returned in the order they were first added, so that ties are resolved the same way as in a linear scan.
+
+class FigureIndex
+{
+public:
+  explicit FigureIndex(double cellSize = 256.);
+
+  void clear();
+  void setFigure(FigureHandle figure, const QRectF& boundingRect);  // adds the figure or updates its rect
+  void removeFigure(FigureHandle figure);
+
+  QList<FigureHandle> figuresNear(const QRectF& rect) const;
+
+private:
+  typedef quint64 CellKey;
+
+  struct Entry
+  {
+    int order;
+    QRect cells;  // empty for oversized figures
+  };
+
+  double cellSize_;
+  int nextOrder_;
+  QHash<FigureHandle, Entry> entries_;
+  QHash<CellKey, QVector<FigureHandle> > cells_;
+  QVector<FigureHandle> oversizedFigures_;
+
+  QRect cellsCovering(const QRectF& rect) const;
+  void insertToCells(FigureHandle figure, const QRect& cells);
+  void removeFromCells(FigureHandle figure, const QRect& cells);
+};
+
+#endif // FIGURE_INDEX_H
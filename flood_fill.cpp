@@ -0,0 +1,334 @@
+#include <QHash>
+#include <QMutexLocker>
+#include <QtConcurrentRun>
+
+#include "color_range.h"
+#include "debug_utils.h"
+#include "flood_fill.h"
+
+
+const int cancellationCheckPeriod = 1024;  // spans
+const int maxCachedTiles = 256;            // enough for the rows around a span across a wide image
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pixel access
+
+namespace {
+
+// Rows of the original image, read tile by tile from the pyramid. Tiles are kept, so that a wide span and the rows
+// above and below it don't read the same tiles from the pyramid over and over.
+class TileRowReader
+{
+public:
+  explicit TileRowReader(const ImagePyramid* pyramid) :
+    pyramid_(pyramid),
+    lastTile_(0)
+  { }
+
+  // Pointer to pixel (x, y); the tile covers columns [tileLeft, tileRight] of the row
+  const QRgb* pixels(int x, int y, int& tileLeft, int& tileRight)
+  {
+    if (!lastTile_ || !lastTile_->rect.contains(x, y)) {
+      ImagePyramid::TileKey key = pyramid_->tilesInLevelRect(0, QRect(x, y, 1, 1)).first();
+      QHash<quint64, CachedTile>::iterator it = tiles_.find(key.toUInt64());
+      if (it == tiles_.end()) {
+        if (tiles_.size() >= maxCachedTiles)
+          tiles_.clear();
+        CachedTile tile;
+        tile.rect = pyramid_->levelTileRect(key);
+        tile.image = pyramid_->tile(key);
+        it = tiles_.insert(key.toUInt64(), tile);
+      }
+      lastTile_ = &it.value();
+    }
+    tileLeft = lastTile_->rect.left();
+    tileRight = lastTile_->rect.right();
+    return reinterpret_cast<const QRgb*>(lastTile_->image.constScanLine(y - lastTile_->rect.top())) + (x - tileLeft);
+  }
+
+private:
+  struct CachedTile
+  {
+    QRect rect;
+    QImage image;
+  };
+
+  const ImagePyramid* pyramid_;
+  QHash<quint64, CachedTile> tiles_;
+  const CachedTile* lastTile_;  // points into tiles_
+};
+
+class PixelMask
+{
+public:
+  explicit PixelMask(QSize size) :
+    width_(size.width()),
+    height_(size.height()),
+    wordsPerRow_((size.width() + 31) / 32),
+    words_(wordsPerRow_ * size.height(), 0)
+  { }
+
+  int wordsPerRow() const  { return wordsPerRow_; }
+  const quint32* row(int y) const  { return words_.constData() + y * wordsPerRow_; }
+
+  bool test(int x, int y) const
+  {
+    return x >= 0 && y >= 0 && x < width_ && y < height_ && (words_[y * wordsPerRow_ + x / 32] >> (x % 32)) & 1;
+  }
+
+  void set(int x, int y)  { words_[y * wordsPerRow_ + x / 32] |= quint32(1) << (x % 32); }
+
+  void setSpan(int y, int left, int right)
+  {
+    quint32* rowWords = words_.data() + y * wordsPerRow_;
+    for (int x = left; x <= right; ) {
+      int bit = x % 32;
+      int nBits = qMin(32 - bit, right - x + 1);
+      rowWords[x / 32] |= (nBits == 32 ? ~quint32(0) : ((quint32(1) << nBits) - 1)) << bit;
+      x += nBits;
+    }
+  }
+
+private:
+  int width_;
+  int height_;
+  int wordsPerRow_;
+  QVector<quint32> words_;
+};
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Outline
+
+// Walking along a ring, the region is on the right. Directions are +x, +y, -x, -y (y goes down); turning right is +1.
+// Pixels in front of a corner, on the right and on the left of the direction, relative to the corner
+static const int stepX[4]       = { 1,  0, -1,  0 };
+static const int stepY[4]       = { 0,  1,  0, -1 };
+static const int frontRightX[4] = { 0, -1, -1,  0 };
+static const int frontRightY[4] = { 0,  0, -1, -1 };
+static const int frontLeftX[4]  = { 0,  0, -1, -1 };
+static const int frontLeftY[4]  = { -1, 0,  0, -1 };
+
+// Starts with the top edge of pixel (x, y) and goes until it's back. Pixels that only touch by a corner are kept apart,
+// as the fill is 4-connected. Only corners where the boundary turns become vertices.
+// The ring is rotated to start at its top left vertex: a ring may pass a corner twice, but never that one.
+static void traceRing(const PixelMask& region, PixelMask& visitedTopEdges, int x, int y, QPolygonF& outline)
+{
+  QPolygonF ring;
+  int iFirst = 0;
+  int cornerX = x;
+  int cornerY = y;
+  int direction = 0;
+  do {
+    if (direction == 0)
+      visitedTopEdges.set(cornerX, cornerY);
+    cornerX += stepX[direction];
+    cornerY += stepY[direction];
+    int newDirection = direction;
+    if (!region.test(cornerX + frontRightX[direction], cornerY + frontRightY[direction]))
+      newDirection = (direction + 1) % 4;
+    else if (region.test(cornerX + frontLeftX[direction], cornerY + frontLeftY[direction]))
+      newDirection = (direction + 3) % 4;
+    if (newDirection != direction) {
+      QPointF corner(cornerX, cornerY);
+      if (   ring.isEmpty() || corner.y() < ring[iFirst].y()
+          || (corner.y() == ring[iFirst].y() && corner.x() < ring[iFirst].x()))
+        iFirst = ring.size();
+      ring.append(corner);
+    }
+    direction = newDirection;
+  } while (cornerX != x || cornerY != y || direction != 0);
+
+  outline += ring.mid(iFirst);
+  outline += ring.mid(0, iFirst);
+  outline.append(ring[iFirst]);
+}
+
+// Every ring, outer or around a hole, has a top edge: a region pixel with a non-region one above it.
+// Rings are found in row order, so the outer one comes first.
+static QPolygonF traceOutline(const PixelMask& region, QSize size, const QRect& bounds)
+{
+  QPolygonF outline;
+  PixelMask visitedTopEdges(size);
+  int firstWord = bounds.left() / 32;
+  int lastWord = bounds.right() / 32;
+  for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+    const quint32* row = region.row(y);
+    const quint32* rowAbove = y > 0 ? region.row(y - 1) : 0;
+    for (int iWord = firstWord; iWord <= lastWord; ++iWord) {
+      quint32 topEdges = row[iWord] & ~(rowAbove ? rowAbove[iWord] : 0);
+      for (int bit = 0; bit < 32 && topEdges; ++bit) {
+        if (!((topEdges >> bit) & 1))
+          continue;
+        topEdges &= ~visitedTopEdges.row(y)[iWord];  // the rings traced so far may have passed here
+        if ((topEdges >> bit) & 1)
+          traceRing(region, visitedTopEdges, iWord * 32 + bit, y, outline);
+      }
+    }
+  }
+  return outline;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fill
+
+FloodFillResult::FloodFillResult() :
+  seed(),
+  tolerance(0),
+  nPixels(0),
+  outline()
+{
+}
+
+// Spans are maximal runs of matching pixels within a row, so an unfilled matching pixel is never next to a filled one
+// in the same row, and a run of matching pixels is either filled as a whole or not at all
+bool floodFill(const ImagePyramid* pyramid, QPoint seed, int tolerance, FloodFillResult& result,
+               const QAtomicInt* generation, int jobGeneration)
+{
+  result = FloodFillResult();
+  result.seed = seed;
+  result.tolerance = tolerance;
+  QSize size = pyramid->size();
+  ASSERT_RETURN_V(QRect(QPoint(), size).contains(seed), false);
+
+  TileRowReader reader(pyramid);
+  int tileLeft, tileRight;
+  ColorRange colorRange(*reader.pixels(seed.x(), seed.y(), tileLeft, tileRight), tolerance);
+  PixelMask region(size);
+  QRect bounds;
+  QVector<QPoint> seeds;
+  seeds.append(seed);
+  int nSpans = 0;
+  while (!seeds.isEmpty()) {
+    if (generation && ++nSpans % cancellationCheckPeriod == 0 && *generation != jobGeneration)
+      return false;
+    QPoint spanSeed = seeds.back();
+    seeds.pop_back();
+    int y = spanSeed.y();
+    if (region.test(spanSeed.x(), y))
+      continue;
+
+    int left = spanSeed.x();
+    for (;;) {
+      const QRgb* pixels = reader.pixels(left, y, tileLeft, tileRight);
+      int nMatching = colorRange.runLengthBackward(pixels, left - tileLeft + 1, true);
+      left -= nMatching;
+      if (left >= tileLeft || left < 0)
+        break;
+    }
+    left++;
+    int right = spanSeed.x();
+    for (;;) {
+      const QRgb* pixels = reader.pixels(right, y, tileLeft, tileRight);
+      int nMatching = colorRange.runLength(pixels, tileRight - right + 1, true);
+      right += nMatching;
+      if (right <= tileRight || right >= size.width())
+        break;
+    }
+    right--;
+    region.setSpan(y, left, right);
+    result.nPixels += right - left + 1;
+    bounds |= QRect(left, y, right - left + 1, 1);
+
+    // Every run of matching pixels next to the span gets a seed
+    for (int neighbourY = y - 1; neighbourY <= y + 1; neighbourY += 2) {
+      if (neighbourY < 0 || neighbourY >= size.height())
+        continue;
+      for (int x = left; x <= right; ) {
+        const QRgb* pixels = reader.pixels(x, neighbourY, tileLeft, tileRight);
+        int n = qMin(tileRight, right) - x + 1;
+        int nMatching = colorRange.runLength(pixels, n, true);
+        if (nMatching > 0) {
+          if (!region.test(x, neighbourY))
+            seeds.append(QPoint(x, neighbourY));
+          x += nMatching;
+        }
+        else {
+          x += colorRange.runLength(pixels, n, false);
+        }
+      }
+    }
+  }
+
+  result.outline = traceOutline(region, size, bounds);
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// RegionFiller
+
+// Runs in a worker thread
+void RegionFiller::fill(RegionFiller* filler, QPoint seed, int tolerance, int jobGeneration)
+{
+  if (filler->generation_ != jobGeneration)
+    return;
+  FloodFillResult result;
+  if (!floodFill(filler->pyramid_, seed, tolerance, result, &filler->generation_, jobGeneration))
+    return;
+  {
+    QMutexLocker locker(&filler->resultMutex_);
+    if (filler->generation_ != jobGeneration)
+      return;
+    filler->result_ = result;
+  }
+  QMetaObject::invokeMethod(filler, "fillFinished", Qt::QueuedConnection, Q_ARG(int, jobGeneration));
+}
+
+
+RegionFiller::RegionFiller(const ImagePyramid* pyramid, QObject* parent) :
+  QObject(parent),
+  pyramid_(pyramid),
+  generation_(0),
+  isBusy_(false),
+  resultMutex_(),
+  result_()
+{
+}
+
+RegionFiller::~RegionFiller()
+{
+  cancel();
+  foreach (QFuture<void> job, runningJobs_)
+    job.waitForFinished();
+}
+
+
+void RegionFiller::request(QPoint seed, int tolerance)
+{
+  cancel();
+  int jobGeneration = generation_;
+  QList<QFuture<void> > stillRunning;
+  foreach (QFuture<void> oldJob, runningJobs_)
+    if (oldJob.isRunning())
+      stillRunning.append(oldJob);
+  runningJobs_ = stillRunning;
+  runningJobs_.append(QtConcurrent::run(fill, this, seed, tolerance, jobGeneration));
+  isBusy_ = true;
+}
+
+void RegionFiller::cancel()
+{
+  QMutexLocker locker(&resultMutex_);  // a result that is being stored is either kept or discarded as a whole
+  generation_.fetchAndAddOrdered(1);
+  isBusy_ = false;
+}
+
+FloodFillResult RegionFiller::result() const
+{
+  QMutexLocker locker(&resultMutex_);
+  return result_;
+}
+
+
+void RegionFiller::fillFinished(int jobGeneration)
+{
+  if (jobGeneration != generation_)
+    return;
+  isBusy_ = false;
+  emit filled();
+}
@@ -0,0 +1,65 @@
+#ifndef FLOOD_FILL_H
+#define FLOOD_FILL_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPolygonF>
+
+#include "image_pyramid.h"
+
+// Region of similar colour around a seed pixel of the original image. It's found with a scanline flood fill that reads
+// tiles of the image pyramid and compares pixels with SSE2 four at a time; only the pixels near the region are decoded.
+// The region is 4-connected; a pixel belongs to it if none of its colour channels differs from the seed by more than
+// the tolerance.
+
+struct FloodFillResult
+{
+  QPoint seed;
+  int tolerance;
+  qint64 nPixels;
+  QPolygonF outline;  // boundary rings as REGION shape points, in pixel corner coordinates
+
+  FloodFillResult();
+};
+
+// Returns false if the generation has changed, i.e. the fill is cancelled, or if the seed is outside the image
+bool floodFill(const ImagePyramid* pyramid, QPoint seed, int tolerance, FloodFillResult& result,
+               const QAtomicInt* generation = 0, int jobGeneration = 0);
+
+// Fills on a worker thread, so that a large region doesn't block the UI. A newer request cancels the older ones.
+class RegionFiller : public QObject
+{
+  Q_OBJECT
+
+public:
+  RegionFiller(const ImagePyramid* pyramid, QObject* parent = 0);
+  ~RegionFiller();
+
+  void request(QPoint seed, int tolerance);
+  void cancel();
+  bool isBusy() const  { return isBusy_; }
+  FloodFillResult result() const;  // of the latest request, after filled() is emitted
+
+signals:
+  void filled();
+
+private:
+  const ImagePyramid* pyramid_;
+  QAtomicInt generation_;
+  QList<QFuture<void> > runningJobs_;
+  bool isBusy_;
+  mutable QMutex resultMutex_;
+  FloodFillResult result_;
+
+  Q_DISABLE_COPY(RegionFiller)
+
+  static void fill(RegionFiller* filler, QPoint seed, int tolerance, int jobGeneration);
+
+private slots:
+  void fillFinished(int jobGeneration);
+};
+
+#endif // FLOOD_FILL_H
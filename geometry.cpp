@@ -0,0 +1,166 @@
+#include <cmath>
+#include <limits>
+
+#include "debug_utils.h"
+#include "geometry.h"
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Exact arithmetic
+//
+// A real number is represented as an expansion: a sum of doubles ordered by magnitude, no two of which overlap
+// (J. R. Shewchuk, Adaptive Precision Floating-Point Arithmetic and Fast Robust Geometric Predicates).
+// The sign of an expansion is the sign of its largest component.
+
+static const double epsilon = std::numeric_limits<double>::epsilon() / 2.;  // 2^-53
+static const double splitter = 134217729.;  // 2^27 + 1
+static const double orientationErrorBound = (3. + 16. * epsilon) * epsilon;
+
+// a + b = sum + error exactly
+static inline void twoSum(double a, double b, double& sum, double& error)
+{
+  sum = a + b;
+  double bVirtual = sum - a;
+  double aVirtual = sum - bVirtual;
+  error = (a - aVirtual) + (b - bVirtual);
+}
+
+static inline void split(double a, double& high, double& low)
+{
+  double c = splitter * a;
+  high = c - (c - a);
+  low = a - high;
+}
+
+// a * b = product + error exactly
+static inline void twoProduct(double a, double b, double& product, double& error)
+{
+  product = a * b;
+  double aHigh, aLow, bHigh, bLow;
+  split(a, aHigh, aLow);
+  split(b, bHigh, bLow);
+  error = aLow * bLow - (((product - aHigh * bHigh) - aLow * bHigh) - aHigh * bLow);
+}
+
+// Adds a double to an expansion of nComponents components; the result has one more component
+static int growExpansion(double* expansion, int nComponents, double b)
+{
+  double q = b;
+  for (int i = 0; i < nComponents; ++i) {
+    double sum, error;
+    twoSum(q, expansion[i], sum, error);
+    expansion[i] = error;
+    q = sum;
+  }
+  expansion[nComponents] = q;
+  return nComponents + 1;
+}
+
+static int expansionSign(const double* expansion, int nComponents)
+{
+  for (int i = nComponents - 1; i >= 0; --i)
+    if (expansion[i] != 0.)
+      return expansion[i] > 0. ? 1 : -1;
+  return 0;
+}
+
+// Sign of (ax - cx) * (by - cy) - (ay - cy) * (bx - cx), computed without rounding
+static int orientationExact(QPointF a, QPointF b, QPointF c)
+{
+  // Expanded, the cx * cy terms cancel out
+  const double factors[6][2] = { {  a.x(), b.y() }, { -a.x(), c.y() }, { -c.x(), b.y() },
+                                 { -a.y(), b.x() }, {  a.y(), c.x() }, {  c.y(), b.x() } };
+  double expansion[12];
+  int nComponents = 0;
+  for (int i = 0; i < 6; ++i) {
+    double product, error;
+    twoProduct(factors[i][0], factors[i][1], product, error);
+    nComponents = growExpansion(expansion, nComponents, error);
+    nComponents = growExpansion(expansion, nComponents, product);
+  }
+  return expansionSign(expansion, nComponents);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Predicates
+
+int orientation(QPointF a, QPointF b, QPointF c)
+{
+  double left  = (a.x() - c.x()) * (b.y() - c.y());
+  double right = (a.y() - c.y()) * (b.x() - c.x());
+  double determinant = left - right;
+  // Rounding can't change the sign unless the result is this close to zero
+  double errorBound = orientationErrorBound * (std::fabs(left) + std::fabs(right));
+  if (determinant > errorBound)
+    return 1;
+  if (determinant < -errorBound)
+    return -1;
+  if (left == 0. && right == 0.)
+    return 0;
+  return orientationExact(a, b, c);
+}
+
+// Whether c, known to be collinear with a and b, lies on the segment ab
+static inline bool collinearPointOnSegment(QPointF a, QPointF b, QPointF c)
+{
+  return    qMin(a.x(), b.x()) <= c.x() && c.x() <= qMax(a.x(), b.x())
+         && qMin(a.y(), b.y()) <= c.y() && c.y() <= qMax(a.y(), b.y());
+}
+
+bool testSegmentsCross(QPointF a, QPointF b, QPointF c, QPointF d)
+{
+  // Cheap rejection first: most edge pairs tested are far from each other
+  if (   qMax(a.x(), b.x()) < qMin(c.x(), d.x()) || qMax(c.x(), d.x()) < qMin(a.x(), b.x())
+      || qMax(a.y(), b.y()) < qMin(c.y(), d.y()) || qMax(c.y(), d.y()) < qMin(a.y(), b.y()))
+    return false;
+  int abc = orientation(a, b, c);
+  int abd = orientation(a, b, d);
+  if (abc != 0 && abc == abd)
+    return false;
+  int cda = orientation(c, d, a);
+  int cdb = orientation(c, d, b);
+  if (cda != 0 && cda == cdb)
+    return false;
+  if (abc != 0 || abd != 0 || cda != 0 || cdb != 0)
+    return true;
+  // All four points are on one line; the bounding boxes overlap, but a degenerate segment may still miss the other one
+  return    collinearPointOnSegment(a, b, c) || collinearPointOnSegment(a, b, d)
+         || collinearPointOnSegment(c, d, a) || collinearPointOnSegment(c, d, b);
+}
+
+bool isPointOnSegment(QPointF point, QPointF a, QPointF b)
+{
+  return orientation(a, b, point) == 0 && collinearPointOnSegment(a, b, point);
+}
+
+bool isPointInPolygon(QPointF point, const QPolygonF& polygon)
+{
+  assertPolygonIsClosed(polygon);
+  bool isInside = false;
+  for (int i = 0; i < polygon.size() - 1; ++i) {
+    QPointF a = polygon[i];
+    QPointF b = polygon[i + 1];
+    if ((a.y() > point.y()) != (b.y() > point.y())) {
+      // The edge crosses the horizontal line through the point; count it if it's to the right of the point
+      int side = orientation(a, b, point);
+      if (side == 0)
+        return true;
+      if ((b.y() > a.y()) == (side > 0))
+        isInside = !isInside;
+    }
+    else if (a.y() == point.y() && isPointOnSegment(point, a, b)) {
+      return true;
+    }
+  }
+  return isInside;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Misc
+
+void assertPolygonIsClosed(const QPolygonF& polygon)
+{
+  ASSERT_RETURN(polygon.isEmpty() || polygon.first() == polygon.last());
+}
@@ -0,0 +1,23 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <QPointF>
+#include <QPolygonF>
+
+// Predicates are exact: a fast floating-point evaluation is used when its error bound proves the sign,
+// and exact arithmetic only in the rare nearly degenerate cases.
+
+// 1 if c is to the left of the directed line ab (in axes with y going up), -1 if to the right, 0 if on the line
+int orientation(QPointF a, QPointF b, QPointF c);
+
+// Whether closed segments ab and cd have a common point, including touching ends and collinear overlaps
+bool testSegmentsCross(QPointF a, QPointF b, QPointF c, QPointF d);
+
+bool isPointOnSegment(QPointF point, QPointF a, QPointF b);
+
+// Odd-even rule; points on the boundary are inside
+bool isPointInPolygon(QPointF point, const QPolygonF& polygon);
+
+void assertPolygonIsClosed(const QPolygonF& polygon);
+
+#endif // GEOMETRY_H
@@ -0,0 +1,299 @@
+#include <cmath>
+
+#include <QMutexLocker>
+#include <QtConcurrentRun>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#include "debug_utils.h"
+#include "gradient_pyramid.h"
+
+
+const int maxGradientCacheKBytes = 96 * 1024;
+
+// Rec. 601 luma in 8.8 fixed point
+static inline qint16 luminance(QRgb color)
+{
+  return qint16((qRed(color) * 77 + qGreen(color) * 150 + qBlue(color) * 29) >> 8);
+}
+
+// Direction is found without atan2. The angle within the first octant comes from a polynomial of min/max of |gx|, |gy|
+// (error below 0.001 of a step) in 1/256 of a step, then it's mirrored into the octant of the signs in 16-bit integers
+// and rounded to 1/256 of a turn. The SSE2 version divides approximately, so it may differ by a step at rounding ties.
+const float octantAngleCoeffs[5] = { float(0.9998660 * 32768. / M_PI), float(-0.3302995 * 32768. / M_PI),
+                                     float(0.1801410 * 32768. / M_PI), float(-0.0851330 * 32768. / M_PI),
+                                     float(0.0208351 * 32768. / M_PI) };
+
+static inline quint8 gradientDirection(int gx, int gy)
+{
+  if (gx == 0 && gy == 0)
+    return 0;
+  int absGx = qAbs(gx);
+  int absGy = qAbs(gy);
+  float ratio = float(qMin(absGx, absGy)) / float(qMax(absGx, absGy));
+  float ratio2 = ratio * ratio;
+  int angle = int(ratio * (octantAngleCoeffs[0] + ratio2 * (octantAngleCoeffs[1] + ratio2 * (octantAngleCoeffs[2]
+                  + ratio2 * (octantAngleCoeffs[3] + ratio2 * octantAngleCoeffs[4])))) + 0.5f);
+  if (absGy > absGx)
+    angle = 64 * 256 - angle;
+  if (gx < 0)
+    angle = 128 * 256 - angle;
+  if (gy < 0)
+    angle = -angle;
+  return quint8(((angle + 128) & 0xffff) >> 8);
+}
+
+#if defined(__SSE2__)
+// Octant angles of four gradients, as gradientDirection computes them before mirroring
+static inline __m128i octantAngles(__m128i minAbs, __m128i maxAbs)
+{
+  __m128 ratio = _mm_mul_ps(_mm_cvtepi32_ps(minAbs), _mm_rcp_ps(_mm_cvtepi32_ps(maxAbs)));
+  __m128 ratio2 = _mm_mul_ps(ratio, ratio);
+  __m128 angle = _mm_set1_ps(octantAngleCoeffs[4]);
+  angle = _mm_add_ps(_mm_set1_ps(octantAngleCoeffs[3]), _mm_mul_ps(ratio2, angle));
+  angle = _mm_add_ps(_mm_set1_ps(octantAngleCoeffs[2]), _mm_mul_ps(ratio2, angle));
+  angle = _mm_add_ps(_mm_set1_ps(octantAngleCoeffs[1]), _mm_mul_ps(ratio2, angle));
+  angle = _mm_mul_ps(ratio, _mm_add_ps(_mm_set1_ps(octantAngleCoeffs[0]), _mm_mul_ps(ratio2, angle)));
+  return _mm_cvtps_epi32(angle);
+}
+
+// Same as gradientDirection for eight gradients; the result is in the low 8 bytes
+static inline __m128i gradientDirections(__m128i gx, __m128i gy, __m128i absGx, __m128i absGy)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i minAbs = _mm_min_epi16(absGx, absGy);
+  __m128i maxAbs = _mm_max_epi16(absGx, absGy);
+  __m128i isZero = _mm_cmpeq_epi16(maxAbs, zero);
+  maxAbs = _mm_max_epi16(maxAbs, _mm_set1_epi16(1));
+  __m128i angle = _mm_packs_epi32(octantAngles(_mm_unpacklo_epi16(minAbs, zero), _mm_unpacklo_epi16(maxAbs, zero)),
+                                  octantAngles(_mm_unpackhi_epi16(minAbs, zero), _mm_unpackhi_epi16(maxAbs, zero)));
+  // x ? base - angle : angle  is  ((angle ^ x) - x) + (x & base)  for an all-ones or all-zeros x
+  __m128i swapped = _mm_cmpgt_epi16(absGy, absGx);
+  angle = _mm_add_epi16(_mm_sub_epi16(_mm_xor_si128(angle, swapped), swapped), _mm_and_si128(swapped, _mm_set1_epi16(64 * 256)));
+  __m128i xNegative = _mm_srai_epi16(gx, 15);
+  angle = _mm_add_epi16(_mm_sub_epi16(_mm_xor_si128(angle, xNegative), xNegative),
+                        _mm_and_si128(xNegative, _mm_set1_epi16(short(128 * 256))));
+  __m128i yNegative = _mm_srai_epi16(gy, 15);
+  angle = _mm_sub_epi16(_mm_xor_si128(angle, yNegative), yNegative);
+  angle = _mm_andnot_si128(isZero, _mm_srli_epi16(_mm_add_epi16(angle, _mm_set1_epi16(128)), 8));
+  return _mm_packus_epi16(angle, zero);
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// GradientField, Sobel operator
+
+GradientField::GradientField() :
+  level(0)
+{
+}
+
+void computeSobel(const qint16* luminance, int luminanceStride, int width, int height,
+                  quint16* magnitude, quint8* direction, int resultStride)
+{
+  for (int y = 0; y < height; ++y) {
+    const qint16* row0 = luminance + y * luminanceStride;
+    const qint16* row1 = row0 + luminanceStride;
+    const qint16* row2 = row1 + luminanceStride;
+    quint16* magnitudeRow = magnitude + y * resultStride;
+    quint8* directionRow = direction + y * resultStride;
+    int x = 0;
+#if defined(__SSE2__)
+    // 8 pixels per step; luminance is 8-bit, so neither sums nor magnitudes overflow 16 bits
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8) {
+      __m128i left0   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x));
+      __m128i center0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x + 1));
+      __m128i right0  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x + 2));
+      __m128i left1   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x));
+      __m128i right1  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x + 2));
+      __m128i left2   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row2 + x));
+      __m128i center2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row2 + x + 1));
+      __m128i right2  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row2 + x + 2));
+      __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(right0, left0), _mm_sub_epi16(right2, left2)),
+                                 _mm_slli_epi16(_mm_sub_epi16(right1, left1), 1));
+      __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(left2, right2), _mm_slli_epi16(center2, 1)),
+                                 _mm_add_epi16(_mm_add_epi16(left0, right0), _mm_slli_epi16(center0, 1)));
+      __m128i absGx = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+      __m128i absGy = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(magnitudeRow + x), _mm_add_epi16(absGx, absGy));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(directionRow + x), gradientDirections(gx, gy, absGx, absGy));
+    }
+#endif
+    for (; x < width; ++x) {
+      int gx = (row0[x + 2] - row0[x]) + 2 * (row1[x + 2] - row1[x]) + (row2[x + 2] - row2[x]);
+      int gy = (row2[x] + 2 * row2[x + 1] + row2[x + 2]) - (row0[x] + 2 * row0[x + 1] + row0[x + 2]);
+      magnitudeRow[x] = quint16(qAbs(gx) + qAbs(gy));
+      directionRow[x] = gradientDirection(gx, gy);
+    }
+  }
+}
+
+// Luminance of levelRect with a 1-pixel border; outside the image the border repeats the edge pixels
+static QVector<qint16> readLuminance(const ImagePyramid* pyramid, int level, const QRect& levelRect)
+{
+  QRect borderedRect = levelRect.adjusted(-1, -1, 1, 1);
+  QRect availableRect = borderedRect.intersected(QRect(QPoint(), pyramid->levelSize(level)));
+  int stride = borderedRect.width();
+  QVector<qint16> result(stride * borderedRect.height());
+  qint16* data = result.data();
+  foreach (const ImagePyramid::TileKey& key, pyramid->tilesInLevelRect(level, availableRect)) {
+    QImage tile = pyramid->tile(key);
+    QRect tileRect = pyramid->levelTileRect(key);
+    QRect part = tileRect.intersected(availableRect);
+    ASSERT_RETURN_V(tile.depth() == 32 && tile.size() == tileRect.size(), result);
+    for (int y = part.top(); y <= part.bottom(); ++y) {
+      const QRgb* source = reinterpret_cast<const QRgb*>(tile.constScanLine(y - tileRect.top())) + (part.left() - tileRect.left());
+      qint16* target = data + (y - borderedRect.top()) * stride + (part.left() - borderedRect.left());
+      for (int i = 0; i < part.width(); ++i)
+        target[i] = luminance(source[i]);
+    }
+  }
+
+  int firstColumn = availableRect.left() - borderedRect.left();
+  int lastColumn  = availableRect.right() - borderedRect.left();
+  int firstRow    = availableRect.top() - borderedRect.top();
+  int lastRow     = availableRect.bottom() - borderedRect.top();
+  for (int row = firstRow; row <= lastRow; ++row) {
+    qint16* line = data + row * stride;
+    if (firstColumn > 0)
+      line[0] = line[firstColumn];
+    if (lastColumn < stride - 1)
+      line[stride - 1] = line[lastColumn];
+  }
+  if (firstRow > 0)
+    qCopy(data + firstRow * stride, data + (firstRow + 1) * stride, data);
+  if (lastRow < borderedRect.height() - 1)
+    qCopy(data + lastRow * stride, data + (lastRow + 1) * stride, data + (borderedRect.height() - 1) * stride);
+  return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Worker
+
+// Runs in a worker thread. Tiles of stale requests are skipped.
+void GradientPyramid::computeTile(GradientPyramid* gradientPyramid, ImagePyramid::TileKey key, int jobGeneration)
+{
+  if (gradientPyramid->generation_ != jobGeneration)
+    return;
+  const ImagePyramid* pyramid = gradientPyramid->pyramid_;
+  if (!gradientPyramid->isCached(key)) {
+    QRect rect = pyramid->levelTileRect(key);
+    QVector<qint16> luminance = readLuminance(pyramid, key.level, rect);
+    Tile* tile = new Tile;
+    tile->magnitude.resize(rect.width() * rect.height());
+    tile->direction.resize(rect.width() * rect.height());
+    computeSobel(luminance.constData(), rect.width() + 2, rect.width(), rect.height(),
+                 tile->magnitude.data(), tile->direction.data(), rect.width());
+    QMutexLocker locker(&gradientPyramid->tilesMutex_);
+    gradientPyramid->tiles_.insert(key.toUInt64(), tile, qMax(1, rect.width() * rect.height() * 3 / 1024));
+  }
+  QMetaObject::invokeMethod(gradientPyramid, "tileComputed", Qt::QueuedConnection,
+                            Q_ARG(qulonglong, key.toUInt64()), Q_ARG(QRect, pyramid->originalTileRect(key)));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// GradientPyramid
+
+GradientPyramid::GradientPyramid(const ImagePyramid* pyramid, QObject* parent) :
+  QObject(parent),
+  pyramid_(pyramid),
+  tilesMutex_(),
+  tiles_(maxGradientCacheKBytes),
+  generation_(0)
+{
+}
+
+GradientPyramid::~GradientPyramid()
+{
+  cancel();
+  foreach (QFuture<void> job, runningJobs_)
+    job.waitForFinished();
+}
+
+
+bool GradientPyramid::readCached(int level, const QRect& levelRect, GradientField& result) const
+{
+  result.level = level;
+  result.rect = levelRect.intersected(QRect(QPoint(), pyramid_->levelSize(level)));
+  int nSamples = result.rect.width() * result.rect.height();
+  result.magnitude.fill(0, nSamples);
+  result.direction.fill(0, nSamples);
+  bool isComplete = true;
+  QMutexLocker locker(&tilesMutex_);
+  foreach (const ImagePyramid::TileKey& key, pyramid_->tilesInLevelRect(level, result.rect)) {
+    const Tile* tile = tiles_.object(key.toUInt64());
+    if (!tile) {
+      isComplete = false;
+      continue;
+    }
+    QRect tileRect = pyramid_->levelTileRect(key);
+    QRect part = tileRect.intersected(result.rect);
+    for (int y = part.top(); y <= part.bottom(); ++y) {
+      int iSource = (y - tileRect.top()) * tileRect.width() + part.left() - tileRect.left();
+      int iTarget = result.index(QPoint(part.left(), y));
+      qCopy(tile->magnitude.constData() + iSource, tile->magnitude.constData() + iSource + part.width(),
+            result.magnitude.data() + iTarget);
+      qCopy(tile->direction.constData() + iSource, tile->direction.constData() + iSource + part.width(),
+            result.direction.data() + iTarget);
+    }
+  }
+  return isComplete;
+}
+
+QList<ImagePyramid::TileKey> GradientPyramid::missingTiles(int level, const QRect& levelRect) const
+{
+  QList<ImagePyramid::TileKey> result;
+  foreach (const ImagePyramid::TileKey& key, pyramid_->tilesInLevelRect(level, levelRect))
+    if (!isCached(key))
+      result.append(key);
+  return result;
+}
+
+
+void GradientPyramid::request(const QList<ImagePyramid::TileKey>& tiles)
+{
+  bool hasNewTiles = false;
+  foreach (const ImagePyramid::TileKey& key, tiles)
+    if (!requestedTiles_.contains(key.toUInt64()))
+      hasNewTiles = true;
+  if (!hasNewTiles)
+    return;
+
+  // Same as in TileLoader: tiles that are still needed are simply requested again
+  cancel();
+  int jobGeneration = generation_;
+  QList<QFuture<void> > stillRunning;
+  foreach (QFuture<void> oldJob, runningJobs_)
+    if (oldJob.isRunning())
+      stillRunning.append(oldJob);
+  runningJobs_ = stillRunning;
+  foreach (const ImagePyramid::TileKey& key, tiles) {
+    requestedTiles_.insert(key.toUInt64());
+    runningJobs_.append(QtConcurrent::run(computeTile, this, key, jobGeneration));
+  }
+}
+
+void GradientPyramid::cancel()
+{
+  generation_.fetchAndAddOrdered(1);
+  requestedTiles_.clear();
+}
+
+
+bool GradientPyramid::isCached(const ImagePyramid::TileKey& key) const
+{
+  QMutexLocker locker(&tilesMutex_);
+  return tiles_.contains(key.toUInt64());
+}
+
+void GradientPyramid::tileComputed(qulonglong key, const QRect& originalRect)
+{
+  requestedTiles_.remove(key);
+  emit computed(originalRect);
+}
@@ -0,0 +1,82 @@
+#ifndef GRADIENT_PYRAMID_H
+#define GRADIENT_PYRAMID_H
+
+#include <QAtomicInt>
+#include <QCache>
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QVector>
+
+#include "image_pyramid.h"
+
+// Brightness gradient of the image at the levels of an image pyramid, so that edges are looked for at the resolution
+// the user sees. Gradient tiles match image tiles; they are computed with the Sobel operator on worker threads and kept
+// in a bounded cache. Like with TileLoader, the caller reads what is cached and requests the rest.
+// All const methods are thread-safe.
+
+// Gradient samples of a rectangle at one level of the pyramid, row by row
+struct GradientField
+{
+  int level;
+  QRect rect;                  // in coordinates of the level
+  QVector<quint16> magnitude;  // |gx| + |gy|; zero where the gradient is not known
+  QVector<quint8> direction;   // angle of the gradient vector, a full turn is 256
+
+  GradientField();
+
+  bool contains(QPoint levelPoint) const  { return rect.contains(levelPoint); }
+  int index(QPoint levelPoint) const      { return (levelPoint.y() - rect.top()) * rect.width() + levelPoint.x() - rect.left(); }
+};
+
+// Sobel operator over a luminance image that has a 1-pixel border around the width x height result.
+// Strides are in elements. Uses SSE2 where available.
+void computeSobel(const qint16* luminance, int luminanceStride, int width, int height,
+                  quint16* magnitude, quint8* direction, int resultStride);
+
+class GradientPyramid : public QObject
+{
+  Q_OBJECT
+
+public:
+  GradientPyramid(const ImagePyramid* pyramid, QObject* parent = 0);
+  ~GradientPyramid();
+
+  // Copies the cached gradient of levelRect, clipped to the level. Returns false if some of its tiles are not computed
+  bool readCached(int level, const QRect& levelRect, GradientField& result) const;
+
+  // Tiles that readCached would miss
+  QList<ImagePyramid::TileKey> missingTiles(int level, const QRect& levelRect) const;
+
+  void request(const QList<ImagePyramid::TileKey>& tiles);
+  void cancel();
+
+signals:
+  void computed(const QRect& originalRect);
+
+private:
+  struct Tile
+  {
+    QVector<quint16> magnitude;
+    QVector<quint8> direction;
+  };
+
+  const ImagePyramid* pyramid_;
+  mutable QMutex tilesMutex_;
+  mutable QCache<quint64, Tile> tiles_;
+  QAtomicInt generation_;
+  QList<QFuture<void> > runningJobs_;
+  QSet<quint64> requestedTiles_;  // not computed yet
+
+  Q_DISABLE_COPY(GradientPyramid)
+
+  static void computeTile(GradientPyramid* gradientPyramid, ImagePyramid::TileKey key, int jobGeneration);
+  bool isCached(const ImagePyramid::TileKey& key) const;
+
+private slots:
+  void tileComputed(qulonglong key, const QRect& originalRect);
+};
+
+#endif // GRADIENT_PYRAMID_H
@@ -0,0 +1,288 @@
+#include <cmath>
+
+#include <QMutexLocker>
+#include <QPainter>
+
+#include "debug_utils.h"
+#include "image_pyramid.h"
+
+
+const int tileSize = 256;
+const int maxTileCacheKBytes = 256 * 1024;
+const QColor missingTileColor = QColor(0xd0, 0xd0, 0xd0);
+
+static inline int nTiles(int length)
+{
+  return (length + tileSize - 1) / tileSize;
+}
+
+// Tile boundaries are rounded the same way for both neighbours, so there are neither gaps nor overlaps between tiles
+static inline int scaledBoundary(int x, double scale)
+{
+  return qRound(x * scale);
+}
+
+static QRect scaledTileRect(const QRect& sourceRect, double scale)
+{
+  return QRect(QPoint(scaledBoundary(sourceRect.left(), scale), scaledBoundary(sourceRect.top(), scale)),
+               QPoint(scaledBoundary(sourceRect.right()  + 1, scale) - 1,
+                      scaledBoundary(sourceRect.bottom() + 1, scale) - 1));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TileKey, Level
+
+quint64 ImagePyramid::TileKey::toUInt64() const
+{
+  return (quint64(quint8(level)) << 56) | (quint64(quint32(tx) & 0xfffffff) << 28) | (quint32(ty) & 0xfffffff);
+}
+
+QRect ImagePyramid::Level::tileRect(int tx, int ty) const
+{
+  return QRect(tx * tileSize, ty * tileSize, tileSize, tileSize).intersected(QRect(QPoint(), size));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ImagePyramid
+
+ImagePyramid::ImagePyramid(TileSource* source) :
+  source_(source),
+  format_(QImage::Format_RGB32),
+  levels_(),
+  tilesMutex_(),
+  tiles_(maxTileCacheKBytes)
+{
+  if (!source_ || source_->size().isEmpty())
+    return;
+  format_ = source_->hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+  int iLevel = 0;
+  do {
+    Level level;
+    level.size = levelSize(source_->size(), iLevel);
+    level.nTilesX = nTiles(level.size.width());
+    level.nTilesY = nTiles(level.size.height());
+    levels_.append(level);
+    iLevel++;
+  } while (levels_.last().nTilesX > 1 || levels_.last().nTilesY > 1);
+}
+
+ImagePyramid::~ImagePyramid()
+{
+}
+
+
+int ImagePyramid::levelForScale(double scale) const
+{
+  // Take the smallest level that is still not smaller than the result
+  int iLevel = 0;
+  while (iLevel + 1 < levels_.size() && scale <= std::ldexp(1., -(iLevel + 1)))
+    iLevel++;
+  return iLevel;
+}
+
+// Whether drawing at this scale resamples the level, i.e. whether smooth filtering makes any difference
+bool ImagePyramid::needsFiltering(double scale) const
+{
+  return std::ldexp(scale, levelForScale(scale)) != 1.;
+}
+
+void ImagePyramid::draw(QPainter& painter, const QRect& targetRect, double scale) const
+{
+  if (isEmpty() || targetRect.isEmpty())
+    return;
+  int iLevel = levelForScale(scale);
+  const Level& level = levels_[iLevel];
+  double levelScale = std::ldexp(scale, iLevel);
+  QRect tiles = tilesCovering(iLevel, targetRect, levelScale);
+  for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty) {
+    for (int tx = tiles.left(); tx <= tiles.right(); ++tx) {
+      QRect tileTargetRect = scaledTileRect(level.tileRect(tx, ty), levelScale);
+      TileKey key = { iLevel, tx, ty };
+      if (tileTargetRect.intersects(targetRect))
+        painter.drawImage(tileTargetRect, tile(key));
+    }
+  }
+}
+
+bool ImagePyramid::drawCached(QPainter& painter, const QRect& targetRect, double scale) const
+{
+  if (isEmpty() || targetRect.isEmpty())
+    return true;
+  int iLevel = levelForScale(scale);
+  const Level& level = levels_[iLevel];
+  double levelScale = std::ldexp(scale, iLevel);
+  QRect tiles = tilesCovering(iLevel, targetRect, levelScale);
+  bool isComplete = true;
+  for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty) {
+    for (int tx = tiles.left(); tx <= tiles.right(); ++tx) {
+      QRect sourceRect = level.tileRect(tx, ty);
+      QRect tileTargetRect = scaledTileRect(sourceRect, levelScale);
+      if (!tileTargetRect.intersects(targetRect))
+        continue;
+      TileKey key = { iLevel, tx, ty };
+      QImage image = cachedTile(key);
+      if (!image.isNull()) {
+        painter.drawImage(tileTargetRect, image);
+        continue;
+      }
+      isComplete = false;
+      // A blurry part of a coarser tile is better than nothing
+      bool hasAncestor = false;
+      for (int iAncestor = iLevel + 1; iAncestor < levels_.size() && !hasAncestor; ++iAncestor) {
+        int shift = iAncestor - iLevel;
+        TileKey ancestorKey = { iAncestor, tx >> shift, ty >> shift };
+        QImage ancestor = cachedTile(ancestorKey);
+        if (ancestor.isNull())
+          continue;
+        double factor = std::ldexp(1., -shift);
+        QRectF ancestorSourceRect(QPointF(sourceRect.topLeft()) * factor
+                                    - levels_[iAncestor].tileRect(ancestorKey.tx, ancestorKey.ty).topLeft(),
+                                  QSizeF(sourceRect.size()) * factor);
+        painter.drawImage(QRectF(tileTargetRect), ancestor, ancestorSourceRect);
+        hasAncestor = true;
+      }
+      if (!hasAncestor)
+        painter.fillRect(tileTargetRect, missingTileColor);
+    }
+  }
+  return isComplete;
+}
+
+QList<ImagePyramid::TileKey> ImagePyramid::missingTiles(const QRect& targetRect, double scale) const
+{
+  QList<TileKey> result;
+  if (isEmpty() || targetRect.isEmpty())
+    return result;
+  int iLevel = levelForScale(scale);
+  const Level& level = levels_[iLevel];
+  double levelScale = std::ldexp(scale, iLevel);
+  QRect tiles = tilesCovering(iLevel, targetRect, levelScale);
+  QMutexLocker locker(&tilesMutex_);
+  for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty) {
+    for (int tx = tiles.left(); tx <= tiles.right(); ++tx) {
+      TileKey key = { iLevel, tx, ty };
+      if (scaledTileRect(level.tileRect(tx, ty), levelScale).intersects(targetRect) && !tiles_.contains(key.toUInt64()))
+        result.append(key);
+    }
+  }
+  return result;
+}
+
+
+QImage ImagePyramid::readOriginal(const QRect& rect) const
+{
+  ASSERT_RETURN_V(!isEmpty() && QRect(QPoint(), size()).contains(rect), QImage());
+  return normalized(source_->read(rect, 0), rect.size());
+}
+
+QImage ImagePyramid::tile(const TileKey& key) const
+{
+  QImage result = cachedTile(key);
+  if (!result.isNull())
+    return result;
+  // Two threads may decode the same tile at once; it's wasteful, but harmless
+  result = loadTile(key);
+  QMutexLocker locker(&tilesMutex_);
+  tiles_.insert(key.toUInt64(), new QImage(result), qMax(1, result.byteCount() / 1024));
+  return result;
+}
+
+QRect ImagePyramid::originalTileRect(const TileKey& key) const
+{
+  ASSERT_RETURN_V(key.level >= 0 && key.level < levels_.size(), QRect());
+  QRect rect = levels_[key.level].tileRect(key.tx, key.ty);
+  return QRect(rect.topLeft() * (1 << key.level), rect.size() * (1 << key.level)).intersected(QRect(QPoint(), size()));
+}
+
+QRect ImagePyramid::targetTileRect(const TileKey& key, double scale) const
+{
+  ASSERT_RETURN_V(key.level >= 0 && key.level < levels_.size(), QRect());
+  return scaledTileRect(levels_[key.level].tileRect(key.tx, key.ty), std::ldexp(scale, key.level));
+}
+
+QSize ImagePyramid::levelSize(int iLevel) const
+{
+  ASSERT_RETURN_V(iLevel >= 0 && iLevel < levels_.size(), QSize());
+  return levels_[iLevel].size;
+}
+
+QRect ImagePyramid::levelTileRect(const TileKey& key) const
+{
+  ASSERT_RETURN_V(key.level >= 0 && key.level < levels_.size(), QRect());
+  return levels_[key.level].tileRect(key.tx, key.ty);
+}
+
+QList<ImagePyramid::TileKey> ImagePyramid::tilesInLevelRect(int iLevel, const QRect& levelRect) const
+{
+  QList<TileKey> result;
+  ASSERT_RETURN_V(iLevel >= 0 && iLevel < levels_.size(), result);
+  QRect rect = levelRect.intersected(QRect(QPoint(), levels_[iLevel].size));
+  if (rect.isEmpty())
+    return result;
+  for (int ty = rect.top() / tileSize; ty <= rect.bottom() / tileSize; ++ty) {
+    for (int tx = rect.left() / tileSize; tx <= rect.right() / tileSize; ++tx) {
+      TileKey key = { iLevel, tx, ty };
+      result.append(key);
+    }
+  }
+  return result;
+}
+
+
+QRect ImagePyramid::tilesCovering(int iLevel, const QRect& targetRect, double levelScale) const
+{
+  const Level& level = levels_[iLevel];
+  return QRect(QPoint(qMax(0,                 int(std::floor(targetRect.left()        / levelScale)) / tileSize),
+                      qMax(0,                 int(std::floor(targetRect.top()         / levelScale)) / tileSize)),
+               QPoint(qMin(level.nTilesX - 1, int(std::floor((targetRect.right()  + 1) / levelScale)) / tileSize),
+                      qMin(level.nTilesY - 1, int(std::floor((targetRect.bottom() + 1) / levelScale)) / tileSize)));
+}
+
+QImage ImagePyramid::cachedTile(const TileKey& key) const
+{
+  QMutexLocker locker(&tilesMutex_);
+  const QImage* image = tiles_.object(key.toUInt64());
+  return image ? *image : QImage();
+}
+
+QImage ImagePyramid::loadTile(const TileKey& key) const
+{
+  ASSERT_RETURN_V(key.level >= 0 && key.level < levels_.size(), QImage());
+  const Level& level = levels_[key.level];
+  QRect rect = level.tileRect(key.tx, key.ty);
+  QImage result;
+  if (source_->hasLevel(key.level)) {
+    result = source_->read(rect, key.level);
+  }
+  else {
+    ASSERT_RETURN_V(key.level > 0, QImage());
+    const Level& finerLevel = levels_[key.level - 1];
+    QRect sourceRect = QRect(rect.topLeft() * 2, rect.size() * 2).intersected(QRect(QPoint(), finerLevel.size));
+    QImage finerImage(sourceRect.size(), format_);
+    QPainter painter(&finerImage);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (int ty = sourceRect.top() / tileSize; ty <= sourceRect.bottom() / tileSize; ++ty) {
+      for (int tx = sourceRect.left() / tileSize; tx <= sourceRect.right() / tileSize; ++tx) {
+        TileKey finerKey = { key.level - 1, tx, ty };
+        painter.drawImage(finerLevel.tileRect(tx, ty).topLeft() - sourceRect.topLeft(), tile(finerKey));
+      }
+    }
+    painter.end();
+    result = finerImage.scaled(rect.size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+  }
+
+  return normalized(result, rect.size());  // the placeholder is cached, so a broken part of the file isn't read again and again
+}
+
+// Converts decoded image to the pyramid format; broken parts of the file are replaced with a placeholder
+QImage ImagePyramid::normalized(const QImage& image, QSize expectedSize) const
+{
+  if (image.isNull() || image.size() != expectedSize) {
+    QImage placeholder(expectedSize, format_);
+    placeholder.fill(missingTileColor.rgb());
+    return placeholder;
+  }
+  return image.format() == format_ ? image : image.convertToFormat(format_);
+}
@@ -0,0 +1,91 @@
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include <QCache>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QVector>
+
+#include "tile_source.h"
+
+class QPainter;
+
+// Mip levels of an image cut into fixed-size tiles.
+// Level 0 is the original image, every next level is two times smaller.
+// Drawing only touches the tiles under the target rect, so its cost depends on the viewport, not on the image size.
+// Tiles are decoded from the source when they are first needed and are kept in a bounded cache, so the image as a whole
+// is never held in memory. Levels that the source doesn't store are made by downscaling the previous level.
+// All const methods are thread-safe.
+
+class ImagePyramid
+{
+public:
+  struct TileKey
+  {
+    int level;
+    int tx;
+    int ty;
+
+    quint64 toUInt64() const;
+  };
+
+  explicit ImagePyramid(TileSource* source);  // takes ownership
+  ~ImagePyramid();
+
+  bool isEmpty() const    { return levels_.isEmpty(); }
+  QSize size() const      { return isEmpty() ? QSize() : levels_.first().size; }
+  int nLevels() const     { return levels_.size(); }
+  bool hasAlphaChannel() const  { return format_ == QImage::Format_ARGB32_Premultiplied; }
+  int levelForScale(double scale) const;
+  bool needsFiltering(double scale) const;
+
+  // Draws the part of the image scaled by ``scale'' that falls into targetRect (in scaled coordinates).
+  // Decodes missing tiles, so it may take long.
+  void draw(QPainter& painter, const QRect& targetRect, double scale) const;
+
+  // Same, but only uses tiles that are already decoded. Missing tiles are replaced with coarser levels or with
+  // a placeholder. Returns false if anything was missing.
+  bool drawCached(QPainter& painter, const QRect& targetRect, double scale) const;
+
+  // Tiles that drawCached would miss
+  QList<TileKey> missingTiles(const QRect& targetRect, double scale) const;
+
+  // Reads a part of the original image right from the source, bypassing the cache
+  QImage readOriginal(const QRect& rect) const;
+
+  QImage tile(const TileKey& key) const;  // decodes the tile if it's not cached
+  QImage cachedTile(const TileKey& key) const;  // null if not cached
+  QRect originalTileRect(const TileKey& key) const;
+  QRect targetTileRect(const TileKey& key, double scale) const;  // where draw() puts the tile
+
+  // Geometry of a single level, in its own pixels
+  QSize levelSize(int iLevel) const;
+  QRect levelTileRect(const TileKey& key) const;
+  QList<TileKey> tilesInLevelRect(int iLevel, const QRect& levelRect) const;
+
+private:
+  struct Level
+  {
+    QSize size;
+    int nTilesX;
+    int nTilesY;
+
+    QRect tileRect(int tx, int ty) const;
+  };
+
+  QScopedPointer<TileSource> source_;
+  QImage::Format format_;
+  QVector<Level> levels_;
+  mutable QMutex tilesMutex_;
+  mutable QCache<quint64, QImage> tiles_;
+
+  Q_DISABLE_COPY(ImagePyramid)
+
+  QRect tilesCovering(int iLevel, const QRect& targetRect, double levelScale) const;
+  QImage loadTile(const TileKey& key) const;
+  QImage normalized(const QImage& image, QSize expectedSize) const;
+};
+
+#endif // IMAGE_PYRAMID_H
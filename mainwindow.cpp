@@ -1,14 +1,23 @@
+#include <QColorDialog>
+#include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QFontDialog>
+#include <QFutureWatcher>
 #include <QImageReader>
 #include <QLabel>
 #include <QMenu>
 #include <QMessageBox>
+#include <QProgressBar>
 #include <QSettings>
+#include <QSpinBox>
 #include <QTimer>
+#include <QToolButton>
+#include <QtConcurrentRun>
 
 #include "canvaswidget.h"
 #include "mainwindow.h"
+#include "tile_source.h"
 #include "ui_mainwindow.h"
 
 
@@ -41,13 +50,48 @@ MainWindow::MainWindow(QWidget* parent) :
   openFileAction->setMenu(openRecentMenu);
   saveFileAction->setEnabled(false);
 
+  exportOverlayAction = new QAction(QString::fromUtf8("Экспортировать разметку в SVG или PDF..."), this);
+  saveMenu = new QMenu(this);
+  saveMenu->addAction(exportOverlayAction);
+  saveSessionAction       = new QAction(QString::fromUtf8("Сохранить сеанс измерений..."), this);
+  exportSessionTextAction = new QAction(QString::fromUtf8("Экспортировать фигуры в текстовый файл..."), this);
+  saveMenu->addSeparator();
+  saveMenu->addAction(saveSessionAction);
+  saveMenu->addAction(exportSessionTextAction);
+  saveFileAction->setMenu(saveMenu);
+
   toggleEtalonModeAction->setCheckable(true);
   toggleEtalonModeAction->setChecked(true);
 
+  // There are no icons for these yet, so the toolbar shows their names
+  measureRegionAreaAction   = new QAction(QString::fromUtf8("Область одного цвета"), modeActionGroup);
+  toggleEdgeSnappingAction  = new QAction(QString::fromUtf8("Привязка к краям"), this);
+  toggleMagneticLassoAction = new QAction(QString::fromUtf8("Магнитное лассо"),  this);
+  censusAction              = new QAction(QString::fromUtf8("Подсчёт по цвету..."), this);
+  clearCensusAction         = new QAction(QString::fromUtf8("Сбросить подсчёт по цвету"), this);
+  measureRegionAreaAction->setToolTip(QString::fromUtf8("Измерение площадей областей одного цвета: "
+                                                        "щелчок выделяет соседние пиксели, близкие по цвету к указанному"));
+  toggleEdgeSnappingAction->setToolTip(QString::fromUtf8("Ставить вершины на ближайший к курсору край объекта на снимке"));
+  toggleEdgeSnappingAction->setCheckable(true);
+  toggleMagneticLassoAction->setToolTip(QString::fromUtf8("Вести линию вдоль краёв объектов между щелчками"));
+  toggleMagneticLassoAction->setCheckable(true);
+  censusAction->setToolTip(QString::fromUtf8("Площадь всех пикселей снимка, близких по цвету к указанному, с текущим допуском; "
+                                             "каждый следующий цвет добавляется к подсчёту"));
+  censusMenu = new QMenu(this);
+  censusMenu->addAction(clearCensusAction);
+  censusAction->setMenu(censusMenu);
+
   foreach (QAction* action, modeActionGroup->actions())
     action->setCheckable(true);
   measureSegmentLengthAction->setChecked(true);
 
+  fillToleranceSpinBox = new QSpinBox(this);
+  fillToleranceSpinBox->setRange(0, 255);
+  fillToleranceSpinBox->setValue(defaultFillTolerance);
+  fillToleranceSpinBox->setPrefix(QString::fromUtf8("Допуск: "));
+  fillToleranceSpinBox->setToolTip(QString::fromUtf8("Насколько цвет пикселей области может отличаться от указанного, "
+                                                     "по каждому каналу"));
+
   toggleRulerAction->setCheckable(true);
   toggleRulerAction->setChecked(true);
 
@@ -57,6 +101,11 @@ MainWindow::MainWindow(QWidget* parent) :
   ui->mainToolBar->addAction(toggleEtalonModeAction);
   ui->mainToolBar->addSeparator();
   ui->mainToolBar->addActions(modeActionGroup->actions());
+  ui->mainToolBar->addWidget(fillToleranceSpinBox);
+  ui->mainToolBar->addAction(censusAction);
+  ui->mainToolBar->addSeparator();
+  ui->mainToolBar->addAction(toggleEdgeSnappingAction);
+  ui->mainToolBar->addAction(toggleMagneticLassoAction);
   ui->mainToolBar->addSeparator();
   ui->mainToolBar->addAction(toggleRulerAction);
   ui->mainToolBar->addAction(customizeInscriptionFontAction);
@@ -74,12 +123,30 @@ MainWindow::MainWindow(QWidget* parent) :
   ui->statusBar->addPermanentWidget(scaleLabel);
   ui->statusBar->addWidget(statusLabel);
 
+  // Decoders don't report their progress, so the bar only shows that the work is going on
+  openingProgressBar = new QProgressBar(this);
+  openingProgressBar->setRange(0, 0);
+  openingProgressBar->setMaximumWidth(150);
+  cancelOpeningButton = new QToolButton(this);
+  cancelOpeningButton->setIcon(style()->standardIcon(QStyle::SP_DialogCancelButton));
+  cancelOpeningButton->setToolTip(QString::fromUtf8("Отменить открытие файла"));
+  ui->statusBar->addPermanentWidget(openingProgressBar);
+  ui->statusBar->addPermanentWidget(cancelOpeningButton);
+  setOpeningProgressVisible(false);
+
+  openingWatcher = 0;
   canvasWidget = 0;
 
   connect(openFileAction,                 SIGNAL(triggered()), this, SLOT(openFile()));
   connect(saveFileAction,                 SIGNAL(triggered()), this, SLOT(saveFile()));
+  connect(exportOverlayAction,            SIGNAL(triggered()), this, SLOT(exportOverlay()));
+  connect(saveSessionAction,              SIGNAL(triggered()), this, SLOT(saveSession()));
+  connect(exportSessionTextAction,        SIGNAL(triggered()), this, SLOT(exportSessionText()));
   connect(customizeInscriptionFontAction, SIGNAL(triggered()), this, SLOT(customizeInscriptionFont()));
   connect(aboutAction,                    SIGNAL(triggered()), this, SLOT(showAbout()));
+  connect(censusAction,                   SIGNAL(triggered()), this, SLOT(addCensusClass()));
+  connect(clearCensusAction,              SIGNAL(triggered()), this, SLOT(clearCensus()));
+  connect(cancelOpeningButton,            SIGNAL(clicked()),   this, SLOT(cancelOpening()));
 
   connect(toggleEtalonModeAction, SIGNAL(toggled(bool)),       this, SLOT(toggleEtalonDefinition(bool)));
   connect(modeActionGroup,        SIGNAL(triggered(QAction*)), this, SLOT(updateMode(QAction*)));
@@ -154,42 +221,45 @@ QString MainWindow::getImageFormatsFilter() const
   return QString::fromUtf8("Все изображения (%1);;").arg(allFormatsString) + singleFormatsList.join(";;");
 }
 
+// Decodes the file on a worker thread; the current canvas stays usable until the new one replaces it in fileOpened
 void MainWindow::doOpenFile(const QString& filename)
 {
-  recentFiles.removeAll(filename);
-
-  QPixmap image;
-  if (!image.load(filename)) {
-    QMessageBox::warning(this, appName(), QString::fromUtf8("Не могу открыть изображение «%1».").arg(filename));
-    updateOpenRecentMenu();
+  if (QFileInfo(filename).suffix().toLower() == sessionFileSuffix) {
+    doOpenSession(filename);
     return;
   }
+  cancelOpening();
+  openingFile = filename;
+  openingWatcher = new QFutureWatcher<TileSource*>(this);
+  connect(openingWatcher, SIGNAL(finished()), this, SLOT(fileOpened()));
+  openingWatcher->setFuture(QtConcurrent::run(openTileSource, filename));
+  ui->statusBar->showMessage(QString::fromUtf8("Открываю «%1»...").arg(filename));
+  setOpeningProgressVisible(true);
+}
 
-  openedFile = filename;
-  recentFiles.prepend(filename);
-  if (recentFiles.size() > maxRecentDocuments)
-    recentFiles.erase(recentFiles.begin() + maxRecentDocuments, recentFiles.end());
-  updateOpenRecentMenu();
-
-  toggleEtalonModeAction->setChecked(true);
-  measureSegmentLengthAction->setChecked(true);
-
-  delete canvasWidget;
-  canvasWidget = new CanvasWidget(image, this, ui->containingScrollArea, scaleLabel, statusLabel, this);
-  ui->containingScrollArea->setWidget(canvasWidget);
-
-  connect(toggleRulerAction, SIGNAL(toggled(bool)), canvasWidget, SLOT(toggleRuler(bool)));
-  canvasWidget->toggleRuler(toggleRulerAction->isChecked());
+// Opens the image of the session; figures are restored in fileOpened
+void MainWindow::doOpenSession(const QString& filename)
+{
+  Session session;
+  if (!loadSession(filename, session)) {
+    QMessageBox::warning(this, appName(), QString::fromUtf8("Не могу прочитать сеанс измерений «%1».").arg(filename));
+    return;
+  }
+  doOpenFile(QFileInfo(filename).dir().absoluteFilePath(session.imageFilename));
+  openingSessionFile = filename;
+  openingSession = session;
+}
 
-  saveFileAction->setEnabled(true);
-  saveSettings();
-  setDrawOptionsEnabled(true);
+void MainWindow::setOpeningProgressVisible(bool visible)
+{
+  openingProgressBar->setVisible(visible);
+  cancelOpeningButton->setVisible(visible);
 }
 
 void MainWindow::doSaveFile(const QString& filename)
 {
   ASSERT_RETURN(canvasWidget);
-  bool ok = canvasWidget->getModifiedImage().save(filename);
+  bool ok = canvasWidget->saveModifiedImage(filename);
   if (ok)
     ui->statusBar->showMessage(QString::fromUtf8("Файл успешно сохранён"), 5000);
   else
@@ -243,8 +313,9 @@ void MainWindow::updateOpenRecentMenu()
 
 void MainWindow::openFile()
 {
+  QString sessionFilter = QString::fromUtf8("Сеансы измерений (*.%1)").arg(sessionFileSuffix);
   QString filename = QFileDialog::getOpenFileName(this, QString::fromUtf8("Открыть изображение — ") + appName(),
-                                                  QString(), getImageFormatsFilter(), 0);
+                                                  QString(), getImageFormatsFilter() + ";;" + sessionFilter, 0);
   if (!filename.isEmpty())
     doOpenFile(filename);
 }
@@ -256,6 +327,78 @@ void MainWindow::openRecentFile()
   doOpenFile(triggeredAction->text());
 }
 
+void MainWindow::fileOpened()
+{
+  QFutureWatcher<TileSource*>* watcher = static_cast<QFutureWatcher<TileSource*>*>(sender());
+  TileSource* imageSource = watcher->result();
+  watcher->deleteLater();
+  if (watcher != openingWatcher) {  // cancelled or replaced with another file
+    delete imageSource;
+    return;
+  }
+  QString filename = openingFile;
+  QString sessionFilename = openingSessionFile;
+  openingWatcher = 0;
+  openingFile.clear();
+  openingSessionFile.clear();
+  ui->statusBar->clearMessage();
+  setOpeningProgressVisible(false);
+
+  QString recentFilename = sessionFilename.isEmpty() ? filename : sessionFilename;
+  recentFiles.removeAll(recentFilename);
+  if (!imageSource) {
+    QMessageBox::warning(this, appName(), QString::fromUtf8("Не могу открыть изображение «%1».").arg(filename));
+    updateOpenRecentMenu();
+    return;
+  }
+
+  openedFile = filename;
+  recentFiles.prepend(recentFilename);
+  if (recentFiles.size() > maxRecentDocuments)
+    recentFiles.erase(recentFiles.begin() + maxRecentDocuments, recentFiles.end());
+  updateOpenRecentMenu();
+
+  toggleEtalonModeAction->setChecked(true);
+  measureSegmentLengthAction->setChecked(true);
+
+  delete canvasWidget;
+  canvasWidget = new CanvasWidget(imageSource, this, ui->containingScrollArea, scaleLabel, statusLabel, this);
+  ui->containingScrollArea->setWidget(canvasWidget);
+
+  connect(toggleRulerAction, SIGNAL(toggled(bool)), canvasWidget, SLOT(toggleRuler(bool)));
+  canvasWidget->toggleRuler(toggleRulerAction->isChecked());
+  connect(toggleEdgeSnappingAction, SIGNAL(toggled(bool)), canvasWidget, SLOT(toggleEdgeSnapping(bool)));
+  canvasWidget->toggleEdgeSnapping(toggleEdgeSnappingAction->isChecked());
+  connect(toggleMagneticLassoAction, SIGNAL(toggled(bool)), canvasWidget, SLOT(toggleMagneticLasso(bool)));
+  canvasWidget->toggleMagneticLasso(toggleMagneticLassoAction->isChecked());
+  connect(fillToleranceSpinBox, SIGNAL(valueChanged(int)), canvasWidget, SLOT(setFillTolerance(int)));
+  canvasWidget->setFillTolerance(fillToleranceSpinBox->value());
+
+  saveFileAction->setEnabled(true);
+  saveSettings();
+  setDrawOptionsEnabled(true);
+
+  if (!sessionFilename.isEmpty()) {
+    if (getImageFingerprint(filename) != openingSession.imageFingerprint)
+      QMessageBox::warning(this, appName(), QString::fromUtf8("Изображение «%1» изменилось после сохранения сеанса, "
+                                                              "фигуры могут не совпадать с ним.").arg(filename));
+    canvasWidget->restoreSession(openingSession);
+    openingSession = Session();
+  }
+}
+
+// The decoding itself can't be interrupted, its result is simply dropped when it's ready
+void MainWindow::cancelOpening()
+{
+  if (!openingWatcher)
+    return;
+  openingWatcher = 0;
+  openingFile.clear();
+  openingSessionFile.clear();
+  ui->statusBar->clearMessage();
+  setOpeningProgressVisible(false);
+}
+
 void MainWindow::saveFile()
 {
   QString filename = QFileDialog::getSaveFileName(this, QString::fromUtf8("Сохранить изображение — ") + appName(),
@@ -264,11 +407,80 @@ void MainWindow::saveFile()
     doSaveFile(filename);
 }
 
+// Figures without the image: file size depends on the number of figures, not on the image size
+void MainWindow::exportOverlay()
+{
+  ASSERT_RETURN(canvasWidget);
+  const QString svgWithImageFilter = QString::fromUtf8("Разметка SVG со ссылкой на изображение (*.svg)");
+  const QString svgFilter          = QString::fromUtf8("Разметка SVG (*.svg)");
+  const QString pdfFilter          = QString::fromUtf8("Разметка PDF (*.pdf)");
+  QString selectedFilter;
+  QFileInfo imageInfo(openedFile);
+  QString filename = QFileDialog::getSaveFileName(this, QString::fromUtf8("Экспортировать разметку — ") + appName(),
+                                                  imageInfo.absolutePath() + "/" + imageInfo.completeBaseName() + ".svg",
+                                                  (QStringList() << svgWithImageFilter << svgFilter << pdfFilter).join(";;"),
+                                                  &selectedFilter);
+  if (filename.isEmpty())
+    return;
+  QString linkedImageFilename = (selectedFilter == svgWithImageFilter) ? openedFile : QString();
+  if (canvasWidget->exportOverlay(filename, linkedImageFilename))
+    ui->statusBar->showMessage(QString::fromUtf8("Разметка успешно экспортирована"), 5000);
+  else
+    QMessageBox::warning(this, appName(), QString::fromUtf8("Не удалось записать файл «%1»!").arg(filename));
+}
+
+void MainWindow::saveSession()
+{
+  ASSERT_RETURN(canvasWidget);
+  QFileInfo imageInfo(openedFile);
+  QString filename = QFileDialog::getSaveFileName(this, QString::fromUtf8("Сохранить сеанс измерений — ") + appName(),
+                                                  imageInfo.absolutePath() + "/" + imageInfo.completeBaseName() + "." + sessionFileSuffix,
+                                                  QString::fromUtf8("Сеансы измерений (*.%1)").arg(sessionFileSuffix), 0);
+  if (filename.isEmpty())
+    return;
+  Session session = canvasWidget->session();
+  session.imageFilename = QFileInfo(filename).dir().relativeFilePath(openedFile);  // survives moving both files together
+  session.imageFingerprint = getImageFingerprint(openedFile);
+  if (::saveSession(filename, session)) {
+    ui->statusBar->showMessage(QString::fromUtf8("Сеанс успешно сохранён"), 5000);
+    recentFiles.removeAll(filename);
+    recentFiles.prepend(filename);
+    if (recentFiles.size() > maxRecentDocuments)
+      recentFiles.erase(recentFiles.begin() + maxRecentDocuments, recentFiles.end());
+    updateOpenRecentMenu();
+  }
+  else {
+    QMessageBox::warning(this, appName(), QString::fromUtf8("Не удалось записать файл «%1»!").arg(filename));
+  }
+}
+
+// Text for other tools, e.g. AreaMeasurementBatch
+void MainWindow::exportSessionText()
+{
+  ASSERT_RETURN(canvasWidget);
+  QFileInfo imageInfo(openedFile);
+  QString filename = QFileDialog::getSaveFileName(this, QString::fromUtf8("Экспортировать фигуры — ") + appName(),
+                                                  imageInfo.absolutePath() + "/" + imageInfo.completeBaseName() + ".txt",
+                                                  QString::fromUtf8("Текстовые файлы (*.txt)"), 0);
+  if (filename.isEmpty())
+    return;
+  Session session = canvasWidget->session();
+  session.imageFilename = openedFile;
+  if (::exportSessionText(filename, session))
+    ui->statusBar->showMessage(QString::fromUtf8("Фигуры успешно экспортированы"), 5000);
+  else
+    QMessageBox::warning(this, appName(), QString::fromUtf8("Не удалось записать файл «%1»!").arg(filename));
+}
+
 void MainWindow::setDrawOptionsEnabled(bool enabled)
 {
   toggleEtalonModeAction->setEnabled(enabled);
   modeActionGroup       ->setEnabled(enabled);
   toggleRulerAction     ->setEnabled(enabled);
+  toggleEdgeSnappingAction ->setEnabled(enabled);
+  toggleMagneticLassoAction->setEnabled(enabled);
+  fillToleranceSpinBox     ->setEnabled(enabled);
+  censusAction             ->setEnabled(enabled);
 }
 
 void MainWindow::updateMode(QAction* modeAction)
@@ -283,6 +495,8 @@ void MainWindow::updateMode(QAction* modeAction)
     return setMode(RECTANGLE);
   if (modeAction == measurePolygonAreaAction)
     return setMode(POLYGON);
+  if (modeAction == measureRegionAreaAction)
+    return setMode(REGION);
   ERROR_RETURN();
 }
 
@@ -293,12 +507,30 @@ void MainWindow::toggleEtalonDefinition(bool isDefiningEtalon)
   toggleEtalonModeAction->setChecked(isDefiningEtalon);
 }
 
+// The colour of the latest flood fill is offered first, so that a clicked region can be counted over the whole image
+void MainWindow::addCensusClass()
+{
+  if (!canvasWidget)
+    return;
+  QColor initialColor = canvasWidget->regionSeedColor();
+  QColor color = QColorDialog::getColor(initialColor.isValid() ? initialColor : Qt::white, this,
+                                        QString::fromUtf8("Цвет для подсчёта"));
+  if (color.isValid())
+    canvasWidget->addCensusClass(color);
+}
+
+void MainWindow::clearCensus()
+{
+  if (canvasWidget)
+    canvasWidget->clearCensus();
+}
+
 void MainWindow::customizeInscriptionFont()
 {
   // TODO: Why does the dialog show wrong font for the first time?
   inscriptionFont = QFontDialog::getFont(0, inscriptionFont, this);
   if (canvasWidget)
-    canvasWidget->update();
+    canvasWidget->setInscriptionFont(inscriptionFont);
 }
 
 void MainWindow::showAbout()
@@ -4,11 +4,17 @@
 #include <QMainWindow>
 
 #include "defines.h"
+#include "session.h"
 
 namespace Ui { class MainWindow; }
 class CanvasWidget;
 class QActionGroup;
 class QLabel;
+class QProgressBar;
+class QSpinBox;
+class QToolButton;
+class TileSource;
+template<typename T> class QFutureWatcher;
 
 class MainWindow : public QMainWindow
 {
@@ -31,31 +37,50 @@ public slots:
 
 private:
   QString openedFile;
+  QString openingFile;
+  QFutureWatcher<TileSource*>* openingWatcher;  // 0 if no file is being opened
+  QString openingSessionFile;  // empty if the file being opened is a plain image
+  Session openingSession;      // restored when its image is opened
   QStringList recentFiles;
   QFont inscriptionFont;
 
   Ui::MainWindow* ui;
 
   QMenu* openRecentMenu;
+  QMenu* saveMenu;
+  QMenu* censusMenu;
   QLabel* scaleLabel;
   QLabel* statusLabel;
+  QProgressBar* openingProgressBar;
+  QToolButton* cancelOpeningButton;
   CanvasWidget* canvasWidget;
 
   QActionGroup* modeActionGroup;
   QAction* openFileAction;
   QAction* saveFileAction;
+  QAction* exportOverlayAction;
+  QAction* saveSessionAction;
+  QAction* exportSessionTextAction;
   QAction* toggleEtalonModeAction;
   QAction* measureSegmentLengthAction;
   QAction* measurePolylineLengthAction;
   QAction* measureClosedPolylineLengthAction;
   QAction* measureRectangleAreaAction;
   QAction* measurePolygonAreaAction;
+  QAction* measureRegionAreaAction;
+  QAction* toggleEdgeSnappingAction;
+  QAction* toggleMagneticLassoAction;
+  QAction* censusAction;
+  QAction* clearCensusAction;
   QAction* toggleRulerAction;
   QAction* customizeInscriptionFontAction;
   QAction* aboutAction;
+  QSpinBox* fillToleranceSpinBox;
 
   QString getImageFormatsFilter() const;
   void doOpenFile(const QString& filename);
+  void doOpenSession(const QString& filename);
+  void setOpeningProgressVisible(bool visible);
   void doSaveFile(const QString& filename);
   void loadSettings();
   void loadAndApplySettings();
@@ -65,9 +90,16 @@ private:
 private slots:
   void openFile();
   void openRecentFile();
+  void fileOpened();
+  void cancelOpening();
   void saveFile();
+  void exportOverlay();
+  void saveSession();
+  void exportSessionText();
   void setDrawOptionsEnabled(bool enabled);
   void updateMode(QAction* modeAction);
+  void addCensusClass();
+  void clearCensus();
   void customizeInscriptionFont();
   void showAbout();
 };
@@ -0,0 +1,279 @@
+#include <cmath>
+
+#if defined(__AVX__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#include "debug_utils.h"
+#include "measure_kernels.h"
+
+
+const int blockSize = 512;  // vertices; two coordinate arrays of this size take 8 KB
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Accumulation
+
+namespace {
+
+// Sums over edges in coordinates relative to the origin
+struct Accumulator
+{
+  double length;
+  double cross;      // doubled signed area
+  double centroidX;  // sum of (x0 + x1) * cross
+  double centroidY;
+  double sumX;
+  double sumY;
+  double minX;
+  double minY;
+  double maxX;
+  double maxY;
+  int nVertices;
+
+  Accumulator();
+  void addVertex(double x, double y);
+  void addEdge(double x0, double y0, double x1, double y1);  // doesn't add the vertices
+};
+
+Accumulator::Accumulator() :
+  length(0.), cross(0.), centroidX(0.), centroidY(0.), sumX(0.), sumY(0.),
+  minX(0.), minY(0.), maxX(0.), maxY(0.),  // the origin is the first vertex, so it's always inside
+  nVertices(0)
+{
+}
+
+inline void Accumulator::addVertex(double x, double y)
+{
+  sumX += x;
+  sumY += y;
+  minX = qMin(minX, x);
+  minY = qMin(minY, y);
+  maxX = qMax(maxX, x);
+  maxY = qMax(maxY, y);
+  nVertices++;
+}
+
+inline void Accumulator::addEdge(double x0, double y0, double x1, double y1)
+{
+  double dx = x1 - x0;
+  double dy = y1 - y0;
+  double edgeCross = x0 * y1 - x1 * y0;
+  length += std::sqrt(dx * dx + dy * dy);
+  cross += edgeCross;
+  centroidX += (x0 + x1) * edgeCross;
+  centroidY += (y0 + y1) * edgeCross;
+}
+
+} // namespace
+
+
+// Adds edges i -> i + 1 for i < nEdges and their first vertices. Reads nEdges + 1 vertices.
+static void accumulateEdgesScalar(const double* xs, const double* ys, int nEdges, double originX, double originY,
+                                  Accumulator& accumulator)
+{
+  for (int i = 0; i < nEdges; ++i) {
+    double x0 = xs[i]     - originX;
+    double y0 = ys[i]     - originY;
+    double x1 = xs[i + 1] - originX;
+    double y1 = ys[i + 1] - originY;
+    accumulator.addVertex(x0, y0);
+    accumulator.addEdge(x0, y0, x1, y1);
+  }
+}
+
+#if defined(__AVX__)
+
+static inline double horizontalSum(__m256d v)
+{
+  __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+static inline double horizontalMin(__m256d v)
+{
+  __m128d result = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_min_sd(result, _mm_unpackhi_pd(result, result)));
+}
+
+static inline double horizontalMax(__m256d v)
+{
+  __m128d result = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_max_sd(result, _mm_unpackhi_pd(result, result)));
+}
+
+static void accumulateEdges(const double* xs, const double* ys, int nEdges, double originX, double originY,
+                            Accumulator& accumulator)
+{
+  const int nLanes = 4;
+  const __m256d ox = _mm256_set1_pd(originX);
+  const __m256d oy = _mm256_set1_pd(originY);
+  __m256d length    = _mm256_setzero_pd();
+  __m256d cross     = _mm256_setzero_pd();
+  __m256d centroidX = _mm256_setzero_pd();
+  __m256d centroidY = _mm256_setzero_pd();
+  __m256d sumX      = _mm256_setzero_pd();
+  __m256d sumY      = _mm256_setzero_pd();
+  __m256d minX      = _mm256_setzero_pd();
+  __m256d minY      = _mm256_setzero_pd();
+  __m256d maxX      = _mm256_setzero_pd();
+  __m256d maxY      = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + nLanes <= nEdges; i += nLanes) {
+    __m256d x0 = _mm256_sub_pd(_mm256_loadu_pd(xs + i),     ox);
+    __m256d y0 = _mm256_sub_pd(_mm256_loadu_pd(ys + i),     oy);
+    __m256d x1 = _mm256_sub_pd(_mm256_loadu_pd(xs + i + 1), ox);
+    __m256d y1 = _mm256_sub_pd(_mm256_loadu_pd(ys + i + 1), oy);
+    __m256d dx = _mm256_sub_pd(x1, x0);
+    __m256d dy = _mm256_sub_pd(y1, y0);
+    __m256d edgeCross = _mm256_sub_pd(_mm256_mul_pd(x0, y1), _mm256_mul_pd(x1, y0));
+    length    = _mm256_add_pd(length, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy))));
+    cross     = _mm256_add_pd(cross, edgeCross);
+    centroidX = _mm256_add_pd(centroidX, _mm256_mul_pd(_mm256_add_pd(x0, x1), edgeCross));
+    centroidY = _mm256_add_pd(centroidY, _mm256_mul_pd(_mm256_add_pd(y0, y1), edgeCross));
+    sumX      = _mm256_add_pd(sumX, x0);
+    sumY      = _mm256_add_pd(sumY, y0);
+    minX      = _mm256_min_pd(minX, x0);
+    minY      = _mm256_min_pd(minY, y0);
+    maxX      = _mm256_max_pd(maxX, x0);
+    maxY      = _mm256_max_pd(maxY, y0);
+  }
+  accumulator.length    += horizontalSum(length);
+  accumulator.cross     += horizontalSum(cross);
+  accumulator.centroidX += horizontalSum(centroidX);
+  accumulator.centroidY += horizontalSum(centroidY);
+  accumulator.sumX      += horizontalSum(sumX);
+  accumulator.sumY      += horizontalSum(sumY);
+  accumulator.minX       = qMin(accumulator.minX, horizontalMin(minX));
+  accumulator.minY       = qMin(accumulator.minY, horizontalMin(minY));
+  accumulator.maxX       = qMax(accumulator.maxX, horizontalMax(maxX));
+  accumulator.maxY       = qMax(accumulator.maxY, horizontalMax(maxY));
+  accumulator.nVertices += i;
+  accumulateEdgesScalar(xs + i, ys + i, nEdges - i, originX, originY, accumulator);
+}
+
+#elif defined(__SSE2__)
+
+static inline double horizontalSum(__m128d v)  { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+static inline double horizontalMin(__m128d v)  { return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v))); }
+static inline double horizontalMax(__m128d v)  { return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v))); }
+
+static void accumulateEdges(const double* xs, const double* ys, int nEdges, double originX, double originY,
+                            Accumulator& accumulator)
+{
+  const int nLanes = 2;
+  const __m128d ox = _mm_set1_pd(originX);
+  const __m128d oy = _mm_set1_pd(originY);
+  __m128d length    = _mm_setzero_pd();
+  __m128d cross     = _mm_setzero_pd();
+  __m128d centroidX = _mm_setzero_pd();
+  __m128d centroidY = _mm_setzero_pd();
+  __m128d sumX      = _mm_setzero_pd();
+  __m128d sumY      = _mm_setzero_pd();
+  __m128d minX      = _mm_setzero_pd();
+  __m128d minY      = _mm_setzero_pd();
+  __m128d maxX      = _mm_setzero_pd();
+  __m128d maxY      = _mm_setzero_pd();
+  int i = 0;
+  for (; i + nLanes <= nEdges; i += nLanes) {
+    __m128d x0 = _mm_sub_pd(_mm_loadu_pd(xs + i),     ox);
+    __m128d y0 = _mm_sub_pd(_mm_loadu_pd(ys + i),     oy);
+    __m128d x1 = _mm_sub_pd(_mm_loadu_pd(xs + i + 1), ox);
+    __m128d y1 = _mm_sub_pd(_mm_loadu_pd(ys + i + 1), oy);
+    __m128d dx = _mm_sub_pd(x1, x0);
+    __m128d dy = _mm_sub_pd(y1, y0);
+    __m128d edgeCross = _mm_sub_pd(_mm_mul_pd(x0, y1), _mm_mul_pd(x1, y0));
+    length    = _mm_add_pd(length, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy))));
+    cross     = _mm_add_pd(cross, edgeCross);
+    centroidX = _mm_add_pd(centroidX, _mm_mul_pd(_mm_add_pd(x0, x1), edgeCross));
+    centroidY = _mm_add_pd(centroidY, _mm_mul_pd(_mm_add_pd(y0, y1), edgeCross));
+    sumX      = _mm_add_pd(sumX, x0);
+    sumY      = _mm_add_pd(sumY, y0);
+    minX      = _mm_min_pd(minX, x0);
+    minY      = _mm_min_pd(minY, y0);
+    maxX      = _mm_max_pd(maxX, x0);
+    maxY      = _mm_max_pd(maxY, y0);
+  }
+  accumulator.length    += horizontalSum(length);
+  accumulator.cross     += horizontalSum(cross);
+  accumulator.centroidX += horizontalSum(centroidX);
+  accumulator.centroidY += horizontalSum(centroidY);
+  accumulator.sumX      += horizontalSum(sumX);
+  accumulator.sumY      += horizontalSum(sumY);
+  accumulator.minX       = qMin(accumulator.minX, horizontalMin(minX));
+  accumulator.minY       = qMin(accumulator.minY, horizontalMin(minY));
+  accumulator.maxX       = qMax(accumulator.maxX, horizontalMax(maxX));
+  accumulator.maxY       = qMax(accumulator.maxY, horizontalMax(maxY));
+  accumulator.nVertices += i;
+  accumulateEdgesScalar(xs + i, ys + i, nEdges - i, originX, originY, accumulator);
+}
+
+#else
+
+static void accumulateEdges(const double* xs, const double* ys, int nEdges, double originX, double originY,
+                            Accumulator& accumulator)
+{
+  accumulateEdgesScalar(xs, ys, nEdges, originX, originY, accumulator);
+}
+
+#endif
+
+// Adds the last vertex and the closing edge, and converts sums to the result
+static ChainMeasurements finish(Accumulator& accumulator, double originX, double originY,
+                                double lastX, double lastY, bool isClosed)
+{
+  double x = lastX - originX;
+  double y = lastY - originY;
+  accumulator.addVertex(x, y);
+  if (isClosed)
+    accumulator.addEdge(x, y, 0., 0.);
+
+  ChainMeasurements result;
+  result.length = accumulator.length;
+  result.signedArea = isClosed ? accumulator.cross / 2. : 0.;
+  if (result.signedArea != 0.)
+    result.centroid = QPointF(originX + accumulator.centroidX / (3. * accumulator.cross),
+                              originY + accumulator.centroidY / (3. * accumulator.cross));
+  else
+    result.centroid = QPointF(originX + accumulator.sumX / accumulator.nVertices,
+                              originY + accumulator.sumY / accumulator.nVertices);
+  result.boundingRect = QRectF(QPointF(originX + accumulator.minX, originY + accumulator.minY),
+                               QPointF(originX + accumulator.maxX, originY + accumulator.maxY));
+  return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels
+
+ChainMeasurements measureChain(const double* xs, const double* ys, int nVertices, bool isClosed)
+{
+  ASSERT_RETURN_V(nVertices > 0, ChainMeasurements());
+  Accumulator accumulator;
+  accumulateEdges(xs, ys, nVertices - 1, xs[0], ys[0], accumulator);
+  return finish(accumulator, xs[0], ys[0], xs[nVertices - 1], ys[nVertices - 1], isClosed);
+}
+
+ChainMeasurements measureChain(const QPolygonF& vertices, bool isClosed)
+{
+  ASSERT_RETURN_V(!vertices.isEmpty(), ChainMeasurements());
+  const QPointF* points = vertices.constData();
+  const int nVertices = vertices.size();
+  const double originX = points[0].x();
+  const double originY = points[0].y();
+  // Neighbouring blocks share a vertex: the last vertex of a block starts the first edge of the next one
+  double xs[blockSize + 1];
+  double ys[blockSize + 1];
+  Accumulator accumulator;
+  for (int iFirst = 0; iFirst < nVertices - 1; iFirst += blockSize) {
+    int nEdges = qMin(blockSize, nVertices - 1 - iFirst);
+    for (int i = 0; i <= nEdges; ++i) {
+      xs[i] = points[iFirst + i].x();
+      ys[i] = points[iFirst + i].y();
+    }
+    accumulateEdges(xs, ys, nEdges, originX, originY, accumulator);
+  }
+  return finish(accumulator, originX, originY, points[nVertices - 1].x(), points[nVertices - 1].y(), isClosed);
+}
@@ -0,0 +1,27 @@
+#ifndef MEASURE_KERNELS_H
+#define MEASURE_KERNELS_H
+
+#include <QPolygonF>
+#include <QRectF>
+
+// One pass over the vertices of a polyline or polygon that computes everything a shape can be measured by.
+// Coordinates are processed as structure of arrays, so that SIMD lanes take consecutive vertices without shuffling.
+// SSE2 (2 vertices per step) is used on every x86-64 build, AVX (4 vertices per step) when the compiler targets it,
+// other platforms get the scalar loop. Results of different paths differ only in rounding.
+// Everything is computed relative to the first vertex, so that far-away shapes don't lose precision.
+
+struct ChainMeasurements
+{
+  double length;        // sum of edge lengths
+  double signedArea;    // shoelace formula; 0 for an open chain
+  QPointF centroid;     // of the area, or the mean vertex if there is no area
+  QRectF boundingRect;
+};
+
+// Edges go from every vertex to the next one and, if isClosed, from the last vertex back to the first one.
+ChainMeasurements measureChain(const double* xs, const double* ys, int nVertices, bool isClosed);
+
+// Same for interleaved vertices; they are split into coordinate arrays block by block, in a buffer that stays in L1 cache
+ChainMeasurements measureChain(const QPolygonF& vertices, bool isClosed);
+
+#endif // MEASURE_KERNELS_H
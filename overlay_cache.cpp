@@ -0,0 +1,63 @@
+#include <cmath>
+
+#include "overlay_cache.h"
+
+
+const int overlayTileSize = 256;
+const int maxOverlayCacheKBytes = 128 * 1024;
+
+static inline quint64 makeTileKey(int tx, int ty)
+{
+  return (quint64(quint32(tx)) << 32) | quint32(ty);
+}
+
+static inline int tileCoordinate(int x)
+{
+  return int(std::floor(double(x) / overlayTileSize));
+}
+
+
+OverlayCache::OverlayCache() :
+  tiles_(maxOverlayCacheKBytes)
+{
+}
+
+
+void OverlayCache::clear()
+{
+  tiles_.clear();
+}
+
+void OverlayCache::invalidate(const QRect& rect)
+{
+  if (rect.isEmpty())
+    return;
+  QRect tiles = tilesCovering(rect);
+  for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty)
+    for (int tx = tiles.left(); tx <= tiles.right(); ++tx)
+      tiles_.remove(makeTileKey(tx, ty));
+}
+
+
+QRect OverlayCache::tilesCovering(const QRect& rect) const
+{
+  if (rect.isEmpty())
+    return QRect();
+  return QRect(QPoint(tileCoordinate(rect.left()),  tileCoordinate(rect.top())),
+               QPoint(tileCoordinate(rect.right()), tileCoordinate(rect.bottom())));
+}
+
+QRect OverlayCache::tileRect(int tx, int ty) const
+{
+  return QRect(tx * overlayTileSize, ty * overlayTileSize, overlayTileSize, overlayTileSize);
+}
+
+const QImage* OverlayCache::tile(int tx, int ty) const
+{
+  return tiles_.object(makeTileKey(tx, ty));
+}
+
+void OverlayCache::insert(int tx, int ty, const QImage& image)
+{
+  tiles_.insert(makeTileKey(tx, ty), new QImage(image), qMax(1, image.byteCount() / 1024));
+}
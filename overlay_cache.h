@@ -0,0 +1,29 @@
+#ifndef OVERLAY_CACHE_H
+#define OVERLAY_CACHE_H
+
+#include <QCache>
+#include <QImage>
+#include <QRect>
+
+// Transparent tiles with figures that don't change from frame to frame, in widget coordinates of the current scale.
+// Tiles are rendered by the owner on demand and are dropped when something under them changes.
+// Memory use is bounded: least recently used tiles are evicted and will be rendered again when needed.
+
+class OverlayCache
+{
+public:
+  OverlayCache();
+
+  void clear();
+  void invalidate(const QRect& rect);
+
+  QRect tilesCovering(const QRect& rect) const;  // in tile coordinates
+  QRect tileRect(int tx, int ty) const;
+  const QImage* tile(int tx, int ty) const;      // 0 if not cached
+  void insert(int tx, int ty, const QImage& image);
+
+private:
+  mutable QCache<quint64, QImage> tiles_;
+};
+
+#endif // OVERLAY_CACHE_H
@@ -0,0 +1,103 @@
+#include <algorithm>
+
+#include "debug_utils.h"
+#include "perf_stats.h"
+
+
+const int maxTimingSamples = 256;
+
+static const char* pathName(PerfStats::Path path)
+{
+  switch (path) {
+    case PerfStats::SCALE_CHANGED: return "scaleChanged";
+    case PerfStats::PAINT_EVENT:   return "paintEvent";
+    case PerfStats::UPDATE_HOVER:  return "updateHover";
+    case PerfStats::UPDATE_STATUS: return "updateStatus";
+    case PerfStats::N_PATHS:       break;
+  }
+  ERROR_RETURN_V("");
+}
+
+static QString formatMilliseconds(qint64 nsecs)
+{
+  return QString::number(nsecs / 1e6, 'f', 3);
+}
+
+
+PerfStats::PerfStats() :
+  isEnabled_(false)
+{
+  reset();
+}
+
+void PerfStats::setEnabled(bool enabled)
+{
+  if (enabled && !isEnabled_)
+    reset();  // old numbers are stale
+  isEnabled_ = enabled;
+}
+
+
+void PerfStats::addTiming(Path path, qint64 nsecs)
+{
+  ASSERT_RETURN(path >= 0 && path < N_PATHS);
+  Timings& timings = timings_[path];
+  timings.samples[timings.iNextSample] = nsecs;
+  timings.iNextSample = (timings.iNextSample + 1) % maxTimingSamples;
+  timings.nSamples = qMin(timings.nSamples + 1, maxTimingSamples);
+  timings.nCalls++;
+}
+
+void PerfStats::finishFrame()
+{
+  if (!isEnabled_)
+    return;
+  for (int i = 0; i < N_COUNTERS; ++i) {
+    lastFrame_[i] = currentFrame_[i];
+    currentFrame_[i] = 0;
+  }
+}
+
+
+QStringList PerfStats::report() const
+{
+  QStringList result;
+  for (int i = 0; i < N_PATHS; ++i) {
+    Path path = Path(i);
+    result.append(QString("%1: p50 %2 ms, p99 %3 ms, %4 calls").arg(pathName(path))
+                  .arg(formatMilliseconds(percentile(path, 0.50))).arg(formatMilliseconds(percentile(path, 0.99)))
+                  .arg(timings_[i].nCalls));
+  }
+  result.append(QString("last frame: %1 figures drawn, %2 culled (not counting cached overlay tiles)")
+                .arg(lastFrame_[FIGURES_DRAWN]).arg(lastFrame_[FIGURES_CULLED]));
+  result.append(QString("last frame: %1 geometry recomputations, %2 scaled")
+                .arg(lastFrame_[GEOMETRY_RECOMPUTED]).arg(lastFrame_[SCALED_GEOMETRY_RECOMPUTED]));
+  return result;
+}
+
+
+void PerfStats::reset()
+{
+  for (int i = 0; i < N_PATHS; ++i) {
+    timings_[i].samples.fill(0, maxTimingSamples);
+    timings_[i].iNextSample = 0;
+    timings_[i].nSamples = 0;
+    timings_[i].nCalls = 0;
+  }
+  for (int i = 0; i < N_COUNTERS; ++i) {
+    currentFrame_[i] = 0;
+    lastFrame_[i] = 0;
+  }
+}
+
+// Over the recent samples; 0 if there are none
+qint64 PerfStats::percentile(Path path, double fraction) const
+{
+  const Timings& timings = timings_[path];
+  if (timings.nSamples == 0)
+    return 0;
+  QVector<qint64> samples = timings.samples.mid(0, timings.nSamples);
+  int iResult = qMin(int(fraction * samples.size()), samples.size() - 1);
+  std::nth_element(samples.begin(), samples.begin() + iResult, samples.end());
+  return samples[iResult];
+}
@@ -0,0 +1,87 @@
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+
+// Timings and counters of the canvas hot paths, for the performance overlay.
+// While disabled nothing is recorded, every probe costs a single branch.
+
+class PerfStats
+{
+public:
+  enum Path
+  {
+    SCALE_CHANGED,
+    PAINT_EVENT,
+    UPDATE_HOVER,
+    UPDATE_STATUS,
+
+    N_PATHS
+  };
+
+  enum Counter
+  {
+    FIGURES_DRAWN,
+    FIGURES_CULLED,
+    GEOMETRY_RECOMPUTED,         // original polygon, vertices and size of a figure
+    SCALED_GEOMETRY_RECOMPUTED,  // screen polygon of a figure
+
+    N_COUNTERS
+  };
+
+  PerfStats();
+
+  bool isEnabled() const  { return isEnabled_; }
+  void setEnabled(bool enabled);
+
+  void addTiming(Path path, qint64 nsecs);
+  void count(Counter counter)  { if (isEnabled_) currentFrame_[counter]++; }
+  void finishFrame();  // called after each repaint; counters of the finished frame are reported until the next one
+
+  QStringList report() const;
+
+private:
+  struct Timings
+  {
+    QVector<qint64> samples;  // ring buffer of the recent calls
+    int iNextSample;
+    int nSamples;
+    qint64 nCalls;
+  };
+
+  bool isEnabled_;
+  Timings timings_[N_PATHS];
+  int currentFrame_[N_COUNTERS];
+  int lastFrame_[N_COUNTERS];
+
+  void reset();
+  qint64 percentile(Path path, double fraction) const;
+};
+
+// Adds the time between construction and destruction to the path timings, unless isRecorded is false
+class ScopedPerfTimer
+{
+public:
+  ScopedPerfTimer(PerfStats& stats, PerfStats::Path path, bool isRecorded = true) :
+    stats_(isRecorded && stats.isEnabled() ? &stats : 0), path_(path)
+  {
+    if (stats_)
+      timer_.start();
+  }
+  ~ScopedPerfTimer()
+  {
+    if (stats_)
+      stats_->addTiming(path_, timer_.nsecsElapsed());
+  }
+
+private:
+  PerfStats* stats_;  // 0 if disabled
+  PerfStats::Path path_;
+  QElapsedTimer timer_;
+
+  Q_DISABLE_COPY(ScopedPerfTimer)
+};
+
+#endif // PERF_STATS_H
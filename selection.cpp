@@ -1,4 +1,5 @@
 #include "figure.h"
+#include "geometry.h"
 #include "selection.h"
 
 
@@ -6,6 +7,8 @@ const double vertexActivationRadius      = 8.;
 const double polylineActivationRadius    = 6.;
 const double polygonActivationRadius     = 2.;
 const double inscriptionActivationRadius = polygonActivationRadius;
+const double maxActivationRadius         = qMax(qMax(vertexActivationRadius, polylineActivationRadius),
+                                                qMax(polygonActivationRadius, inscriptionActivationRadius));
 
 static inline double computeScore(double distance, double activationRadius)
 {
@@ -21,18 +24,16 @@ double pointToPointDistance(QPointF point1, QPointF point2)
   return QLineF(point1, point2).length();
 }
 
+// Distance to the closest point of the segment, found by clamping the projection to the segment ends
 double pointToSegmentDistance(QPointF point, QLineF line)
 {
-  QPointF normalVector = QPointF(line.dy(), -line.dx()) * 100.;  // The multiplier is to get an ``infinite straight line''
-  QPointF projection;
-  switch (line.intersect(QLineF(point - normalVector, point + normalVector), &projection)) {
-    case QLineF::BoundedIntersection:
-      return pointToPointDistance(point, projection);
-    case QLineF::NoIntersection:
-    case QLineF::UnboundedIntersection:
-      return qMin(pointToPointDistance(point, line.p1()), pointToPointDistance(point, line.p2()));
-  }
-  ERROR_RETURN_V(0.);
+  QPointF direction = line.p2() - line.p1();
+  double squaredLength = sqr(direction.x()) + sqr(direction.y());
+  if (squaredLength == 0.)
+    return pointToPointDistance(point, line.p1());
+  QPointF offset = point - line.p1();
+  double t = qBound(0., (offset.x() * direction.x() + offset.y() * direction.y()) / squaredLength, 1.);
+  return pointToPointDistance(point, line.p1() + direction * t);
 }
 
 double pointToPolylineDistance(QPointF point, QPolygonF polyline)
@@ -45,7 +46,19 @@ double pointToPolylineDistance(QPointF point, QPolygonF polyline)
 
 double pointToPolygonDistance(QPointF point, QPolygonF polygon)
 {
-  return polygon.containsPoint(point, Qt::OddEvenFill) ? 0. : pointToPolylineDistance(point, polygon);
+  return isPointInPolygon(point, polygon) ? 0. : pointToPolylineDistance(point, polygon);
+}
+
+// Odd-even rule over all the rings, so that holes are outside
+double pointToRingsDistance(QPointF point, const QList<QPolygonF>& rings)
+{
+  bool isInside = false;
+  double distance = positiveInf;
+  foreach (const QPolygonF& ring, rings) {
+    isInside ^= isPointInPolygon(point, ring);
+    distance = qMin(distance, pointToPolylineDistance(point, ring));
+  }
+  return isInside ? 0. : distance;
 }
 
 
@@ -60,20 +73,20 @@ Selection::Selection()
 
 void Selection::clear()
 {
-  assign(0, FIGURE);
+  assign(FigureHandle(), FIGURE);
 }
 
-void Selection::setFigure(Figure* figure__)
+void Selection::setFigure(FigureHandle figure__)
 {
   assign(figure__, FIGURE);
 }
 
-void Selection::setVertex(Figure* figure__, int iVertex__)
+void Selection::setVertex(FigureHandle figure__, int iVertex__)
 {
   assign(figure__, VERTEX, iVertex__);
 }
 
-void Selection::setInscription(Figure* figure__)
+void Selection::setInscription(FigureHandle figure__)
 {
   assign(figure__, INSCRIPTION);
 }
@@ -106,14 +119,7 @@ bool Selection::operator!=(const Selection& other)
 //  ERROR_RETURN(false);
 //}
 
-void Selection::dragTo(QPointF newPos)
-{
-  if (!isEmpty())
-    figure->dragTo(*this, newPos);
-}
-
-
-void Selection::assign(Figure* figure__, Type type__, int iVertex__)
+void Selection::assign(FigureHandle figure__, Type type__, int iVertex__)
 {
   figure  = figure__;
   type    = type__;
@@ -131,7 +137,7 @@ SelectionFinder::SelectionFinder(QPointF cursorPos) :
 {
 }
 
-void SelectionFinder::testPolygon(QPolygonF polygon, Figure* figure)
+void SelectionFinder::testPolygon(QPolygonF polygon, FigureHandle figure)
 {
   double score = computeScore(pointToPolygonDistance(cursorPos_, polygon), polygonActivationRadius);
   if (score > bestScore_) {
@@ -140,7 +146,16 @@ void SelectionFinder::testPolygon(QPolygonF polygon, Figure* figure)
   }
 }
 
-void SelectionFinder::testPolyline(QPolygonF polyline, Figure* figure)
+void SelectionFinder::testRegion(const QList<QPolygonF>& rings, FigureHandle figure)
+{
+  double score = computeScore(pointToRingsDistance(cursorPos_, rings), polygonActivationRadius);
+  if (score > bestScore_) {
+    bestSelection_.setFigure(figure);
+    bestScore_ = score;
+  }
+}
+
+void SelectionFinder::testPolyline(QPolygonF polyline, FigureHandle figure)
 {
   double score = computeScore(pointToPolylineDistance(cursorPos_, polyline), polylineActivationRadius);
   if (score > bestScore_) {
@@ -149,7 +164,7 @@ void SelectionFinder::testPolyline(QPolygonF polyline, Figure* figure)
   }
 }
 
-void SelectionFinder::testVertex(QPointF vertex, Figure* figure, int iVertex)
+void SelectionFinder::testVertex(QPointF vertex, FigureHandle figure, int iVertex)
 {
   double score = computeScore(pointToPointDistance(cursorPos_, vertex), vertexActivationRadius);
   if (score > bestScore_) {
@@ -158,7 +173,7 @@ void SelectionFinder::testVertex(QPointF vertex, Figure* figure, int iVertex)
   }
 }
 
-void SelectionFinder::testInscription(QRectF boundingRect, Figure* figure)
+void SelectionFinder::testInscription(QRectF boundingRect, FigureHandle figure)
 {
   double score = computeScore(pointToPolygonDistance(cursorPos_, QPolygonF(boundingRect)), inscriptionActivationRadius);
   if (score > bestScore_) {
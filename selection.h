@@ -2,9 +2,12 @@
 #define SELECTION_H
 
 #include <QLineF>
+#include <QList>
 #include <QPolygonF>
 
-class Figure;
+#include "figure.h"
+
+extern const double maxActivationRadius;  // no selection is further from the cursor than that
 
 struct Selection
 {
@@ -15,26 +18,25 @@ struct Selection
     INSCRIPTION
   };
 
-  Figure* figure;
+  FigureHandle figure;
   Type    type;
   int     iVertex;
 
   Selection();
 
   void clear();
-  void setFigure(Figure* figure__);
-  void setVertex(Figure* figure__, int iVertex__);
-  void setInscription(Figure* figure__);
+  void setFigure(FigureHandle figure__);
+  void setVertex(FigureHandle figure__, int iVertex__);
+  void setInscription(FigureHandle figure__);
 
   bool operator==(const Selection& other);
   bool operator!=(const Selection& other);
 
-  bool isEmpty()  { return !figure; }
+  bool isEmpty() const  { return figure.isNull(); }  // a non-empty selection may still refer to a removed figure
 //  bool isDraggable() const;
-  void dragTo(QPointF newPos);
 
 private:
-  void assign(Figure* figure__, Type type__, int iVertex__ = -1);
+  void assign(FigureHandle figure__, Type type__, int iVertex__ = -1);
 };
 
 class SelectionFinder
@@ -42,10 +44,11 @@ class SelectionFinder
 public:
   SelectionFinder(QPointF cursorPos);
 
-  void testPolygon(QPolygonF polygon, Figure* figure);
-  void testPolyline(QPolygonF polyline, Figure* figure);
-  void testVertex(QPointF vertex, Figure* figure, int iVertex);
-  void testInscription(QRectF boundingRect, Figure* figure);
+  void testPolygon(QPolygonF polygon, FigureHandle figure);
+  void testRegion(const QList<QPolygonF>& rings, FigureHandle figure);
+  void testPolyline(QPolygonF polyline, FigureHandle figure);
+  void testVertex(QPointF vertex, FigureHandle figure, int iVertex);
+  void testInscription(QRectF boundingRect, FigureHandle figure);
 
   //bool hasSelection() const               { return bestScore_ > 0.; }
   const Selection& bestSelection() const  { return bestSelection_; }
@@ -0,0 +1,252 @@
+#include <cstring>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QTemporaryFile>
+#include <QTextStream>
+
+#include "debug_utils.h"
+#include "session.h"
+
+
+const QString sessionFileSuffix = "amsession";
+
+const char sessionMagic[8] = { 'A', 'M', 'S', 'E', 'S', 'S', '\x1a', '\n' };  // breaks on text-mode transfers
+const quint32 sessionVersion = 1;
+const int sessionHeaderSize = 64;
+const int figureRecordSize = 8;
+const int vertexSize = 16;
+const qint64 fingerprintChunkSize = 1024 * 1024;
+const int coordinateOutputPrecision = 17;  // round-trips doubles
+
+// Vertices can be copied between QPolygonF and the file as is
+static const bool hasNativeVertexLayout = (Q_BYTE_ORDER == Q_LITTLE_ENDIAN && sizeof(QPointF) == vertexSize
+                                           && sizeof(qreal) == sizeof(double));
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Encoding
+
+static void appendUnsigned(QByteArray& data, quint64 value, int nBytes)
+{
+  for (int i = 0; i < nBytes; ++i)
+    data.append(char((value >> (8 * i)) & 0xff));
+}
+
+static void appendDouble(QByteArray& data, double value)
+{
+  quint64 bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  appendUnsigned(data, bits, 8);
+}
+
+static quint64 readUnsigned(const uchar* data, int nBytes)
+{
+  quint64 result = 0;
+  for (int i = nBytes - 1; i >= 0; --i)
+    result = (result << 8) | data[i];
+  return result;
+}
+
+static double readDouble(const uchar* data)
+{
+  quint64 bits = readUnsigned(data, 8);
+  double result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+static int paddingTo8(qint64 size)
+{
+  return int((8 - size % 8) % 8);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Session
+
+Session::Session() :
+  imageFilename(),
+  imageFingerprint(),
+  etalonMetersSize(0.),
+  iEtalonFigure(-1),
+  figures(),
+  scale(1.),
+  scrollPos()
+{
+}
+
+
+QByteArray getImageFingerprint(const QString& imageFilename)
+{
+  QFile file(imageFilename);
+  if (!file.open(QIODevice::ReadOnly))
+    return QByteArray();
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(QByteArray::number(file.size()));
+  hash.addData(file.read(fingerprintChunkSize));
+  if (file.size() > 2 * fingerprintChunkSize && file.seek(file.size() - fingerprintChunkSize))
+    hash.addData(file.read(fingerprintChunkSize));
+  return hash.result();
+}
+
+
+bool saveSession(const QString& filename, const Session& session)
+{
+  QByteArray imageFilename = session.imageFilename.toUtf8();
+  quint64 nVertices = 0;
+  foreach (const SessionFigure& figure, session.figures)
+    nVertices += figure.vertices.size();
+
+  QByteArray header(sessionMagic, sizeof(sessionMagic));
+  appendUnsigned(header, sessionVersion, 4);
+  appendUnsigned(header, session.figures.size(), 4);
+  appendUnsigned(header, nVertices, 8);
+  appendDouble  (header, session.etalonMetersSize);
+  appendUnsigned(header, quint32(session.iEtalonFigure), 4);
+  appendUnsigned(header, quint32(session.scrollPos.x()), 4);
+  appendUnsigned(header, quint32(session.scrollPos.y()), 4);
+  appendUnsigned(header, imageFilename.size(), 4);
+  appendDouble  (header, session.scale);
+  appendUnsigned(header, session.imageFingerprint.size(), 4);
+  appendUnsigned(header, 0, 4);  // reserved
+  ASSERT_RETURN_V(header.size() == sessionHeaderSize, false);
+  header += imageFilename + session.imageFingerprint;
+  header += QByteArray(paddingTo8(header.size()), 0);
+  foreach (const SessionFigure& figure, session.figures) {
+    appendUnsigned(header, figure.type, 4);
+    appendUnsigned(header, figure.vertices.size(), 4);
+  }
+
+  // The session is written next to the target and replaces it only when complete, so a failed save keeps the old one
+  QTemporaryFile file(filename + ".XXXXXX");
+  if (!file.open())
+    return false;
+  if (QFile::exists(filename))
+    file.setPermissions(QFile::permissions(filename));
+  else
+    file.setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+  if (file.write(header) != header.size())
+    return false;
+  foreach (const SessionFigure& figure, session.figures) {
+    QByteArray vertices;
+    if (hasNativeVertexLayout) {
+      vertices = QByteArray::fromRawData(reinterpret_cast<const char*>(figure.vertices.constData()),
+                                         figure.vertices.size() * vertexSize);
+    }
+    else {
+      vertices.reserve(figure.vertices.size() * vertexSize);
+      foreach (QPointF vertex, figure.vertices) {
+        appendDouble(vertices, vertex.x());
+        appendDouble(vertices, vertex.y());
+      }
+    }
+    if (file.write(vertices) != vertices.size())
+      return false;
+  }
+  if (!file.flush())
+    return false;
+  QString temporaryFilename = file.fileName();
+  file.close();
+  file.setAutoRemove(false);
+  QFile::remove(filename);  // Qt doesn't rename over an existing file
+  if (!QFile::rename(temporaryFilename, filename)) {
+    QFile::remove(temporaryFilename);
+    return false;
+  }
+  return true;
+}
+
+bool loadSession(const QString& filename, Session& session)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly) || file.size() < sessionHeaderSize)
+    return false;
+  const qint64 fileSize = file.size();
+  const uchar* data = file.map(0, fileSize);
+  QByteArray readData;
+  if (!data) {  // some file systems can't be mapped
+    readData = file.readAll();
+    if (readData.size() != fileSize)
+      return false;
+    data = reinterpret_cast<const uchar*>(readData.constData());
+  }
+
+  if (std::memcmp(data, sessionMagic, sizeof(sessionMagic)) != 0 || readUnsigned(data + 8, 4) != sessionVersion)
+    return false;
+  quint64 nFigures          = readUnsigned(data + 12, 4);
+  quint64 nVertices         = readUnsigned(data + 16, 8);
+  double etalonMetersSize   = readDouble  (data + 24);
+  int iEtalonFigure         = int(qint32(readUnsigned(data + 32, 4)));
+  int scrollX               = int(qint32(readUnsigned(data + 36, 4)));
+  int scrollY               = int(qint32(readUnsigned(data + 40, 4)));
+  quint64 imageFilenameSize = readUnsigned(data + 44, 4);
+  double scale              = readDouble  (data + 48);
+  quint64 fingerprintSize   = readUnsigned(data + 56, 4);
+
+  quint64 figuresOffset = sessionHeaderSize + imageFilenameSize + fingerprintSize;
+  figuresOffset += paddingTo8(figuresOffset);
+  quint64 verticesOffset = figuresOffset + nFigures * figureRecordSize;
+  if (   nVertices > quint64(fileSize) / vertexSize
+      || verticesOffset + nVertices * vertexSize != quint64(fileSize)
+      || iEtalonFigure < -1 || iEtalonFigure >= int(nFigures))
+    return false;
+
+  Session result;
+  result.imageFilename = QString::fromUtf8(reinterpret_cast<const char*>(data + sessionHeaderSize), int(imageFilenameSize));
+  result.imageFingerprint = QByteArray(reinterpret_cast<const char*>(data + sessionHeaderSize + imageFilenameSize), int(fingerprintSize));
+  result.etalonMetersSize = etalonMetersSize;
+  result.iEtalonFigure = iEtalonFigure;
+  result.scale = scale;
+  result.scrollPos = QPoint(scrollX, scrollY);
+  result.figures.resize(int(nFigures));
+  quint64 iFirstVertex = 0;
+  for (int i = 0; i < result.figures.size(); ++i) {
+    const uchar* record = data + figuresOffset + i * figureRecordSize;
+    quint64 type = readUnsigned(record, 4);
+    quint64 nFigureVertices = readUnsigned(record + 4, 4);
+    if (   type > REGION || nFigureVertices == 0 || iFirstVertex + nFigureVertices > nVertices
+        || ((type == SEGMENT || type == RECTANGLE) && nFigureVertices != 2)
+        || (type == REGION && nFigureVertices < 5))
+      return false;
+    SessionFigure& figure = result.figures[i];
+    figure.type = ShapeType(type);
+    figure.vertices.resize(int(nFigureVertices));
+    const uchar* vertices = data + verticesOffset + iFirstVertex * vertexSize;
+    if (hasNativeVertexLayout) {
+      std::memcpy(figure.vertices.data(), vertices, nFigureVertices * vertexSize);
+    }
+    else {
+      for (int j = 0; j < figure.vertices.size(); ++j)
+        figure.vertices[j] = QPointF(readDouble(vertices + j * vertexSize), readDouble(vertices + j * vertexSize + 8));
+    }
+    iFirstVertex += nFigureVertices;
+  }
+  if (iFirstVertex != nVertices)
+    return false;
+  session = result;
+  return true;
+}
+
+
+bool exportSessionText(const QString& filename, const Session& session)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    return false;
+  QTextStream output(&file);
+  output.setCodec("UTF-8");
+  output.setRealNumberPrecision(coordinateOutputPrecision);
+  output << "# image: " << session.imageFilename << '\n';
+  for (int i = 0; i < session.figures.size(); ++i) {
+    const SessionFigure& figure = session.figures[i];
+    if (i == session.iEtalonFigure)
+      output << "etalon " << session.etalonMetersSize << ' ';
+    output << shapeTypeName(figure.type);
+    foreach (QPointF vertex, figure.vertices)
+      output << ' ' << vertex.x() << ' ' << vertex.y();
+    output << '\n';
+  }
+  output.flush();
+  return output.status() == QTextStream::Ok && file.error() == QFile::NoError;
+}
@@ -0,0 +1,49 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QByteArray>
+#include <QPoint>
+#include <QPolygonF>
+#include <QString>
+#include <QVector>
+
+#include "defines.h"
+
+// Everything needed to continue measuring an image later: finished figures, etalon and view.
+//
+// Binary session file, all numbers little-endian:
+//   header (64 bytes), image filename (UTF-8), image fingerprint, zero padding to a multiple of 8 bytes,
+//   figure records {quint32 type, quint32 nVertices}, vertices {double x, double y} of all figures one after another.
+// The file is memory-mapped on load, and vertex arrays are copied from the mapping in one go.
+
+extern const QString sessionFileSuffix;
+
+struct SessionFigure
+{
+  ShapeType type;
+  QPolygonF vertices;
+};
+
+struct Session
+{
+  QString imageFilename;
+  QByteArray imageFingerprint;   // see getImageFingerprint
+  double etalonMetersSize;       // 0 if there is no etalon
+  int iEtalonFigure;             // -1 if there is no etalon
+  QVector<SessionFigure> figures;
+  double scale;
+  QPoint scrollPos;
+
+  Session();
+};
+
+// Identifies the image file without reading all of it
+QByteArray getImageFingerprint(const QString& imageFilename);
+
+bool saveSession(const QString& filename, const Session& session);
+bool loadSession(const QString& filename, Session& session);
+
+// Same lines as AreaMeasurementBatch reads, so exported figures can be measured in batch
+bool exportSessionText(const QString& filename, const Session& session);
+
+#endif // SESSION_H
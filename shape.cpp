@@ -1,58 +1,91 @@
-#include <QLineF>
+#include <algorithm>
 
+#include "edge_index.h"
+#include "measure_kernels.h"
 #include "shape.h"
+#include "sweep_line.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Helpers
+// Shape
 
-double segmentLenght(QPointF a, QPointF b)
+Shape::MeasurementCache::MeasurementCache() :
+  hasPolygon(false),
+  hasCorrectness(false),
+  hasLength(false),
+  hasArea(false),
+  polygon(),
+  correctness(VALID_SHAPE),
+  length(0.),
+  area(0.),
+  windingArea(0.)
 {
-  return QLineF(a, b).length();
 }
 
-void assertPolygonIsClosed(QPolygonF polygon)
+
+Shape::Shape(ShapeType shapeType) :
+  vertices_(),
+  type_(shapeType),
+  isFinished_(false),
+  incrementalChecks_(false),
+  edgeIndex_(),
+  cache_()
 {
-  ASSERT_RETURN(polygon.isEmpty() || polygon.first() == polygon.last());
 }
 
-bool testSegmentsCross(QPointF a, QPointF b, QPointF c, QPointF d)
+Shape::Shape(ShapeType shapeType, const QPolygonF& points) :
+  vertices_(points),
+  type_(shapeType),
+  isFinished_(true),
+  incrementalChecks_(false),
+  edgeIndex_(),
+  cache_()
 {
-  return QLineF(a, b).intersect(QLineF(c, d), 0) == QLineF::BoundedIntersection;
+  ASSERT_RETURN(!vertices_.isEmpty());
+  ASSERT_RETURN((type_ != SEGMENT && type_ != RECTANGLE) || vertices_.size() == 2);
 }
 
-bool isSelfintersectingPolygon(QPolygonF polygon)
+Shape::Shape(const Shape& other) :
+  vertices_(other.vertices_),
+  type_(other.type_),
+  isFinished_(other.isFinished_),
+  incrementalChecks_(other.incrementalChecks_),
+  edgeIndex_(),
+  cache_(other.cache_)
 {
-  assertPolygonIsClosed(polygon);
-  int n = polygon.size() - 1;  // cut off last vertex
-  for (int i1 = 0; i1 < n; i1++) {
-    int i2 = (i1 + 1) % n;
-    for (int j1 = 0; j1 < n; j1++) {
-      int j2 = (j1 + 1) % n;
-      if (i1 != j1 && i1 != j2 && i2 != j1
-          && testSegmentsCross(polygon[i1], polygon[i2], polygon[j1], polygon[j2]))
-        return true;
-    }
-  }
-  return false;
 }
 
-double triangleSignedArea(QPointF a, QPointF b, QPointF c)
+Shape::~Shape()
 {
-  QPointF p = b - a;
-  QPointF q = c - a;
-  return (p.x() * q.y() - p.y() * q.x()) / 2.0;
 }
 
+Shape& Shape::operator=(const Shape& other)
+{
+  vertices_ = other.vertices_;
+  type_ = other.type_;
+  isFinished_ = other.isFinished_;
+  incrementalChecks_ = other.incrementalChecks_;
+  edgeIndex_.reset();
+  cache_ = other.cache_;
+  return *this;
+}
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Shape
+void Shape::swap(Shape& other)
+{
+  std::swap(vertices_, other.vertices_);
+  std::swap(type_, other.type_);
+  std::swap(isFinished_, other.isFinished_);
+  std::swap(incrementalChecks_, other.incrementalChecks_);
+  EdgeIndex* edgeIndex = edgeIndex_.take();
+  edgeIndex_.reset(other.edgeIndex_.take());
+  other.edgeIndex_.reset(edgeIndex);
+  std::swap(cache_, other.cache_);
+}
 
-Shape::Shape(ShapeType shapeType) :
-  vertices_(),
-  type_(shapeType),
-  isFinished_(false)
+
+void Shape::enableIncrementalChecks()
 {
+  incrementalChecks_ = true;
 }
 
 
@@ -62,6 +95,9 @@ bool Shape::addPoint(QPointF newPoint)
   if (!vertices_.isEmpty() && newPoint == vertices_.back())
     return false;
   vertices_.append(newPoint);
+  invalidateCache();
+  if (edgeIndex_)
+    edgeIndex_->appendVertex(newPoint);
 
   switch (type_) {
     case SEGMENT:
@@ -74,6 +110,9 @@ bool Shape::addPoint(QPointF newPoint)
     case CLOSED_POLYLINE:
     case POLYGON:
       return false;
+
+    case REGION:
+      ERROR_RETURN_V(true);  // regions are made finished, by a flood fill
   }
   ERROR_RETURN_V(true);
 }
@@ -82,22 +121,28 @@ void Shape::finish()
 {
   ASSERT_RETURN(!vertices_.empty());
   isFinished_ = true;
+  invalidateCache();
 }
 
 void Shape::scale(double factor)
 {
   for (int i = 0; i < vertices_.size(); ++i)
     vertices_[i] *= factor;
+  edgeIndex_.reset();
+  invalidateCache();
 }
 
 void Shape::dragVertex(int iVertex, QPointF newPos)
 {
+  invalidateCache();
   switch (type_) {
     case SEGMENT:
     case POLYLINE:
     case CLOSED_POLYLINE:
     case POLYGON:
       vertices_[iVertex] = newPos;
+      if (edgeIndex_)
+        edgeIndex_->moveVertex(iVertex, newPos);
       break;
 
     case RECTANGLE:
@@ -110,6 +155,9 @@ void Shape::dragVertex(int iVertex, QPointF newPos)
         default: ERROR_RETURN();
       }
       break;
+
+    case REGION:
+      ERROR_RETURN();  // the boundary follows pixels, there is nothing to drag
   }
 }
 
@@ -123,6 +171,7 @@ QPolygonF Shape::vertices() const
     case POLYLINE:
     case CLOSED_POLYLINE:
     case POLYGON:
+    case REGION:
       break;
 
     case RECTANGLE:
@@ -137,6 +186,8 @@ QPolygonF Shape::vertices() const
 
 QPolygonF Shape::polygon() const
 {
+  if (cache_.hasPolygon)
+    return cache_.polygon;
   QPolygonF result = vertices_;
 
   switch (type_) {
@@ -149,46 +200,137 @@ QPolygonF Shape::polygon() const
       result.append(result.first());
       break;
 
+    case REGION: {
+      // Every ring after the first one is reached from the first point and followed by a return to it. Each join is
+      // passed both ways, so joins cancel out in the shoelace formula and don't change the odd-even rule.
+      QList<QPolygonF> rings = regionRings();
+      if (rings.isEmpty())
+        break;
+      result = rings.first();
+      for (int i = 1; i < rings.size(); ++i) {
+        result += rings[i];
+        result.append(rings.first().first());
+      }
+      break;
+    }
+
     case RECTANGLE:
       if (result.size() == 2)
         result = QPolygonF(QRectF(result[0], result[1]));
       break;
   }
+  cache_.polygon = result;
+  cache_.hasPolygon = true;
+  return result;
+}
+
+QList<QPolygonF> Shape::regionRings() const
+{
+  QList<QPolygonF> result;
+  ASSERT_RETURN_V(type_ == REGION, result);
+  int ringStart = 0;
+  for (int i = 1; i < vertices_.size(); ++i) {
+    if (i > ringStart && vertices_[i] == vertices_[ringStart]) {
+      result.append(vertices_.mid(ringStart, i - ringStart + 1));
+      ringStart = i + 1;
+    }
+  }
+  if (ringStart < vertices_.size())
+    result.append(vertices_.mid(ringStart));  // not closed, only possible in a broken input
   return result;
 }
 
 ShapeCorrectness Shape::correctness() const
 {
+  if (cache_.hasCorrectness)
+    return cache_.correctness;
+  ShapeCorrectness result = VALID_SHAPE;
   switch (type_) {
     case SEGMENT:
     case POLYLINE:
     case CLOSED_POLYLINE:
     case RECTANGLE:
-      return VALID_SHAPE;
+    case REGION:  // rings of a region may touch at corners, but never cross
+      result = VALID_SHAPE;
+      break;
 
     case POLYGON:
-      return isSelfintersectingPolygon(polygon()) ? SELF_INTERSECTING_POLYGON : VALID_SHAPE;
+      if (incrementalChecks_)
+        result = edgeIndex().nCrossings() > 0 ? SELF_INTERSECTING_POLYGON : VALID_SHAPE;
+      else
+        result = isSelfintersectingPolygon(polygon()) ? SELF_INTERSECTING_POLYGON : VALID_SHAPE;
+      break;
   }
-  ERROR_RETURN_V(VALID_SHAPE);
+  cache_.correctness = result;
+  cache_.hasCorrectness = true;
+  return result;
+}
+
+ShapeCorrectness Shape::correctnessWithAddedPoint(QPointF newPoint) const
+{
+  if (!vertices_.isEmpty() && newPoint == vertices_.back())
+    return correctness();
+  if (type_ == POLYGON && incrementalChecks_)
+    return edgeIndex().nCrossingsWithAppendedVertex(newPoint) > 0 ? SELF_INTERSECTING_POLYGON : VALID_SHAPE;
+  Shape extendedShape = *this;
+  extendedShape.addPoint(newPoint);
+  return extendedShape.correctness();
 }
 
 double Shape::length() const
 {
   ASSERT_RETURN_V(dimensionality() == SHAPE_1D, 0.);
-  QPolygonF p = polygon();
-  double result = 0.;
-  for (int i = 0; i < p.size() - 1; i++)
-    result += segmentLenght(p[i], p[i + 1]);
-  return result;
+  if (!cache_.hasLength)
+    measure();
+  return cache_.length;
 }
 
 double Shape::area() const
 {
   ASSERT_RETURN_V(dimensionality() == SHAPE_2D, 0.);
-  QPolygonF p = polygon();
-  assertPolygonIsClosed(p);
-  double result = 0.;
-  for (int i = 1; i < p.size() - 2; i++)
-    result += triangleSignedArea(p[0], p[i], p[i + 1]);
-  return qAbs(result);
+  if (!cache_.hasArea)
+    measure();
+  return cache_.area;
+}
+
+double Shape::windingArea() const
+{
+  ASSERT_RETURN_V(dimensionality() == SHAPE_2D, 0.);
+  if (!cache_.hasArea)
+    measure();
+  return cache_.windingArea;
+}
+
+
+const EdgeIndex& Shape::edgeIndex() const
+{
+  if (!edgeIndex_)
+    edgeIndex_.reset(new EdgeIndex(vertices_));
+  return *edgeIndex_;
+}
+
+// Length and area are computed together in one pass over the vertices
+void Shape::measure() const
+{
+  cache_.length = 0.;
+  cache_.area = 0.;
+  cache_.windingArea = 0.;
+  if (!vertices_.isEmpty()) {
+    bool isClosed = (type_ == CLOSED_POLYLINE || dimensionality() == SHAPE_2D);
+    // Holes of a region go against its outer ring, so the area of a region is exactly its pixel count
+    ChainMeasurements measurements = measureChain(type_ == REGION ? polygon() : vertices(), isClosed);
+    cache_.length = measurements.length;
+    cache_.area = isClosed ? qAbs(measurements.signedArea) : 0.;
+    cache_.windingArea = cache_.area;
+    // Shoelace formula counts regions by winding number: lobes of a figure eight cancel out, the core of a pentagram counts twice
+    if (type_ == POLYGON && correctness() == SELF_INTERSECTING_POLYGON)
+      cache_.area = computePolygonAreas(polygon()).enclosedArea;
+  }
+  cache_.hasLength = true;
+  cache_.hasArea = true;
+}
+
+void Shape::invalidateCache()
+{
+  cache_ = MeasurementCache();
 }
@@ -1,14 +1,27 @@
 #ifndef SHAPE_H
 #define SHAPE_H
 
+#include <QList>
 #include <QPolygonF>
+#include <QScopedPointer>
 
 #include "defines.h"
 
+class EdgeIndex;
+
 class Shape
 {
 public:
   Shape(ShapeType shapeType);
+  Shape(ShapeType shapeType, const QPolygonF& points);  // finished shape, points as returned by points()
+  Shape(const Shape& other);
+  ~Shape();
+  Shape& operator=(const Shape& other);
+  void swap(Shape& other);  // unlike copying, keeps the edge indices
+
+  // Keep an edge index, so that addPoint and dragVertex update correctness incrementally.
+  // The index itself is not copied, copies rebuild it when needed.
+  void enableIncrementalChecks();
 
   bool addPoint(QPointF newPoint);  // returns whether polygon is finished
   void finish();
@@ -21,16 +34,45 @@ public:
   bool isFinished() const               { return isFinished_; }
   bool isValid() const                  { return correctness() == VALID_SHAPE; }
   int nVertices() const                 { return vertices().size(); }
+  QPolygonF points() const              { return vertices_; }  // as they were added, e.g. two corners of a rectangle
   QPolygonF vertices() const;
   QPolygonF polygon() const;
+  QList<QPolygonF> regionRings() const;  // boundary rings of a region, the outer one first
   ShapeCorrectness correctness() const;
+  ShapeCorrectness correctnessWithAddedPoint(QPointF newPoint) const;  // as if addPoint(newPoint) was called
   double length() const;
-  double area() const;
+  double area() const;         // a self-intersecting polygon is measured by the union of the regions it encloses; a region - by pixel count
+  double windingArea() const;  // regions counted as many times as the polygon winds around them; same as area() for simple shapes
 
 private:
-  QPolygonF vertices_;  // never closed
+  QPolygonF vertices_;  // never closed, except for the rings of a region
   ShapeType type_;
   bool      isFinished_;
+  bool      incrementalChecks_;
+  mutable QScopedPointer<EdgeIndex> edgeIndex_;
+
+  // Measurements are kept until the shape changes
+  struct MeasurementCache
+  {
+    MeasurementCache();
+
+    bool             hasPolygon;
+    bool             hasCorrectness;
+    bool             hasLength;
+    bool             hasArea;
+    QPolygonF        polygon;
+    ShapeCorrectness correctness;
+    double           length;
+    double           area;
+    double           windingArea;
+  };
+  mutable MeasurementCache cache_;
+
+  const EdgeIndex& edgeIndex() const;
+  void measure() const;
+  void invalidateCache();
 };
 
+inline void swap(Shape& a, Shape& b)  { a.swap(b); }
+
 #endif // SHAPE_H
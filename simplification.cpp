@@ -0,0 +1,61 @@
+#include <QPair>
+
+#include "defines.h"
+#include "simplification.h"
+
+
+static double squaredDistanceToSegment(QPointF point, QPointF a, QPointF b)
+{
+  QPointF direction = b - a;
+  QPointF offset = point - a;
+  double squaredLength = sqr(direction.x()) + sqr(direction.y());
+  if (squaredLength > 0.) {
+    double t = qBound(0., (offset.x() * direction.x() + offset.y() * direction.y()) / squaredLength, 1.);
+    offset -= direction * t;
+  }
+  return sqr(offset.x()) + sqr(offset.y());
+}
+
+QVector<int> simplifyPolyline(const QPolygonF& polyline, double tolerance)
+{
+  int n = polyline.size();
+  QVector<int> result;
+  if (n <= 2) {
+    for (int i = 0; i < n; ++i)
+      result.append(i);
+    return result;
+  }
+
+  // Ranges are kept on an explicit stack: traced shapes can have enough vertices to overflow the call stack
+  double squaredTolerance = sqr(tolerance);
+  QVector<bool> isKept(n, false);
+  isKept[0] = true;
+  isKept[n - 1] = true;
+  QVector<QPair<int, int> > ranges;
+  ranges.append(qMakePair(0, n - 1));
+  while (!ranges.isEmpty()) {
+    QPair<int, int> range = ranges.back();
+    ranges.pop_back();
+    QPointF a = polyline[range.first];
+    QPointF b = polyline[range.second];
+    int iFarthest = -1;
+    double maxSquaredDistance = squaredTolerance;
+    for (int i = range.first + 1; i < range.second; ++i) {
+      double squaredDistance = squaredDistanceToSegment(polyline[i], a, b);
+      if (squaredDistance > maxSquaredDistance) {
+        maxSquaredDistance = squaredDistance;
+        iFarthest = i;
+      }
+    }
+    if (iFarthest >= 0) {
+      isKept[iFarthest] = true;
+      ranges.append(qMakePair(range.first, iFarthest));
+      ranges.append(qMakePair(iFarthest, range.second));
+    }
+  }
+
+  for (int i = 0; i < n; ++i)
+    if (isKept[i])
+      result.append(i);
+  return result;
+}
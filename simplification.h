@@ -0,0 +1,12 @@
+#ifndef SIMPLIFICATION_H
+#define SIMPLIFICATION_H
+
+#include <QPolygonF>
+#include <QVector>
+
+// Douglas–Peucker simplification. Returns indices of the vertices to keep, in order, such that no dropped vertex
+// is further than tolerance from the simplified polyline. The first and the last vertices are always kept,
+// so a closed polygon stays closed.
+QVector<int> simplifyPolyline(const QPolygonF& polyline, double tolerance);
+
+#endif // SIMPLIFICATION_H
@@ -0,0 +1,147 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include <algorithm>
+#include <vector>
+
+#include <QHash>
+#include <QVector>
+
+#include "debug_utils.h"
+
+// Refers to an element of a SlotMap. A handle of a removed element stays invalid forever, even when its slot is reused.
+struct SlotHandle
+{
+  int index;
+  int generation;
+
+  SlotHandle() : index(-1), generation(0)  { }
+  SlotHandle(int index__, int generation__) : index(index__), generation(generation__)  { }
+
+  bool isNull() const  { return index < 0; }
+
+  bool operator==(const SlotHandle& other) const  { return index == other.index && generation == other.generation; }
+  bool operator!=(const SlotHandle& other) const  { return !(*this == other); }
+};
+
+inline uint qHash(const SlotHandle& handle)
+{
+  return qHash((quint64(quint32(handle.index)) << 32) | quint32(handle.generation));
+}
+
+
+// Container with O(1) insertion, removal and lookup by handle.
+// Values are kept contiguous (removal swaps the last value into the gap), so iteration order is not preserved by removals.
+// Pointers to values are invalidated by insertions and removals, handles are not.
+
+template<typename T>
+class SlotMap
+{
+public:
+  SlotMap();
+
+  int size() const      { return int(values_.size()); }
+  bool isEmpty() const  { return values_.empty(); }
+
+  SlotHandle insert(const T& value);
+  void remove(SlotHandle handle);
+  void clear();
+
+  bool contains(SlotHandle handle) const;
+  T* get(SlotHandle handle);              // 0 if the handle is null or dangling
+  const T* get(SlotHandle handle) const;
+
+  // Access in storage order, for iteration
+  T& at(int i)                        { return values_[i]; }
+  const T& at(int i) const            { return values_[i]; }
+  SlotHandle handleAt(int i) const    { return SlotHandle(valueSlots_[i], slots_[valueSlots_[i]].generation); }
+
+private:
+  struct Slot
+  {
+    int iValue;      // -1 for a free slot
+    int generation;  // incremented on removal
+  };
+
+  std::vector<T> values_;   // QVector would require T to be default-constructible
+  QVector<int> valueSlots_;
+  QVector<Slot> slots_;
+  QVector<int> freeSlots_;
+};
+
+
+template<typename T>
+SlotMap<T>::SlotMap() :
+  values_(),
+  valueSlots_(),
+  slots_(),
+  freeSlots_()
+{
+}
+
+template<typename T>
+SlotHandle SlotMap<T>::insert(const T& value)
+{
+  int iSlot;
+  if (freeSlots_.isEmpty()) {
+    iSlot = slots_.size();
+    Slot slot = { -1, 0 };
+    slots_.append(slot);
+  }
+  else {
+    iSlot = freeSlots_.last();
+    freeSlots_.pop_back();
+  }
+  slots_[iSlot].iValue = size();
+  values_.push_back(value);
+  valueSlots_.append(iSlot);
+  return SlotHandle(iSlot, slots_[iSlot].generation);
+}
+
+template<typename T>
+void SlotMap<T>::remove(SlotHandle handle)
+{
+  ASSERT_RETURN(contains(handle));
+  Slot& slot = slots_[handle.index];
+  int iLast = size() - 1;
+  if (slot.iValue != iLast) {
+    using std::swap;  // T may have a cheaper swap of its own
+    swap(values_[slot.iValue], values_[iLast]);
+    valueSlots_[slot.iValue] = valueSlots_[iLast];
+    slots_[valueSlots_[iLast]].iValue = slot.iValue;
+  }
+  values_.pop_back();
+  valueSlots_.pop_back();
+  slot.iValue = -1;
+  slot.generation++;
+  freeSlots_.append(handle.index);
+}
+
+template<typename T>
+void SlotMap<T>::clear()
+{
+  while (!isEmpty())
+    remove(handleAt(size() - 1));
+}
+
+template<typename T>
+bool SlotMap<T>::contains(SlotHandle handle) const
+{
+  return    0 <= handle.index && handle.index < slots_.size()
+         && slots_[handle.index].iValue >= 0
+         && slots_[handle.index].generation == handle.generation;
+}
+
+template<typename T>
+T* SlotMap<T>::get(SlotHandle handle)
+{
+  return contains(handle) ? &values_[slots_[handle.index].iValue] : 0;
+}
+
+template<typename T>
+const T* SlotMap<T>::get(SlotHandle handle) const
+{
+  return contains(handle) ? &values_[slots_[handle.index].iValue] : 0;
+}
+
+#endif // SLOT_MAP_H
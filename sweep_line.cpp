@@ -0,0 +1,599 @@
+#include <limits>
+#include <set>
+
+#include <QVector>
+
+#include "debug_utils.h"
+#include "geometry.h"
+#include "sweep_line.h"
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+namespace {
+
+// Sweep goes from left to right; points with equal x are swept from bottom to top.
+// This is the same as sweeping with a slightly rotated line, so vertical edges need no special treatment in the event order.
+inline bool sweepsBefore(QPointF a, QPointF b)
+{
+  return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+}
+
+struct SweepEdge
+{
+  QPointF left;
+  QPointF right;
+
+  bool isVertical() const { return left.x() == right.x(); }
+  bool isPoint() const    { return left == right; }
+
+  double yAt(QPointF sweepPoint) const
+  {
+    if (isVertical())
+      return qBound(left.y(), sweepPoint.y(), right.y());
+    if (sweepPoint.x() == left.x())
+      return left.y();
+    if (sweepPoint.x() == right.x())
+      return right.y();
+    return left.y() + (right.y() - left.y()) * (sweepPoint.x() - left.x()) / (right.x() - left.x());
+  }
+
+  double slope() const
+  {
+    return isVertical() ? std::numeric_limits<double>::infinity() : (right.y() - left.y()) / (right.x() - left.x());
+  }
+};
+
+struct SweepEvent
+{
+  QPointF point;
+  int iEdge;
+  bool isLeft;
+
+  bool operator<(const SweepEvent& other) const
+  {
+    if (point != other.point)
+      return sweepsBefore(point, other.point);
+    return isLeft && !other.isLeft;
+  }
+};
+
+// Orders edges crossed by the sweep line from bottom to top.
+// The order is consistent as long as the edges crossed by the sweep line do not intersect, which is enough to find the first intersection.
+class SweepStatusOrder
+{
+public:
+  SweepStatusOrder(const QVector<SweepEdge>* edges, const QPointF* sweepPoint) :
+    edges_(edges),
+    sweepPoint_(sweepPoint)
+  {
+  }
+
+  bool operator()(int iEdge1, int iEdge2) const
+  {
+    if (iEdge1 == iEdge2)
+      return false;
+    const SweepEdge& edge1 = (*edges_)[iEdge1];
+    const SweepEdge& edge2 = (*edges_)[iEdge2];
+    double y1 = edge1.yAt(*sweepPoint_);
+    double y2 = edge2.yAt(*sweepPoint_);
+    if (y1 != y2)
+      return y1 < y2;
+    // Edges meet at the sweep point: order them by what happens to the right of it
+    double slope1 = edge1.slope();
+    double slope2 = edge2.slope();
+    if (slope1 != slope2)
+      return slope1 < slope2;
+    return iEdge1 < iEdge2;
+  }
+
+private:
+  const QVector<SweepEdge>* edges_;
+  const QPointF* sweepPoint_;
+};
+
+typedef std::set<int, SweepStatusOrder> SweepStatus;
+
+class SelfintersectionFinder
+{
+public:
+  SelfintersectionFinder(const QPolygonF& polygon);
+
+  bool run();
+
+private:
+  const QPolygonF& polygon_;
+  int nEdges_;
+  int probeEdge_;  // an extra zero-length edge used to look up the sweep point in the status
+  QVector<SweepEdge> edges_;
+  QVector<SweepEvent> events_;
+  QPointF sweepPoint_;
+  SweepStatus status_;
+  QVector<SweepStatus::iterator> positions_;
+
+  QVector<int> edgesThroughSweepPoint();
+  bool areAdjacent(int iEdge1, int iEdge2) const;
+  bool testEdges(int iEdge1, int iEdge2) const;
+  bool testNeighbours(SweepStatus::iterator position) const;
+};
+
+SelfintersectionFinder::SelfintersectionFinder(const QPolygonF& polygon) :
+  polygon_(polygon),
+  nEdges_(qMax(0, polygon.size() - 1)),
+  probeEdge_(nEdges_),
+  edges_(nEdges_ + 1),
+  events_(),
+  sweepPoint_(),
+  status_(SweepStatusOrder(&edges_, &sweepPoint_)),
+  positions_(nEdges_)
+{
+  events_.reserve(2 * nEdges_);
+  for (int i = 0; i < nEdges_; ++i) {
+    QPointF a = polygon[i];
+    QPointF b = polygon[i + 1];
+    if (sweepsBefore(b, a))
+      qSwap(a, b);
+    edges_[i].left  = a;
+    edges_[i].right = b;
+    SweepEvent leftEvent  = { a, i, true  };
+    SweepEvent rightEvent = { b, i, false };
+    events_.append(leftEvent);
+    events_.append(rightEvent);
+  }
+  qSort(events_);
+}
+
+bool SelfintersectionFinder::run()
+{
+  int iEvent = 0;
+  while (iEvent < events_.size()) {
+    sweepPoint_ = events_[iEvent].point;
+    int groupBegin = iEvent;
+    while (iEvent < events_.size() && events_[iEvent].point == sweepPoint_)
+      iEvent++;
+    int groupEnd = iEvent;
+
+    // Degenerate cases (coinciding vertices, vertices lying on other edges, overlapping edges) can hide
+    // an intersection from the neighbour tests, so test all edges passing through the event point against each other
+    QVector<int> touchingEdges = edgesThroughSweepPoint();
+    for (int i = groupBegin; i < groupEnd; ++i)
+      if (events_[i].isLeft)
+        touchingEdges.append(events_[i].iEdge);
+    for (int i = 0; i < touchingEdges.size(); ++i)
+      for (int j = i + 1; j < touchingEdges.size(); ++j)
+        if (testEdges(touchingEdges[i], touchingEdges[j]))
+          return true;
+
+    // Right ends go first: edges ending here are not comparable with the ones starting here.
+    // Zero-length edges never enter the sweep status, they are fully handled by the test above.
+    for (int i = groupBegin; i < groupEnd; ++i) {
+      if (events_[i].isLeft || edges_[events_[i].iEdge].isPoint())
+        continue;
+      SweepStatus::iterator position = positions_[events_[i].iEdge];
+      SweepStatus::iterator next = position;
+      ++next;
+      bool hasNeighbours = (position != status_.begin() && next != status_.end());
+      SweepStatus::iterator prev = position;
+      if (hasNeighbours)
+        --prev;
+      status_.erase(position);
+      if (hasNeighbours && testEdges(*prev, *next))
+        return true;
+    }
+
+    for (int i = groupBegin; i < groupEnd; ++i) {
+      if (!events_[i].isLeft || edges_[events_[i].iEdge].isPoint())
+        continue;
+      SweepStatus::iterator position = status_.insert(events_[i].iEdge).first;
+      positions_[events_[i].iEdge] = position;
+      if (testNeighbours(position))
+        return true;
+    }
+  }
+  return false;
+}
+
+// Edges from the sweep status that contain the sweep point. They form a contiguous block in the status.
+QVector<int> SelfintersectionFinder::edgesThroughSweepPoint()
+{
+  QVector<int> result;
+  edges_[probeEdge_].left  = sweepPoint_;
+  edges_[probeEdge_].right = sweepPoint_;
+  SweepStatus::iterator blockMiddle = status_.lower_bound(probeEdge_);
+  for (SweepStatus::iterator it = blockMiddle; it != status_.end() && edges_[*it].yAt(sweepPoint_) == sweepPoint_.y(); ++it)
+    result.append(*it);
+  for (SweepStatus::iterator it = blockMiddle; it != status_.begin(); ) {
+    --it;
+    if (edges_[*it].yAt(sweepPoint_) != sweepPoint_.y())
+      break;
+    result.append(*it);
+  }
+  return result;
+}
+
+bool SelfintersectionFinder::areAdjacent(int iEdge1, int iEdge2) const
+{
+  return    iEdge1 == iEdge2
+         || (iEdge1 + 1) % nEdges_ == iEdge2
+         || (iEdge2 + 1) % nEdges_ == iEdge1;
+}
+
+bool SelfintersectionFinder::testEdges(int iEdge1, int iEdge2) const
+{
+  return    !areAdjacent(iEdge1, iEdge2)
+         && testSegmentsCross(polygon_[iEdge1], polygon_[iEdge1 + 1], polygon_[iEdge2], polygon_[iEdge2 + 1]);
+}
+
+bool SelfintersectionFinder::testNeighbours(SweepStatus::iterator position) const
+{
+  SweepStatus::iterator next = position;
+  ++next;
+  if (next != status_.end() && testEdges(*position, *next))
+    return true;
+  if (position != status_.begin()) {
+    SweepStatus::iterator prev = position;
+    --prev;
+    if (testEdges(*prev, *position))
+      return true;
+  }
+  return false;
+}
+
+
+// Area sweep: unlike SelfintersectionFinder, it keeps going past intersections.
+// Every edge is cut at each event point it passes through, so that an edge in the sweep status never
+// contains an event point in its interior. Then regions between neighbouring edges have a constant winding number,
+// and each piece of an edge contributes to the area according to the winding numbers on its two sides.
+//
+// Crossing points are rounded, so the edges are bent slightly to meet there. To keep the status consistent,
+// an event point also cuts (and bends) edges that pass within rounding error of it.
+
+struct AreaEdge
+{
+  QPointF left;
+  QPointF right;
+  int direction;     // +1 if the polygon goes from left to right along this edge, -1 otherwise
+  int windingBelow;  // winding number of the region just below the edge; set when the edge enters the sweep status
+};
+
+struct AreaEvent
+{
+  enum Type { START, END, CROSSING };
+
+  QPointF point;
+  Type type;
+  int iEdge1;
+  int iEdge2;  // for crossings only
+
+  bool operator<(const AreaEvent& other) const
+  {
+    if (point != other.point)
+      return sweepsBefore(point, other.point);
+    if (type != other.type)
+      return type < other.type;
+    if (iEdge1 != other.iEdge1)
+      return iEdge1 < other.iEdge1;
+    return iEdge2 < other.iEdge2;
+  }
+};
+
+// Orders edges crossed by the sweep line from bottom to top using exact predicates only.
+// Lookups and insertions only happen at event points, so one of the edges compared always starts at the sweep point:
+// either it's an edge being inserted, or it's the probe (which stands for the sweep point itself).
+class AreaStatusOrder
+{
+public:
+  AreaStatusOrder(const QVector<AreaEdge>* edges, const int* probeEdge, const QPointF* sweepPoint) :
+    edges_(edges),
+    probeEdge_(probeEdge),
+    sweepPoint_(sweepPoint)
+  {
+  }
+
+  bool operator()(int iEdge1, int iEdge2) const
+  {
+    if (iEdge1 == iEdge2)
+      return false;
+    bool starts1 = startsAtSweepPoint(iEdge1);
+    bool starts2 = startsAtSweepPoint(iEdge2);
+    if (starts1 && starts2)
+      return startingEdgesOrder(iEdge1, iEdge2);
+    if (starts1)
+      return isBelow(iEdge1, iEdge2);
+    if (starts2)
+      return !isBelow(iEdge2, iEdge1);
+    // Should not happen; order by the left ends, which is the best guess there is
+    const AreaEdge& edge1 = (*edges_)[iEdge1];
+    const AreaEdge& edge2 = (*edges_)[iEdge2];
+    int side = orientation(edge2.left, edge2.right, edge1.left);
+    return side != 0 ? side < 0 : iEdge1 < iEdge2;
+  }
+
+private:
+  const QVector<AreaEdge>* edges_;
+  const int* probeEdge_;
+  const QPointF* sweepPoint_;
+
+  bool startsAtSweepPoint(int iEdge) const
+  {
+    return iEdge == *probeEdge_ || (*edges_)[iEdge].left == *sweepPoint_;
+  }
+
+  // Both edges go right from the sweep point; the probe is below all of them
+  bool startingEdgesOrder(int iEdge1, int iEdge2) const
+  {
+    if (iEdge1 == *probeEdge_)
+      return true;
+    if (iEdge2 == *probeEdge_)
+      return false;
+    int side = orientation(*sweepPoint_, (*edges_)[iEdge1].right, (*edges_)[iEdge2].right);
+    return side != 0 ? side > 0 : iEdge1 < iEdge2;
+  }
+
+  // Whether the edge iEdge1, which starts at the sweep point, is below the edge iEdge2, which started earlier
+  bool isBelow(int iEdge1, int iEdge2) const
+  {
+    const AreaEdge& edge2 = (*edges_)[iEdge2];
+    int side = orientation(edge2.left, edge2.right, *sweepPoint_);
+    if (side != 0)
+      return side < 0;
+    // Edge iEdge2 passes through the sweep point: the probe goes below, so that lower_bound finds such edges.
+    // A real edge is never inserted next to an edge passing through its start, those are cut first.
+    if (iEdge1 == *probeEdge_)
+      return true;
+    side = orientation(edge2.left, edge2.right, (*edges_)[iEdge1].right);
+    return side != 0 ? side < 0 : iEdge1 < iEdge2;
+  }
+};
+
+typedef std::set<int, AreaStatusOrder> AreaStatus;
+
+class AreaSweep
+{
+public:
+  AreaSweep(const QPolygonF& polygon);
+
+  PolygonAreas run();
+
+private:
+  QPointF origin_;  // everything is computed relative to it, so that far-away polygons don't lose precision
+  double snapDistance_;
+  QVector<AreaEdge> edges_;
+  std::set<AreaEvent> events_;
+  int probeEdge_;
+  QPointF sweepPoint_;
+  AreaStatus status_;
+  QVector<AreaStatus::iterator> positions_;
+  QVector<int> edgesToCut_;
+  double enclosedArea_;
+  double windingArea_;
+
+  int addEdge(QPointF a, QPointF b, int direction);
+  bool passesNearSweepPoint(int iEdge) const;
+  QVector<int> edgesNearSweepPoint();
+  void cutEdge(int iEdge, QVector<int>& startingEdges);
+  void insertEdges(const QVector<int>& startingEdges);
+  void testEdges(int iEdge1, int iEdge2);
+};
+
+AreaSweep::AreaSweep(const QPolygonF& polygon) :
+  origin_(polygon.isEmpty() ? QPointF() : polygon.first()),
+  snapDistance_(0.),
+  edges_(),
+  events_(),
+  probeEdge_(-1),
+  sweepPoint_(),
+  status_(AreaStatusOrder(&edges_, &probeEdge_, &sweepPoint_)),
+  positions_(),
+  edgesToCut_(),
+  enclosedArea_(0.),
+  windingArea_(0.)
+{
+  int nEdges = qMax(0, polygon.size() - 1);
+  edges_.reserve(2 * nEdges + 1);
+  probeEdge_ = addEdge(QPointF(), QPointF(), 0);
+  double maxCoordinate = 0.;
+  for (int i = 0; i < nEdges; ++i) {
+    QPointF a = polygon[i] - origin_;
+    QPointF b = polygon[i + 1] - origin_;
+    maxCoordinate = qMax(maxCoordinate, qMax(qAbs(a.x()), qAbs(a.y())));
+    if (a == b)
+      continue;
+    int iEdge = sweepsBefore(a, b) ? addEdge(a, b, 1) : addEdge(b, a, -1);
+    AreaEvent startEvent = { edges_[iEdge].left,  AreaEvent::START, iEdge, -1 };
+    AreaEvent endEvent   = { edges_[iEdge].right, AreaEvent::END,   iEdge, -1 };
+    events_.insert(startEvent);
+    events_.insert(endEvent);
+  }
+  // Well above the error of a computed crossing point, still far below anything visible
+  snapDistance_ = 64. * std::numeric_limits<double>::epsilon() * maxCoordinate;
+}
+
+PolygonAreas AreaSweep::run()
+{
+  while (!events_.empty()) {
+    sweepPoint_ = events_.begin()->point;
+    QVector<int> startingEdges;
+    while (!events_.empty() && events_.begin()->point == sweepPoint_) {
+      // Ends and crossings need no processing of their own: the edges are found among the edges passing by
+      if (events_.begin()->type == AreaEvent::START)
+        startingEdges.append(events_.begin()->iEdge1);
+      events_.erase(events_.begin());
+    }
+
+    // Edges are cut at the sweep point, and the parts on the right start here.
+    // Inserting them can reveal edges that cross at the sweep point within rounding error; those are cut as well.
+    edgesToCut_ = edgesNearSweepPoint();
+    while (!edgesToCut_.isEmpty() || !startingEdges.isEmpty()) {
+      foreach (int iEdge, edgesToCut_)
+        cutEdge(iEdge, startingEdges);
+      edgesToCut_.clear();
+      insertEdges(startingEdges);
+      startingEdges.clear();
+    }
+  }
+
+  PolygonAreas result;
+  result.enclosedArea = qAbs(enclosedArea_);
+  result.windingArea = qAbs(windingArea_);
+  return result;
+}
+
+int AreaSweep::addEdge(QPointF a, QPointF b, int direction)
+{
+  AreaEdge edge = { a, b, direction, 0 };
+  edges_.append(edge);
+  positions_.append(status_.end());
+  return edges_.size() - 1;
+}
+
+bool AreaSweep::passesNearSweepPoint(int iEdge) const
+{
+  const AreaEdge& edge = edges_[iEdge];
+  if (orientation(edge.left, edge.right, sweepPoint_) == 0)
+    return true;
+  QPointF direction = edge.right - edge.left;
+  QPointF offset = sweepPoint_ - edge.left;
+  double crossProduct = direction.x() * offset.y() - direction.y() * offset.x();
+  return qAbs(crossProduct) <= snapDistance_ * (qAbs(direction.x()) + qAbs(direction.y()));
+}
+
+// Edges from the sweep status passing through the sweep point or close to it. They form a contiguous block in the status.
+QVector<int> AreaSweep::edgesNearSweepPoint()
+{
+  QVector<int> result;
+  AreaStatus::iterator blockMiddle = status_.lower_bound(probeEdge_);
+  for (AreaStatus::iterator it = blockMiddle; it != status_.end() && passesNearSweepPoint(*it); ++it)
+    result.append(*it);
+  for (AreaStatus::iterator it = blockMiddle; it != status_.begin(); ) {
+    --it;
+    if (!passesNearSweepPoint(*it))
+      break;
+    result.append(*it);
+  }
+  return result;
+}
+
+// Removes the edge from the status and accounts for its contribution to the area: integral of y dx
+// taken along the polygon over every boundary between two regions, which is the piece from the left end to the sweep point.
+// The rest of the edge, if any, is appended to startingEdges.
+void AreaSweep::cutEdge(int iEdge, QVector<int>& startingEdges)
+{
+  AreaEdge& edge = edges_[iEdge];
+  ASSERT_RETURN(positions_[iEdge] != status_.end());
+  double integral = (sweepPoint_.x() - edge.left.x()) * (edge.left.y() + sweepPoint_.y()) / 2.;
+  int windingAbove = edge.windingBelow + edge.direction;
+  // Going left to right with the enclosed region below adds the area under the edge, with the region above subtracts it
+  if (edge.windingBelow != 0 && windingAbove == 0)
+    enclosedArea_ += integral;
+  else if (edge.windingBelow == 0 && windingAbove != 0)
+    enclosedArea_ -= integral;
+  windingArea_ += (edge.windingBelow - windingAbove) * integral;
+  status_.erase(positions_[iEdge]);
+  positions_[iEdge] = status_.end();
+  if (sweepsBefore(sweepPoint_, edge.right))
+    startingEdges.append(addEdge(sweepPoint_, edge.right, edge.direction));  // invalidates the edge reference
+}
+
+void AreaSweep::insertEdges(const QVector<int>& startingEdges)
+{
+  foreach (int iEdge, startingEdges)
+    positions_[iEdge] = status_.insert(iEdge).first;
+
+  // Edges starting here are right above the probe, and nothing passes through the sweep point anymore
+  AreaStatus::iterator blockBegin = status_.lower_bound(probeEdge_);
+  AreaStatus::iterator blockEnd = blockBegin;
+  int windingNumber = 0;
+  if (blockBegin != status_.begin()) {
+    AreaStatus::iterator below = blockBegin;
+    --below;
+    windingNumber = edges_[*below].windingBelow + edges_[*below].direction;
+  }
+  while (blockEnd != status_.end() && edges_[*blockEnd].left == sweepPoint_) {
+    edges_[*blockEnd].windingBelow = windingNumber;
+    windingNumber += edges_[*blockEnd].direction;
+    ++blockEnd;
+  }
+
+  // New neighbours are the block boundaries, or the two edges around the sweep point if nothing starts here
+  if (blockBegin != status_.begin() && blockBegin != status_.end()) {
+    AreaStatus::iterator below = blockBegin;
+    --below;
+    testEdges(*below, *blockBegin);
+  }
+  if (blockEnd != blockBegin && blockEnd != status_.end()) {
+    AreaStatus::iterator lastStarting = blockEnd;
+    --lastStarting;
+    testEdges(*lastStarting, *blockEnd);
+  }
+}
+
+// Schedules a crossing event if the edges intersect at a point strictly inside both of them.
+// Touching is handled without it: an end lying on the other edge is an event point, and the edge is cut there.
+void AreaSweep::testEdges(int iEdge1, int iEdge2)
+{
+  const AreaEdge& edge1 = edges_[iEdge1];
+  const AreaEdge& edge2 = edges_[iEdge2];
+  if (   orientation(edge1.left, edge1.right, edge2.left) * orientation(edge1.left, edge1.right, edge2.right) >= 0
+      || orientation(edge2.left, edge2.right, edge1.left) * orientation(edge2.left, edge2.right, edge1.right) >= 0)
+    return;
+  QPointF d1 = edge1.right - edge1.left;
+  QPointF d2 = edge2.right - edge2.left;
+  QPointF d12 = edge2.left - edge1.left;
+  double t = (d12.x() * d2.y() - d12.y() * d2.x()) / (d1.x() * d2.y() - d1.y() * d2.x());
+  QPointF crossing = edge1.left + t * d1;
+  if (!sweepsBefore(sweepPoint_, crossing)) {
+    // Rounded to the sweep point or behind it: the edges meet here
+    if (edge1.left != sweepPoint_ && !edgesToCut_.contains(iEdge1))
+      edgesToCut_.append(iEdge1);
+    if (edge2.left != sweepPoint_ && !edgesToCut_.contains(iEdge2))
+      edgesToCut_.append(iEdge2);
+    return;
+  }
+  if (sweepsBefore(edge1.right, crossing))
+    crossing = edge1.right;
+  if (sweepsBefore(edge2.right, crossing))
+    crossing = edge2.right;
+  AreaEvent crossingEvent = { crossing, AreaEvent::CROSSING, qMin(iEdge1, iEdge2), qMax(iEdge1, iEdge2) };
+  events_.insert(crossingEvent);
+}
+
+
+}  // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Self-intersection
+
+bool isSelfintersectingPolygon(const QPolygonF& polygon)
+{
+  assertPolygonIsClosed(polygon);
+  return SelfintersectionFinder(polygon).run();
+}
+
+bool isSelfintersectingPolygonBruteForce(const QPolygonF& polygon)
+{
+  assertPolygonIsClosed(polygon);
+  int n = polygon.size() - 1;  // cut off last vertex
+  for (int i1 = 0; i1 < n; i1++) {
+    int i2 = (i1 + 1) % n;
+    for (int j1 = 0; j1 < n; j1++) {
+      int j2 = (j1 + 1) % n;
+      if (i1 != j1 && i1 != j2 && i2 != j1
+          && testSegmentsCross(polygon[i1], polygon[i2], polygon[j1], polygon[j2]))
+        return true;
+    }
+  }
+  return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Area
+
+PolygonAreas computePolygonAreas(const QPolygonF& polygon)
+{
+  assertPolygonIsClosed(polygon);
+  return AreaSweep(polygon).run();
+}
@@ -0,0 +1,24 @@
+#ifndef SWEEP_LINE_H
+#define SWEEP_LINE_H
+
+#include <QPolygonF>
+
+// Polygon must be closed. Adjacent edges are allowed to touch at their common vertex, any other contact is an intersection.
+
+// Shamos–Hoey sweep, O(n log n). Stops at the first intersection found.
+bool isSelfintersectingPolygon(const QPolygonF& polygon);
+
+// Tests all pairs of edges, O(n^2). Reference implementation for benchmarks.
+bool isSelfintersectingPolygonBruteForce(const QPolygonF& polygon);
+
+struct PolygonAreas
+{
+  double enclosedArea;  // union of the regions enclosed by the polygon (nonzero winding rule)
+  double windingArea;   // regions weighted by their winding numbers; same as the shoelace formula
+};
+
+// Bentley–Ottmann sweep that splits edges at their intersections, O((n + k) log n) for k intersections.
+// Works for any polygon, but only differs from the shoelace formula for self-intersecting ones.
+PolygonAreas computePolygonAreas(const QPolygonF& polygon);
+
+#endif // SWEEP_LINE_H
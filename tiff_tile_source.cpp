@@ -0,0 +1,608 @@
+#include <climits>
+#include <cstring>
+
+#include <QMap>
+#include <QMutexLocker>
+#include <QScopedPointer>
+#include <QSet>
+
+#include "debug_utils.h"
+#include "tiff_tile_source.h"
+
+
+const int maxDirectories = 64;            // protects from loops in broken files
+const int maxLevels = 32;
+const quint64 maxEntriesInDirectory = 4096;
+const quint64 maxValuesInEntry = 1 << 28;
+const qint64 maxDecodedBlockSize = 256 * 1024 * 1024;
+const int maxBlockCacheKBytes = 64 * 1024;
+
+enum TiffTag
+{
+  TAG_NEW_SUBFILE_TYPE  = 254,
+  TAG_IMAGE_WIDTH       = 256,
+  TAG_IMAGE_LENGTH      = 257,
+  TAG_BITS_PER_SAMPLE   = 258,
+  TAG_COMPRESSION       = 259,
+  TAG_PHOTOMETRIC       = 262,
+  TAG_STRIP_OFFSETS     = 273,
+  TAG_SAMPLES_PER_PIXEL = 277,
+  TAG_ROWS_PER_STRIP    = 278,
+  TAG_STRIP_BYTE_COUNTS = 279,
+  TAG_PLANAR_CONFIG     = 284,
+  TAG_PREDICTOR         = 317,
+  TAG_COLOR_MAP         = 320,
+  TAG_TILE_WIDTH        = 322,
+  TAG_TILE_LENGTH       = 323,
+  TAG_TILE_OFFSETS      = 324,
+  TAG_TILE_BYTE_COUNTS  = 325,
+  TAG_EXTRA_SAMPLES     = 338
+};
+
+enum TiffCompression
+{
+  COMPRESSION_NONE          = 1,
+  COMPRESSION_LZW           = 5,
+  COMPRESSION_DEFLATE       = 8,
+  COMPRESSION_PACKBITS      = 32773,
+  COMPRESSION_DEFLATE_OLD   = 32946
+};
+
+enum TiffPhotometric
+{
+  PHOTOMETRIC_WHITE_IS_ZERO = 0,
+  PHOTOMETRIC_BLACK_IS_ZERO = 1,
+  PHOTOMETRIC_RGB           = 2,
+  PHOTOMETRIC_PALETTE       = 3
+};
+
+const int PREDICTOR_NONE        = 1;
+const int PREDICTOR_HORIZONTAL  = 2;
+
+const int EXTRA_SAMPLE_ASSOCIATED_ALPHA   = 1;
+const int EXTRA_SAMPLE_UNASSOCIATED_ALPHA = 2;
+
+const int REDUCED_IMAGE_FLAG = 1;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Decompression
+
+static inline quint64 makeBlockKey(int iLevel, int iBlock)
+{
+  return (quint64(iLevel) << 56) | quint32(iBlock);
+}
+
+static quint64 tagValue(const QMap<int, QVector<quint64> >& tags, int tag, quint64 defaultValue)
+{
+  QVector<quint64> values = tags.value(tag);
+  return values.isEmpty() ? defaultValue : values.first();
+}
+
+static inline int colorSamples(int photometric)
+{
+  return photometric == PHOTOMETRIC_RGB ? 3 : 1;
+}
+
+// TIFF flavour of LZW: codes are written MSB-first, their width grows one code early
+static bool decodeLzw(const QByteArray& input, int expectedSize, QByteArray& output)
+{
+  const int clearCode = 256;
+  const int endCode = 257;
+  const int firstFreeCode = 258;
+  const int maxCodeWidth = 12;
+
+  QByteArray paddedInput = input + QByteArray(3, 0);
+  const uchar* data = reinterpret_cast<const uchar*>(paddedInput.constData());
+  const qint64 nBits = qint64(input.size()) * 8;
+
+  // Every string in the table is a part of the output, so it's stored as a position in the output
+  QVector<int> stringStarts(1 << maxCodeWidth);
+  QVector<int> stringLengths(1 << maxCodeWidth);
+  output.resize(expectedSize);
+  int outputSize = 0;
+  int codeWidth = 9;
+  int nextCode = firstFreeCode;
+  int previousStart = -1;
+  int previousLength = 0;
+  qint64 bitPosition = 0;
+  while (bitPosition + codeWidth <= nBits) {
+    int bytePosition = int(bitPosition >> 3);
+    quint32 bits = (quint32(data[bytePosition]) << 16) | (quint32(data[bytePosition + 1]) << 8) | data[bytePosition + 2];
+    int code = (bits >> (24 - int(bitPosition & 7) - codeWidth)) & ((1 << codeWidth) - 1);
+    bitPosition += codeWidth;
+
+    if (code == endCode)
+      break;
+    if (code == clearCode) {
+      codeWidth = 9;
+      nextCode = firstFreeCode;
+      previousStart = -1;
+      continue;
+    }
+
+    int start = outputSize;
+    int length = 0;
+    if (code < clearCode)
+      length = 1;
+    else if (code < nextCode)
+      length = stringLengths[code];
+    else if (code == nextCode && previousStart >= 0)
+      length = previousLength + 1;
+    else
+      return false;
+    if (outputSize + length > expectedSize)
+      return false;
+
+    char* outputData = output.data();
+    if (code < clearCode) {
+      outputData[start] = char(code);
+    }
+    else if (code < nextCode) {
+      std::memcpy(outputData + start, outputData + stringStarts[code], length);
+    }
+    else {
+      std::memcpy(outputData + start, outputData + previousStart, previousLength);
+      outputData[start + previousLength] = outputData[previousStart];
+    }
+    outputSize += length;
+
+    // The new string is the previous one plus the first byte of the current one, and they are adjacent in the output
+    if (previousStart >= 0 && nextCode < (1 << maxCodeWidth)) {
+      stringStarts[nextCode] = previousStart;
+      stringLengths[nextCode] = previousLength + 1;
+      nextCode++;
+      if (nextCode + 1 >= (1 << codeWidth) && codeWidth < maxCodeWidth)
+        codeWidth++;
+    }
+    previousStart = start;
+    previousLength = length;
+  }
+  output.resize(outputSize);
+  return true;
+}
+
+static bool decodeDeflate(const QByteArray& input, int expectedSize, QByteArray& output)
+{
+  // qUncompress expects zlib stream prefixed with the big-endian size of the result
+  QByteArray prefixedInput(4, 0);
+  prefixedInput[0] = char((expectedSize >> 24) & 0xff);
+  prefixedInput[1] = char((expectedSize >> 16) & 0xff);
+  prefixedInput[2] = char((expectedSize >>  8) & 0xff);
+  prefixedInput[3] = char( expectedSize        & 0xff);
+  prefixedInput += input;
+  output = qUncompress(prefixedInput);
+  return !output.isEmpty() && output.size() <= expectedSize;
+}
+
+static bool decodePackBits(const QByteArray& input, int expectedSize, QByteArray& output)
+{
+  output.clear();
+  output.reserve(expectedSize);
+  const char* data = input.constData();
+  int position = 0;
+  while (position < input.size() && output.size() < expectedSize) {
+    int header = qint8(data[position++]);
+    if (header >= 0) {
+      int length = header + 1;
+      if (position + length > input.size())
+        return false;
+      output.append(data + position, length);
+      position += length;
+    }
+    else if (header != -128) {
+      if (position >= input.size())
+        return false;
+      output.append(QByteArray(1 - header, data[position++]));
+    }
+  }
+  return output.size() <= expectedSize;
+}
+
+static void undoHorizontalPredictor(QByteArray& block, int width, int height, int nSamples)
+{
+  uchar* data = reinterpret_cast<uchar*>(block.data());
+  int rowSize = width * nSamples;
+  for (int y = 0; y < height; ++y) {
+    uchar* row = data + y * rowSize;
+    for (int i = nSamples; i < rowSize; ++i)
+      row[i] += row[i - nSamples];
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Directory
+
+TiffTileSource::Directory::Directory() :
+  size(),
+  blockWidth(0),
+  blockHeight(0),
+  nBlocksX(0),
+  nBlocksY(0),
+  blockOffsets(),
+  blockByteCounts(),
+  compression(COMPRESSION_NONE),
+  predictor(PREDICTOR_NONE),
+  photometric(PHOTOMETRIC_BLACK_IS_ZERO),
+  nSamples(0),
+  hasAlpha(false),
+  alphaIsPremultiplied(false),
+  colorMap()
+{
+}
+
+QRect TiffTileSource::Directory::blockRect(int bx, int by) const
+{
+  return QRect(bx * blockWidth, by * blockHeight, blockWidth, blockHeight);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TiffTileSource
+
+TiffTileSource::TiffTileSource(const QString& filename) :
+  file_(filename),
+  fileMutex_(),
+  isBigEndian_(false),
+  isBigTiff_(false),
+  levels_(),
+  blockCacheMutex_(),
+  blockCache_(maxBlockCacheKBytes)
+{
+}
+
+TiffTileSource::~TiffTileSource()
+{
+}
+
+TiffTileSource* TiffTileSource::open(const QString& filename)
+{
+  QScopedPointer<TiffTileSource> source(new TiffTileSource(filename));
+  if (!source->file_.open(QIODevice::ReadOnly))
+    return 0;
+  quint64 offset = 0;
+  if (!source->readHeader(offset))
+    return 0;
+
+  // The first directory is the image itself; reduced copies of it may follow (that's how GDAL stores overviews).
+  // Overviews kept in SubIFDs are not looked for.
+  QSet<quint64> visitedOffsets;
+  for (int i = 0; i < maxDirectories && offset != 0 && !visitedOffsets.contains(offset); ++i) {
+    visitedOffsets.insert(offset);
+    Directory directory;
+    bool isReduced = false;
+    quint64 nextOffset = 0;
+    bool isSupported = source->readDirectory(offset, directory, isReduced, nextOffset);
+    if (source->levels_.isEmpty()) {
+      if (!isSupported)
+        return 0;
+      source->levels_.append(directory);
+    }
+    else if (isSupported && isReduced) {
+      for (int iLevel = 1; iLevel < maxLevels; ++iLevel) {
+        if (levelSize(source->size(), iLevel) == directory.size) {
+          if (source->levels_.size() <= iLevel)
+            source->levels_.resize(iLevel + 1);
+          if (!source->levels_[iLevel].isValid())
+            source->levels_[iLevel] = directory;
+          break;
+        }
+      }
+    }
+    offset = nextOffset;
+  }
+  return source->levels_.isEmpty() ? 0 : source.take();
+}
+
+
+QSize TiffTileSource::size() const
+{
+  return levels_.first().size;
+}
+
+bool TiffTileSource::hasAlphaChannel() const
+{
+  return levels_.first().hasAlpha;
+}
+
+bool TiffTileSource::hasLevel(int iLevel) const
+{
+  return iLevel >= 0 && iLevel < levels_.size() && levels_[iLevel].isValid();
+}
+
+QImage TiffTileSource::read(const QRect& rect, int iLevel) const
+{
+  ASSERT_RETURN_V(hasLevel(iLevel), QImage());
+  const Directory& directory = levels_[iLevel];
+  ASSERT_RETURN_V(!rect.isEmpty() && QRect(QPoint(), directory.size).contains(rect), QImage());
+
+  QImage::Format format = !directory.hasAlpha           ? QImage::Format_RGB32 :
+                          directory.alphaIsPremultiplied ? QImage::Format_ARGB32_Premultiplied :
+                                                           QImage::Format_ARGB32;
+  QImage result(rect.size(), format);
+  for (int by = rect.top() / directory.blockHeight; by <= rect.bottom() / directory.blockHeight; ++by) {
+    for (int bx = rect.left() / directory.blockWidth; bx <= rect.right() / directory.blockWidth; ++bx) {
+      int iBlock = by * directory.nBlocksX + bx;
+      QRect blockRect = directory.blockRect(bx, by);
+      QRect part = blockRect & rect;
+      int partRowSize = part.width() * directory.nSamples;
+      if (directory.compression == COMPRESSION_NONE) {
+        // Rows are read right from the file, so a huge uncompressed strip is never loaded as a whole
+        for (int y = part.top(); y <= part.bottom(); ++y) {
+          quint64 rowOffset = directory.blockOffsets[iBlock]
+                            + (quint64(y - blockRect.top()) * directory.blockWidth + (part.left() - blockRect.left())) * directory.nSamples;
+          QByteArray row = readBytes(rowOffset, partRowSize);
+          if (row.size() != partRowSize)
+            return QImage();
+          QRgb* target = reinterpret_cast<QRgb*>(result.scanLine(y - rect.top())) + (part.left() - rect.left());
+          convertPixels(directory, reinterpret_cast<const uchar*>(row.constData()), target, part.width());
+        }
+      }
+      else {
+        QByteArray block = decodedBlock(iLevel, bx, by);
+        if (block.isEmpty())
+          return QImage();
+        for (int y = part.top(); y <= part.bottom(); ++y) {
+          const uchar* source = reinterpret_cast<const uchar*>(block.constData())
+                              + ((y - blockRect.top()) * directory.blockWidth + (part.left() - blockRect.left())) * directory.nSamples;
+          QRgb* target = reinterpret_cast<QRgb*>(result.scanLine(y - rect.top())) + (part.left() - rect.left());
+          convertPixels(directory, source, target, part.width());
+        }
+      }
+    }
+  }
+  return result;
+}
+
+
+bool TiffTileSource::readHeader(quint64& firstDirectoryOffset)
+{
+  QByteArray header = readBytes(0, 16);
+  if (header.size() < 8)
+    return false;
+  if (header.startsWith("II"))
+    isBigEndian_ = false;
+  else if (header.startsWith("MM"))
+    isBigEndian_ = true;
+  else
+    return false;
+
+  const uchar* data = reinterpret_cast<const uchar*>(header.constData());
+  int magic = int(readUnsigned(data + 2, 2));
+  if (magic == 42) {
+    isBigTiff_ = false;
+    firstDirectoryOffset = readUnsigned(data + 4, 4);
+    return true;
+  }
+  if (magic == 43 && header.size() == 16 && readUnsigned(data + 4, 2) == 8) {
+    isBigTiff_ = true;
+    firstDirectoryOffset = readUnsigned(data + 8, 8);
+    return true;
+  }
+  return false;
+}
+
+// Returns whether the directory describes an image that can be read. nextOffset is 0 if there are no more directories.
+bool TiffTileSource::readDirectory(quint64 offset, Directory& directory, bool& isReduced, quint64& nextOffset)
+{
+  const int countSize  = isBigTiff_ ? 8 : 2;
+  const int entrySize  = isBigTiff_ ? 20 : 12;
+  const int offsetSize = isBigTiff_ ? 8 : 4;
+
+  nextOffset = 0;
+  QByteArray countBytes = readBytes(offset, countSize);
+  if (countBytes.size() != countSize)
+    return false;
+  quint64 nEntries = readUnsigned(reinterpret_cast<const uchar*>(countBytes.constData()), countSize);
+  if (nEntries > maxEntriesInDirectory)
+    return false;
+  QByteArray entries = readBytes(offset + countSize, nEntries * entrySize + offsetSize);
+  if (quint64(entries.size()) != nEntries * entrySize + offsetSize)
+    return false;
+  const uchar* entriesData = reinterpret_cast<const uchar*>(entries.constData());
+  nextOffset = readUnsigned(entriesData + nEntries * entrySize, offsetSize);
+
+  QMap<int, QVector<quint64> > tags;
+  for (quint64 i = 0; i < nEntries; ++i) {
+    const uchar* entry = entriesData + i * entrySize;
+    tags[int(readUnsigned(entry, 2))] = readValues(entry);
+  }
+
+  isReduced = (tagValue(tags, TAG_NEW_SUBFILE_TYPE, 0) & REDUCED_IMAGE_FLAG);
+  quint64 width = tagValue(tags, TAG_IMAGE_WIDTH, 0);
+  quint64 height = tagValue(tags, TAG_IMAGE_LENGTH, 0);
+  if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX)
+    return false;
+
+  directory.nSamples = int(tagValue(tags, TAG_SAMPLES_PER_PIXEL, 1));
+  directory.compression = int(tagValue(tags, TAG_COMPRESSION, COMPRESSION_NONE));
+  directory.predictor = int(tagValue(tags, TAG_PREDICTOR, PREDICTOR_NONE));
+  directory.photometric = int(tagValue(tags, TAG_PHOTOMETRIC, -1));
+  if (directory.nSamples < 1 || directory.nSamples > 8)
+    return false;
+  foreach (quint64 bitsPerSample, tags.value(TAG_BITS_PER_SAMPLE))
+    if (bitsPerSample != 8)
+      return false;
+  if (tagValue(tags, TAG_PLANAR_CONFIG, 1) != 1)
+    return false;
+  if (   directory.compression != COMPRESSION_NONE && directory.compression != COMPRESSION_LZW
+      && directory.compression != COMPRESSION_DEFLATE && directory.compression != COMPRESSION_DEFLATE_OLD
+      && directory.compression != COMPRESSION_PACKBITS)
+    return false;
+  if (directory.predictor != PREDICTOR_NONE && directory.predictor != PREDICTOR_HORIZONTAL)
+    return false;
+  if (   directory.photometric != PHOTOMETRIC_WHITE_IS_ZERO && directory.photometric != PHOTOMETRIC_BLACK_IS_ZERO
+      && directory.photometric != PHOTOMETRIC_RGB && directory.photometric != PHOTOMETRIC_PALETTE)
+    return false;
+  int nColorSamples = colorSamples(directory.photometric);
+  if (directory.nSamples < nColorSamples)
+    return false;
+
+  if (directory.photometric == PHOTOMETRIC_PALETTE) {
+    QVector<quint64> colorMap = tags.value(TAG_COLOR_MAP);
+    if (colorMap.size() != 3 * 256)
+      return false;
+    directory.colorMap.resize(256);
+    for (int i = 0; i < 256; ++i)
+      directory.colorMap[i] = qRgb(int(colorMap[i] >> 8), int(colorMap[256 + i] >> 8), int(colorMap[512 + i] >> 8));
+  }
+  else if (directory.nSamples > nColorSamples) {
+    int extraSample = int(tagValue(tags, TAG_EXTRA_SAMPLES, 0));
+    directory.hasAlpha = (extraSample == EXTRA_SAMPLE_ASSOCIATED_ALPHA || extraSample == EXTRA_SAMPLE_UNASSOCIATED_ALPHA);
+    directory.alphaIsPremultiplied = (extraSample == EXTRA_SAMPLE_ASSOCIATED_ALPHA);
+  }
+
+  if (tags.contains(TAG_TILE_WIDTH)) {
+    directory.blockWidth = int(qMin(tagValue(tags, TAG_TILE_WIDTH, 0), quint64(INT_MAX)));
+    directory.blockHeight = int(qMin(tagValue(tags, TAG_TILE_LENGTH, 0), quint64(INT_MAX)));
+    directory.blockOffsets = tags.value(TAG_TILE_OFFSETS);
+    directory.blockByteCounts = tags.value(TAG_TILE_BYTE_COUNTS);
+  }
+  else {
+    directory.blockWidth = int(width);
+    directory.blockHeight = int(qMin(tagValue(tags, TAG_ROWS_PER_STRIP, height), height));
+    directory.blockOffsets = tags.value(TAG_STRIP_OFFSETS);
+    directory.blockByteCounts = tags.value(TAG_STRIP_BYTE_COUNTS);
+  }
+  if (directory.blockWidth <= 0 || directory.blockHeight <= 0)
+    return false;
+  directory.nBlocksX = int((width  + directory.blockWidth  - 1) / directory.blockWidth);
+  directory.nBlocksY = int((height + directory.blockHeight - 1) / directory.blockHeight);
+  if (   directory.blockOffsets.size() != directory.nBlocksX * directory.nBlocksY
+      || directory.blockByteCounts.size() != directory.blockOffsets.size())
+    return false;
+  if (   directory.compression != COMPRESSION_NONE
+      && qint64(directory.blockWidth) * directory.blockHeight * directory.nSamples > maxDecodedBlockSize)
+    return false;
+
+  directory.size = QSize(int(width), int(height));
+  return true;
+}
+
+// Reads integer values of an entry; returns nothing for other types
+QVector<quint64> TiffTileSource::readValues(const uchar* entry) const
+{
+  const int inlineSize = isBigTiff_ ? 8 : 4;
+  int type = int(readUnsigned(entry + 2, 2));
+  quint64 nValues = readUnsigned(entry + 4, inlineSize);
+  const uchar* valueField = entry + 4 + inlineSize;
+  int valueSize = 0;
+  switch (type) {
+    case 1:  valueSize = 1; break;  // BYTE
+    case 3:  valueSize = 2; break;  // SHORT
+    case 4:                         // LONG
+    case 13: valueSize = 4; break;  // IFD
+    case 16:                        // LONG8
+    case 18: valueSize = 8; break;  // IFD8
+    default: return QVector<quint64>();
+  }
+  if (nValues == 0 || nValues > maxValuesInEntry)
+    return QVector<quint64>();
+
+  QByteArray externalData;
+  const uchar* data = valueField;
+  if (nValues * valueSize > quint64(inlineSize)) {
+    externalData = readBytes(readUnsigned(valueField, inlineSize), nValues * valueSize);
+    if (quint64(externalData.size()) != nValues * valueSize)
+      return QVector<quint64>();
+    data = reinterpret_cast<const uchar*>(externalData.constData());
+  }
+  QVector<quint64> result(int(nValues));
+  for (int i = 0; i < result.size(); ++i)
+    result[i] = readUnsigned(data + i * valueSize, valueSize);
+  return result;
+}
+
+QByteArray TiffTileSource::readBytes(quint64 offset, quint64 size) const
+{
+  QMutexLocker locker(&fileMutex_);
+  if (offset + size > quint64(file_.size()) || size > quint64(INT_MAX))
+    return QByteArray();
+  if (!file_.seek(qint64(offset)))
+    return QByteArray();
+  return file_.read(qint64(size));
+}
+
+quint64 TiffTileSource::readUnsigned(const uchar* data, int nBytes) const
+{
+  quint64 result = 0;
+  if (isBigEndian_) {
+    for (int i = 0; i < nBytes; ++i)
+      result = (result << 8) | data[i];
+  }
+  else {
+    for (int i = nBytes - 1; i >= 0; --i)
+      result = (result << 8) | data[i];
+  }
+  return result;
+}
+
+
+// Decompressed block of the level, padded to the full block size. Empty on error.
+QByteArray TiffTileSource::decodedBlock(int iLevel, int bx, int by) const
+{
+  const Directory& directory = levels_[iLevel];
+  int iBlock = by * directory.nBlocksX + bx;
+  quint64 key = makeBlockKey(iLevel, iBlock);
+  {
+    QMutexLocker locker(&blockCacheMutex_);
+    const QByteArray* cachedBlock = blockCache_.object(key);
+    if (cachedBlock)
+      return *cachedBlock;
+  }
+
+  QByteArray compressedBlock = readBytes(directory.blockOffsets[iBlock], directory.blockByteCounts[iBlock]);
+  if (quint64(compressedBlock.size()) != directory.blockByteCounts[iBlock])
+    return QByteArray();
+  int blockSize = directory.blockWidth * directory.blockHeight * directory.nSamples;
+  QByteArray block;
+  bool isOk = false;
+  switch (directory.compression) {
+    case COMPRESSION_LZW:
+      isOk = decodeLzw(compressedBlock, blockSize, block);
+      break;
+    case COMPRESSION_DEFLATE:
+    case COMPRESSION_DEFLATE_OLD:
+      isOk = decodeDeflate(compressedBlock, blockSize, block);
+      break;
+    case COMPRESSION_PACKBITS:
+      isOk = decodePackBits(compressedBlock, blockSize, block);
+      break;
+    default:
+      ERROR_RETURN_V(QByteArray());
+  }
+  if (!isOk)
+    return QByteArray();
+  block.resize(blockSize);  // the last strip is usually shorter
+  if (directory.predictor == PREDICTOR_HORIZONTAL)
+    undoHorizontalPredictor(block, directory.blockWidth, directory.blockHeight, directory.nSamples);
+
+  QMutexLocker locker(&blockCacheMutex_);
+  blockCache_.insert(key, new QByteArray(block), qMax(1, blockSize / 1024));
+  return block;
+}
+
+void TiffTileSource::convertPixels(const Directory& directory, const uchar* source, QRgb* target, int nPixels) const
+{
+  const int nSamples = directory.nSamples;
+  const int alphaSample = colorSamples(directory.photometric);
+  for (int i = 0; i < nPixels; ++i) {
+    const uchar* pixel = source + i * nSamples;
+    int alpha = directory.hasAlpha ? pixel[alphaSample] : 255;
+    switch (directory.photometric) {
+      case PHOTOMETRIC_WHITE_IS_ZERO:
+        target[i] = qRgba(255 - pixel[0], 255 - pixel[0], 255 - pixel[0], alpha);
+        break;
+      case PHOTOMETRIC_BLACK_IS_ZERO:
+        target[i] = qRgba(pixel[0], pixel[0], pixel[0], alpha);
+        break;
+      case PHOTOMETRIC_RGB:
+        target[i] = qRgba(pixel[0], pixel[1], pixel[2], alpha);
+        break;
+      case PHOTOMETRIC_PALETTE:
+        target[i] = directory.colorMap[pixel[0]];
+        break;
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef TIFF_TILE_SOURCE_H
+#define TIFF_TILE_SOURCE_H
+
+#include <QCache>
+#include <QFile>
+#include <QMutex>
+#include <QVector>
+
+#include "tile_source.h"
+
+// Reads rects of classic TIFF and BigTIFF files without decoding the rest of the image.
+// Supports tiled and stripped images with 8-bit grayscale, RGB(A) or palette pixels, stored uncompressed
+// or compressed with LZW, Deflate or PackBits. Reduced-resolution copies stored in the file (overviews) are used as levels.
+// Uncompressed data is read directly from the file; compressed blocks are decoded as a whole and kept in a bounded cache.
+
+class TiffTileSource : public TileSource
+{
+public:
+  static TiffTileSource* open(const QString& filename);  // returns 0 if it's not a TIFF or its layout is not supported
+  ~TiffTileSource();
+
+  virtual QSize size() const;
+  virtual bool hasAlphaChannel() const;
+  virtual bool hasLevel(int iLevel) const;
+  virtual QImage read(const QRect& rect, int iLevel = 0) const;
+
+private:
+  // One image stored in the file. Strips are treated as tiles as wide as the image.
+  struct Directory
+  {
+    QSize size;
+    int blockWidth;
+    int blockHeight;
+    int nBlocksX;
+    int nBlocksY;
+    QVector<quint64> blockOffsets;
+    QVector<quint64> blockByteCounts;
+    int compression;
+    int predictor;
+    int photometric;
+    int nSamples;
+    bool hasAlpha;
+    bool alphaIsPremultiplied;
+    QVector<QRgb> colorMap;
+
+    Directory();
+    bool isValid() const  { return !size.isEmpty(); }
+    QRect blockRect(int bx, int by) const;
+  };
+
+  mutable QFile file_;
+  mutable QMutex fileMutex_;
+  bool isBigEndian_;
+  bool isBigTiff_;
+  QVector<Directory> levels_;  // invalid directories for levels that are not stored in the file
+  mutable QMutex blockCacheMutex_;
+  mutable QCache<quint64, QByteArray> blockCache_;
+
+  explicit TiffTileSource(const QString& filename);
+
+  bool readHeader(quint64& firstDirectoryOffset);
+  bool readDirectory(quint64 offset, Directory& directory, bool& isReduced, quint64& nextOffset);
+  QVector<quint64> readValues(const uchar* entry) const;
+  QByteArray readBytes(quint64 offset, quint64 size) const;
+  quint64 readUnsigned(const uchar* data, int nBytes) const;
+
+  QByteArray decodedBlock(int iLevel, int bx, int by) const;
+  void convertPixels(const Directory& directory, const uchar* source, QRgb* target, int nPixels) const;
+};
+
+#endif // TIFF_TILE_SOURCE_H
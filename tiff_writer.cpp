@@ -0,0 +1,154 @@
+#include <QVector>
+
+#include "debug_utils.h"
+#include "tiff_writer.h"
+
+
+const int rowsPerStrip = 64;
+const quint64 maxClassicTiffSize = 0xffffffffULL;
+const quint64 maxDirectorySize = 64 * 1024;
+
+const int TYPE_SHORT = 3;
+const int TYPE_LONG  = 4;
+const int TYPE_LONG8 = 16;
+
+struct TiffEntry
+{
+  int tag;
+  int type;
+  QVector<quint64> values;
+};
+
+static void appendLittleEndian(QByteArray& data, quint64 value, int nBytes)
+{
+  for (int i = 0; i < nBytes; ++i)
+    data.append(char((value >> (8 * i)) & 0xff));
+}
+
+
+TiffWriter::TiffWriter(const QString& filename, QSize size, bool hasAlphaChannel) :
+  file_(filename),
+  size_(size),
+  hasAlphaChannel_(hasAlphaChannel),
+  isBigTiff_(false),
+  nSamples_(hasAlphaChannel ? 4 : 3),
+  nRowsWritten_(0)
+{
+  quint64 nStrips = (size_.height() + rowsPerStrip - 1) / rowsPerStrip;
+  quint64 dataSize = quint64(size_.width()) * size_.height() * nSamples_;
+  isBigTiff_ = (dataSize + 2 * nStrips * sizeof(quint32) + maxDirectorySize > maxClassicTiffSize);
+}
+
+
+bool TiffWriter::open()
+{
+  if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  QByteArray header("II");
+  if (isBigTiff_) {
+    appendLittleEndian(header, 43, 2);
+    appendLittleEndian(header, 8, 2);  // offset size
+    appendLittleEndian(header, 0, 2);
+    appendLittleEndian(header, 0, 8);  // directory offset is filled in on close
+  }
+  else {
+    appendLittleEndian(header, 42, 2);
+    appendLittleEndian(header, 0, 4);
+  }
+  return file_.write(header) == header.size();
+}
+
+bool TiffWriter::writeRows(const QImage& rows)
+{
+  ASSERT_RETURN_V(rows.width() == size_.width() && nRowsWritten_ + rows.height() <= size_.height(), false);
+  ASSERT_RETURN_V(rows.format() == QImage::Format_RGB32 || rows.format() == QImage::Format_ARGB32_Premultiplied, false);
+  QByteArray data(rows.width() * rows.height() * nSamples_, 0);
+  uchar* target = reinterpret_cast<uchar*>(data.data());
+  for (int y = 0; y < rows.height(); ++y) {
+    const QRgb* source = reinterpret_cast<const QRgb*>(rows.constScanLine(y));
+    for (int x = 0; x < rows.width(); ++x) {
+      *target++ = qRed  (source[x]);
+      *target++ = qGreen(source[x]);
+      *target++ = qBlue (source[x]);
+      if (hasAlphaChannel_)
+        *target++ = qAlpha(source[x]);  // stored as associated alpha, i.e. premultiplied
+    }
+  }
+  nRowsWritten_ += rows.height();
+  return file_.write(data) == data.size();
+}
+
+bool TiffWriter::close()
+{
+  ASSERT_RETURN_V(nRowsWritten_ == size_.height(), false);
+  quint64 directoryOffset = file_.pos();
+  if (directoryOffset % 2 != 0) {  // the directory has to start on a word boundary
+    if (!file_.putChar(0))
+      return false;
+    directoryOffset++;
+  }
+
+  const int offsetType = isBigTiff_ ? TYPE_LONG8 : TYPE_LONG;
+  const quint64 rowSize = quint64(size_.width()) * nSamples_;
+  const int nStrips = (size_.height() + rowsPerStrip - 1) / rowsPerStrip;
+  QVector<quint64> stripOffsets(nStrips);
+  QVector<quint64> stripByteCounts(nStrips);
+  for (int i = 0; i < nStrips; ++i) {
+    stripOffsets[i] = headerSize() + quint64(i) * rowsPerStrip * rowSize;
+    stripByteCounts[i] = qMin(rowsPerStrip, size_.height() - i * rowsPerStrip) * rowSize;
+  }
+
+  QList<TiffEntry> entries;  // ordered by tag
+  TiffEntry imageWidth         = { 256, TYPE_LONG,  QVector<quint64>(1, size_.width())  };
+  TiffEntry imageLength        = { 257, TYPE_LONG,  QVector<quint64>(1, size_.height()) };
+  TiffEntry bitsPerSample      = { 258, TYPE_SHORT, QVector<quint64>(nSamples_, 8)      };
+  TiffEntry compression        = { 259, TYPE_SHORT, QVector<quint64>(1, 1)              };  // none
+  TiffEntry photometric        = { 262, TYPE_SHORT, QVector<quint64>(1, 2)              };  // RGB
+  TiffEntry stripOffsetsTag    = { 273, offsetType, stripOffsets                        };
+  TiffEntry samplesPerPixel    = { 277, TYPE_SHORT, QVector<quint64>(1, nSamples_)      };
+  TiffEntry rowsPerStripTag    = { 278, TYPE_LONG,  QVector<quint64>(1, rowsPerStrip)   };
+  TiffEntry stripByteCountsTag = { 279, offsetType, stripByteCounts                     };
+  TiffEntry planarConfig       = { 284, TYPE_SHORT, QVector<quint64>(1, 1)              };  // chunky
+  TiffEntry extraSamples       = { 338, TYPE_SHORT, QVector<quint64>(1, 1)              };  // associated alpha
+  entries << imageWidth << imageLength << bitsPerSample << compression << photometric << stripOffsetsTag
+          << samplesPerPixel << rowsPerStripTag << stripByteCountsTag << planarConfig;
+  if (hasAlphaChannel_)
+    entries << extraSamples;
+
+  const int countSize  = isBigTiff_ ? 8 : 2;
+  const int entrySize  = isBigTiff_ ? 20 : 12;
+  const int offsetSize = isBigTiff_ ? 8 : 4;
+  const quint64 directorySize = countSize + entries.size() * entrySize + offsetSize;
+  QByteArray directory;
+  QByteArray externalValues;  // arrays that don't fit into their entries follow the directory
+  appendLittleEndian(directory, entries.size(), countSize);
+  foreach (const TiffEntry& entry, entries) {
+    int valueSize = (entry.type == TYPE_SHORT) ? 2 : (entry.type == TYPE_LONG) ? 4 : 8;
+    QByteArray values;
+    foreach (quint64 value, entry.values)
+      appendLittleEndian(values, value, valueSize);
+    appendLittleEndian(directory, entry.tag, 2);
+    appendLittleEndian(directory, entry.type, 2);
+    appendLittleEndian(directory, entry.values.size(), offsetSize);
+    if (values.size() <= offsetSize) {
+      directory += values + QByteArray(offsetSize - values.size(), 0);
+    }
+    else {
+      appendLittleEndian(directory, directoryOffset + directorySize + externalValues.size(), offsetSize);
+      externalValues += values;
+      if (externalValues.size() % 2 != 0)
+        externalValues.append('\0');
+    }
+  }
+  appendLittleEndian(directory, 0, offsetSize);  // no more directories
+  ASSERT_RETURN_V(quint64(directory.size()) == directorySize, false);
+
+  QByteArray directoryOffsetBytes;
+  appendLittleEndian(directoryOffsetBytes, directoryOffset, offsetSize);
+  bool isOk =    file_.write(directory) == directory.size()
+              && file_.write(externalValues) == externalValues.size()
+              && file_.seek(headerSize() - offsetSize)
+              && file_.write(directoryOffsetBytes) == directoryOffsetBytes.size();
+  file_.close();
+  return isOk && file_.error() == QFile::NoError;
+}
@@ -0,0 +1,31 @@
+#ifndef TIFF_WRITER_H
+#define TIFF_WRITER_H
+
+#include <QFile>
+#include <QImage>
+
+// Writes an uncompressed TIFF (BigTIFF if it doesn't fit in 4 GB) row by row, so that the image
+// never has to be held in memory as a whole. Pixel data goes first, the directory is written on close.
+
+class TiffWriter
+{
+public:
+  TiffWriter(const QString& filename, QSize size, bool hasAlphaChannel);
+
+  bool open();
+  bool writeRows(const QImage& rows);  // next rows from top to bottom, RGB32 or ARGB32_Premultiplied
+  bool close();
+  QString errorString() const  { return file_.errorString(); }
+
+private:
+  QFile file_;
+  QSize size_;
+  bool hasAlphaChannel_;
+  bool isBigTiff_;
+  int nSamples_;
+  int nRowsWritten_;
+
+  int headerSize() const  { return isBigTiff_ ? 16 : 8; }
+};
+
+#endif // TIFF_WRITER_H
@@ -0,0 +1,73 @@
+#include <QtConcurrentRun>
+
+#include "tile_loader.h"
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Worker
+
+// Runs in a worker thread. Tiles of stale requests are skipped.
+static void loadTile(const ImagePyramid* pyramid, ImagePyramid::TileKey key,
+                     QAtomicInt* generation, int jobGeneration, QObject* loader)
+{
+  if (*generation != jobGeneration)
+    return;
+  pyramid->tile(key);
+  QMetaObject::invokeMethod(loader, "tileLoaded", Qt::QueuedConnection,
+                            Q_ARG(qulonglong, key.toUInt64()), Q_ARG(QRect, pyramid->originalTileRect(key)));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TileLoader
+
+TileLoader::TileLoader(const ImagePyramid* pyramid, QObject* parent) :
+  QObject(parent),
+  pyramid_(pyramid),
+  generation_(0)
+{
+}
+
+TileLoader::~TileLoader()
+{
+  cancel();
+  foreach (QFuture<void> job, runningJobs_)
+    job.waitForFinished();
+}
+
+
+void TileLoader::request(const QList<ImagePyramid::TileKey>& tiles)
+{
+  bool hasNewTiles = false;
+  foreach (const ImagePyramid::TileKey& key, tiles)
+    if (!requestedTiles_.contains(key.toUInt64()))
+      hasNewTiles = true;
+  if (!hasNewTiles)
+    return;
+
+  // Tiles that are still needed are simply requested again: the ones already decoded by then are taken from the cache
+  cancel();
+  int jobGeneration = generation_;
+  QList<QFuture<void> > stillRunning;
+  foreach (QFuture<void> oldJob, runningJobs_)
+    if (oldJob.isRunning())
+      stillRunning.append(oldJob);
+  runningJobs_ = stillRunning;
+  foreach (const ImagePyramid::TileKey& key, tiles) {
+    requestedTiles_.insert(key.toUInt64());
+    runningJobs_.append(QtConcurrent::run(loadTile, pyramid_, key, &generation_, jobGeneration, static_cast<QObject*>(this)));
+  }
+}
+
+void TileLoader::cancel()
+{
+  generation_.fetchAndAddOrdered(1);
+  requestedTiles_.clear();
+}
+
+
+void TileLoader::tileLoaded(qulonglong key, const QRect& originalRect)
+{
+  requestedTiles_.remove(key);
+  emit loaded(originalRect);
+}
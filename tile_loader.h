@@ -0,0 +1,39 @@
+#ifndef TILE_LOADER_H
+#define TILE_LOADER_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QList>
+#include <QObject>
+#include <QSet>
+
+#include "image_pyramid.h"
+
+// Decodes image tiles on worker threads, so that opening and scrolling a huge image never blocks the UI.
+// The caller draws what is cached and requests the rest; a newer request makes the queued tiles of older ones stale.
+
+class TileLoader : public QObject
+{
+  Q_OBJECT
+
+public:
+  TileLoader(const ImagePyramid* pyramid, QObject* parent = 0);
+  ~TileLoader();
+
+  void request(const QList<ImagePyramid::TileKey>& tiles);
+  void cancel();
+
+signals:
+  void loaded(const QRect& originalRect);
+
+private:
+  const ImagePyramid* pyramid_;
+  QAtomicInt generation_;
+  QList<QFuture<void> > runningJobs_;
+  QSet<quint64> requestedTiles_;  // not loaded yet
+
+private slots:
+  void tileLoaded(qulonglong key, const QRect& originalRect);
+};
+
+#endif // TILE_LOADER_H
@@ -0,0 +1,240 @@
+#include <QFile>
+#include <QImageReader>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QScopedPointer>
+
+#include "debug_utils.h"
+#include "tiff_tile_source.h"
+#include "tile_source.h"
+
+
+// Smaller images are simply decoded as a whole: it is faster than any partial decoding
+const qint64 maxFullyDecodedPixels = 64 * 1024 * 1024;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TileSource
+
+QSize levelSize(QSize originalSize, int iLevel)
+{
+  QSize result = originalSize;
+  for (int i = 0; i < iLevel; ++i)
+    result = QSize((result.width() + 1) / 2, (result.height() + 1) / 2);
+  return result;
+}
+
+
+TileSource::~TileSource()
+{
+}
+
+bool TileSource::hasLevel(int iLevel) const
+{
+  return iLevel == 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ImageTileSource
+
+ImageTileSource::ImageTileSource(const QImage& image) :
+  image_(image)
+{
+}
+
+QImage ImageTileSource::read(const QRect& rect, int iLevel) const
+{
+  ASSERT_RETURN_V(iLevel == 0, QImage());
+  return image_.copy(rect);
+}
+
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// RawTileSource
+
+// Binary PGM and PPM with 8-bit samples: pixels are stored as is, so any rect is read directly from the file
+class RawTileSource : public TileSource
+{
+public:
+  static RawTileSource* open(const QString& filename);
+
+  virtual QSize size() const            { return size_; }
+  virtual bool hasAlphaChannel() const  { return false; }
+  virtual QImage read(const QRect& rect, int iLevel = 0) const;
+
+private:
+  mutable QFile file_;
+  mutable QMutex fileMutex_;
+  QSize size_;
+  int nChannels_;
+  qint64 dataOffset_;
+
+  explicit RawTileSource(const QString& filename);
+};
+
+RawTileSource::RawTileSource(const QString& filename) :
+  file_(filename),
+  fileMutex_(),
+  size_(),
+  nChannels_(0),
+  dataOffset_(0)
+{
+}
+
+// Reads a header field, skipping whitespace and comments
+static bool readPnmNumber(QFile& file, int& result)
+{
+  char c;
+  do {
+    if (!file.getChar(&c))
+      return false;
+    if (c == '#') {
+      while (c != '\n')
+        if (!file.getChar(&c))
+          return false;
+    }
+  } while (QChar(c).isSpace());
+
+  QByteArray digits;
+  while (c >= '0' && c <= '9') {
+    digits.append(c);
+    if (!file.getChar(&c))
+      return false;
+  }
+  bool isOk = false;
+  result = digits.toInt(&isOk);
+  return isOk && QChar(c).isSpace();  // exactly one whitespace character separates the header from the data
+}
+
+RawTileSource* RawTileSource::open(const QString& filename)
+{
+  QScopedPointer<RawTileSource> source(new RawTileSource(filename));
+  QFile& file = source->file_;
+  if (!file.open(QIODevice::ReadOnly))
+    return 0;
+  QByteArray magic = file.read(2);
+  if (magic == "P5")
+    source->nChannels_ = 1;
+  else if (magic == "P6")
+    source->nChannels_ = 3;
+  else
+    return 0;
+  int width = 0;
+  int height = 0;
+  int maxValue = 0;
+  if (!readPnmNumber(file, width) || !readPnmNumber(file, height) || !readPnmNumber(file, maxValue))
+    return 0;
+  if (width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255)
+    return 0;
+  source->size_ = QSize(width, height);
+  source->dataOffset_ = file.pos();
+  if (file.size() < source->dataOffset_ + qint64(width) * height * source->nChannels_)
+    return 0;
+  return source.take();
+}
+
+QImage RawTileSource::read(const QRect& rect, int iLevel) const
+{
+  ASSERT_RETURN_V(iLevel == 0 && QRect(QPoint(), size_).contains(rect), QImage());
+  QImage result(rect.size(), QImage::Format_RGB32);
+  QByteArray row(rect.width() * nChannels_, 0);
+  for (int y = 0; y < rect.height(); ++y) {
+    {
+      QMutexLocker locker(&fileMutex_);
+      qint64 rowOffset = dataOffset_ + (qint64(rect.top() + y) * size_.width() + rect.left()) * nChannels_;
+      if (!file_.seek(rowOffset) || file_.read(row.data(), row.size()) != row.size())
+        return QImage();
+    }
+    const uchar* source = reinterpret_cast<const uchar*>(row.constData());
+    QRgb* target = reinterpret_cast<QRgb*>(result.scanLine(y));
+    for (int x = 0; x < rect.width(); ++x) {
+      if (nChannels_ == 1)
+        target[x] = qRgb(source[x], source[x], source[x]);
+      else
+        target[x] = qRgb(source[3 * x], source[3 * x + 1], source[3 * x + 2]);
+    }
+  }
+  return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ReaderTileSource
+
+// Any format which Qt plugin can decode a clip rect of (e.g., JPEG).
+// The plugin may still have to go through the beginning of the file, but the memory use is bounded.
+class ReaderTileSource : public TileSource
+{
+public:
+  ReaderTileSource(const QString& filename, QSize size, bool hasAlphaChannel, bool canScale);
+
+  virtual QSize size() const            { return size_; }
+  virtual bool hasAlphaChannel() const  { return hasAlphaChannel_; }
+  virtual bool hasLevel(int iLevel) const;
+  virtual QImage read(const QRect& rect, int iLevel = 0) const;
+
+private:
+  QString filename_;
+  QSize size_;
+  bool hasAlphaChannel_;
+  bool canScale_;
+};
+
+ReaderTileSource::ReaderTileSource(const QString& filename, QSize size, bool hasAlphaChannel, bool canScale) :
+  filename_(filename),
+  size_(size),
+  hasAlphaChannel_(hasAlphaChannel),
+  canScale_(canScale)
+{
+}
+
+bool ReaderTileSource::hasLevel(int iLevel) const
+{
+  return iLevel == 0 || canScale_;
+}
+
+QImage ReaderTileSource::read(const QRect& rect, int iLevel) const
+{
+  QImageReader reader(filename_);  // readers are not thread-safe, so every read gets its own one
+  if (iLevel == 0) {
+    reader.setClipRect(rect);
+  }
+  else {
+    reader.setScaledSize(levelSize(size_, iLevel));
+    reader.setScaledClipRect(rect);
+  }
+  return reader.read();
+}
+
+}  // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Factory
+
+TileSource* openTileSource(const QString& filename)
+{
+  TileSource* source = TiffTileSource::open(filename);
+  if (source)
+    return source;
+  source = RawTileSource::open(filename);
+  if (source)
+    return source;
+
+  QImageReader reader(filename);
+  QSize size = reader.size();
+  if (   size.isValid() && qint64(size.width()) * size.height() > maxFullyDecodedPixels
+      && reader.supportsOption(QImageIOHandler::ClipRect)) {
+    bool hasAlphaChannel = (reader.imageFormat() == QImage::Format_ARGB32 || reader.imageFormat() == QImage::Format_ARGB32_Premultiplied);
+    bool canScale = reader.supportsOption(QImageIOHandler::ScaledSize) && reader.supportsOption(QImageIOHandler::ScaledClipRect);
+    return new ReaderTileSource(filename, size, hasAlphaChannel, canScale);
+  }
+
+  QImage image;
+  if (!reader.read(&image))
+    return 0;
+  return new ImageTileSource(image);
+}
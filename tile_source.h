@@ -0,0 +1,47 @@
+#ifndef TILE_SOURCE_H
+#define TILE_SOURCE_H
+
+#include <QImage>
+#include <QString>
+
+// Decodes parts of an image on request, so that huge images never have to be held in memory as a whole.
+// Implementations must be thread-safe: tiles are read from worker threads.
+
+class TileSource
+{
+public:
+  virtual ~TileSource();
+
+  virtual QSize size() const = 0;
+  virtual bool hasAlphaChannel() const = 0;
+
+  // Some formats store reduced copies of the image. Level n is 2^n times smaller than the original, see levelSize.
+  virtual bool hasLevel(int iLevel) const;
+
+  // Rect is in coordinates of the level and lies within it. Returns a null image on error.
+  virtual QImage read(const QRect& rect, int iLevel = 0) const = 0;
+};
+
+// Size of the image reduced 2^iLevel times: halved iLevel times rounding up
+QSize levelSize(QSize originalSize, int iLevel);
+
+// Picks a reader that can decode the file in parts, or decodes the whole file if there is no such reader.
+// Returns 0 if the file cannot be read.
+TileSource* openTileSource(const QString& filename);
+
+
+// Image that is already in memory
+class ImageTileSource : public TileSource
+{
+public:
+  explicit ImageTileSource(const QImage& image);
+
+  virtual QSize size() const            { return image_.size(); }
+  virtual bool hasAlphaChannel() const  { return image_.hasAlphaChannel(); }
+  virtual QImage read(const QRect& rect, int iLevel = 0) const;
+
+private:
+  QImage image_;
+};
+
+#endif // TILE_SOURCE_H
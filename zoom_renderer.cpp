@@ -0,0 +1,107 @@
+#include <QPainter>
+#include <QtConcurrentRun>
+
+#include "image_pyramid.h"
+#include "zoom_renderer.h"
+
+
+const int bandHeight = 64;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Worker
+
+// Runs in a worker thread. Returns a null image if the job became stale before it was done.
+static QImage renderSmooth(const ImagePyramid* pyramid, QRect targetRect, double scale,
+                           QAtomicInt* generation, int jobGeneration)
+{
+  QImage result(targetRect.size(), QImage::Format_ARGB32_Premultiplied);
+  result.fill(0);  // transparent parts of the image are drawn over it
+  QPainter painter(&result);
+  painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+  painter.translate(-targetRect.topLeft());
+  for (int y = targetRect.top(); y <= targetRect.bottom(); y += bandHeight) {
+    if (*generation != jobGeneration)
+      return QImage();
+    QRect band(targetRect.left(), y, targetRect.width(), qMin(bandHeight, targetRect.bottom() + 1 - y));
+    painter.setClipRect(band);
+    pyramid->draw(painter, band, scale);
+  }
+  return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ZoomRenderer
+
+ZoomRenderer::ZoomRenderer(const ImagePyramid* pyramid, QObject* parent) :
+  QObject(parent),
+  pyramid_(pyramid),
+  generation_(0),
+  pendingScale_(0.),
+  resultScale_(0.)
+{
+  connect(&watcher_, SIGNAL(finished()), this, SLOT(jobFinished()));
+}
+
+ZoomRenderer::~ZoomRenderer()
+{
+  cancel();
+  foreach (QFuture<QImage> job, runningJobs_)
+    job.waitForFinished();
+}
+
+
+bool ZoomRenderer::draw(QPainter& painter, const QRect& targetRect, double scale) const
+{
+  if (result_.isNull() || resultScale_ != scale || !resultRect_.contains(targetRect))
+    return false;
+  painter.drawImage(targetRect.topLeft(), result_, targetRect.translated(-resultRect_.topLeft()));
+  return true;
+}
+
+void ZoomRenderer::request(const QRect& targetRect, double scale)
+{
+  if (targetRect.isEmpty())
+    return;
+  if (pendingScale_ == scale && pendingRect_.contains(targetRect))
+    return;
+  if (resultScale_ != scale)
+    result_ = QImage();
+
+  int jobGeneration = generation_.fetchAndAddOrdered(1) + 1;
+  pendingRect_ = targetRect;
+  pendingScale_ = scale;
+  QFuture<QImage> job = QtConcurrent::run(renderSmooth, pyramid_, targetRect, scale, &generation_, jobGeneration);
+  watcher_.setFuture(job);
+
+  QList<QFuture<QImage> > stillRunning;
+  foreach (QFuture<QImage> oldJob, runningJobs_)
+    if (oldJob.isRunning())
+      stillRunning.append(oldJob);
+  runningJobs_ = stillRunning;
+  runningJobs_.append(job);
+}
+
+void ZoomRenderer::cancel()
+{
+  generation_.fetchAndAddOrdered(1);
+  pendingRect_ = QRect();
+  pendingScale_ = 0.;
+}
+
+
+void ZoomRenderer::jobFinished()
+{
+  if (!watcher_.isFinished())  // a late notification from a job that has already been replaced
+    return;
+  QImage result = watcher_.result();
+  if (result.isNull() || pendingRect_.isEmpty())
+    return;
+  result_ = result;
+  resultRect_ = pendingRect_;
+  resultScale_ = pendingScale_;
+  pendingRect_ = QRect();
+  pendingScale_ = 0.;
+  emit updated(resultRect_);
+}
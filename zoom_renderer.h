@@ -0,0 +1,47 @@
+#ifndef ZOOM_RENDERER_H
+#define ZOOM_RENDERER_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QList>
+#include <QObject>
+
+class ImagePyramid;
+class QPainter;
+
+// Renders smooth-filtered parts of a scaled image on a worker thread.
+// Until the result is ready the caller is expected to draw a cheap preview; stale jobs are cancelled by newer requests.
+
+class ZoomRenderer : public QObject
+{
+  Q_OBJECT
+
+public:
+  ZoomRenderer(const ImagePyramid* pyramid, QObject* parent = 0);
+  ~ZoomRenderer();
+
+  // Returns false if there is no smooth image for the rect, nothing is drawn in this case
+  bool draw(QPainter& painter, const QRect& targetRect, double scale) const;
+  void request(const QRect& targetRect, double scale);
+  void cancel();
+
+signals:
+  void updated(const QRect& rect);
+
+private:
+  const ImagePyramid* pyramid_;
+  QAtomicInt generation_;
+  QFutureWatcher<QImage> watcher_;
+  QList<QFuture<QImage> > runningJobs_;
+  QRect pendingRect_;
+  double pendingScale_;
+  QImage result_;
+  QRect resultRect_;
+  double resultScale_;
+
+private slots:
+  void jobFinished();
+};
+
+#endif // ZOOM_RENDERER_H